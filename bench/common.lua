@@ -0,0 +1,83 @@
+--[[
+	Shared helpers of the benchmark suite.
+	Every result is printed as one JSON object per line so runs can be compared by scripts.
+--]]
+local zmq = require 'zmq'
+
+local M = {}
+
+M.transports = {'inproc', 'ipc', 'tcp'}
+
+-- ipc endpoints are not available on Windows
+local windows = package.config:sub(1, 1) == '\\'
+
+local port = tonumber(os.getenv('LUAZMQ_BENCH_PORT')) or 15555
+
+-- returns an endpoint for the transport or nil if it's not supported
+M.endpoint = function(transport, name)
+	if transport == 'inproc' then
+		return ('inproc://bench_%s'):format(name)
+	elseif transport == 'ipc' then
+		if windows then
+			return nil
+		end
+		return ('ipc:///tmp/luazmq_bench_%s'):format(name)
+	elseif transport == 'tcp' then
+		port = port + 1
+		return ('tcp://127.0.0.1:%d'):format(port)
+	end
+end
+
+-- output file, stdout by default
+M.output = io.stdout
+
+local function encode(value)
+	local t = type(value)
+	if t == 'number' then
+		if value ~= value or value == math.huge or value == -math.huge then
+			return 'null'
+		elseif math.floor(value) == value then
+			return ('%d'):format(value)
+		end
+		return ('%.6g'):format(value)
+	elseif t == 'boolean' then
+		return tostring(value)
+	elseif t == 'nil' then
+		return 'null'
+	end
+	return ('%q'):format(tostring(value)):gsub('\\\n', '\\n')
+end
+
+--[[
+	Writes one result. Fields are written in the order of keys list,
+	common fields: bench, api, transport, size, messages, seconds, msgs_per_sec, p50_ns, p99_ns
+--]]
+local keys = {'bench', 'api', 'transport', 'sockets', 'size', 'messages', 'seconds', 'msgs_per_sec', 'p50_ns', 'p99_ns', 'max_ns', 'error'}
+
+M.report = function(result)
+	local fields = {}
+	for _, key in ipairs(keys) do
+		if result[key] ~= nil then
+			table.insert(fields, ('"%s":%s'):format(key, encode(result[key])))
+		end
+	end
+	M.output:write('{', table.concat(fields, ','), '}\n')
+	M.output:flush()
+end
+
+-- adds latency percentiles of a histogram into a result
+M.percentiles = function(result, histogram)
+	local s = histogram.summary()
+	result.p50_ns = s.p50
+	result.p99_ns = s.p99
+	result.max_ns = s.max
+	return result
+end
+
+M.context = function()
+	local context = assert(zmq.context())
+	context.options.MAX_SOCKETS = 4096
+	return context
+end
+
+return M
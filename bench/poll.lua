@@ -0,0 +1,83 @@
+--[[
+	Cost of zmq.poll dispatch with 1 to 1000 sockets.
+	One PUSH socket sends to N PULL sockets (round robin), each message is received
+	in a poll callback. Every dispatch call is recorded into a histogram.
+
+	Usage: lua poll.lua [messages]
+--]]
+local dir = (arg and arg[0] or ''):match('^(.*[/\\])') or ''
+package.path = dir .. '?.lua;' .. package.path
+
+local zmq = require 'zmq'
+local bench = require 'common'
+
+local N = tonumber(arg and arg[1]) or 100000
+local COUNTS = {1, 10, 100, 1000}
+
+local context = bench.context()
+
+local function run(transport, count)
+	local push = assert(context.socket(zmq.ZMQ_PUSH))
+	push.options.LINGER = 0
+	local sockets = {}
+	local received = 0
+	local poll = zmq.poll()
+	local callback = function(socket)
+		socket.recv()
+		received = received + 1
+	end
+
+	local ok, err = pcall(function()
+		for i=1,count do
+			local endpoint = bench.endpoint(transport, ('poll_%d_%d'):format(count, i))
+			local pull = assert(context.socket(zmq.ZMQ_PULL))
+			pull.options.LINGER = 0
+			table.insert(sockets, pull)
+			assert(pull.bind(endpoint))
+			assert(push.connect(endpoint))
+			poll.add(pull, zmq.ZMQ_POLLIN, callback)
+		end
+	end)
+
+	if ok then
+		-- wait until all connections are established, round robin skips pending pipes
+		for i=1,count do
+			push.send('')
+		end
+		while received < count do
+			poll.start(100)
+		end
+
+		local histogram = zmq.histogram()
+		received = 0
+		local start = zmq.now()
+		for i=1,N do
+			push.send('x')
+			local t0 = zmq.now()
+			poll.start(-1)
+			histogram.record(zmq.now() - t0)
+		end
+		local seconds = (zmq.now() - start) / 1e9
+
+		bench.report(bench.percentiles({
+			bench = 'poll', api = 'poll.start', transport = transport, sockets = count,
+			messages = received, seconds = seconds, msgs_per_sec = received / seconds,
+		}, histogram))
+	else
+		bench.report {bench = 'poll', api = 'poll.start', transport = transport, sockets = count, error = err}
+	end
+
+	for _, socket in ipairs(sockets) do
+		poll.remove(socket)
+		socket.close()
+	end
+	push.close()
+end
+
+for _, transport in ipairs(bench.transports) do
+	if bench.endpoint(transport, 'poll_probe') then
+		for _, count in ipairs(COUNTS) do
+			run(transport, count)
+		end
+	end
+end
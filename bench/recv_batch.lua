@@ -0,0 +1,57 @@
+--[[
+	Compares per-message recv() loop with recvBatch() on small PUSH/PULL messages over inproc.
+
+	Usage: lua recv_batch.lua [messages] [batch size]
+--]]
+local zmq = require 'zmq'
+
+local N = tonumber(arg and arg[1]) or 1000000
+local BATCH = tonumber(arg and arg[2]) or 256
+local HWM = 100000
+
+local context = assert(zmq.context())
+local pull = assert(context.socket(zmq.ZMQ_PULL))
+local push = assert(context.socket(zmq.ZMQ_PUSH))
+pull.options.RCVHWM = HWM
+push.options.SNDHWM = HWM
+assert(pull.bind("inproc://recv_batch"))
+assert(push.connect("inproc://recv_batch"))
+
+local payload = "tick:EURUSD:1.0842"
+
+local function run(name, consume)
+	local received = 0
+	local elapsed = 0
+	while received < N do
+		local chunk = math.min(HWM, N - received)
+		for i=1,chunk do
+			assert(push.send(payload))
+		end
+		local start = zmq.now()
+		local got = 0
+		while got < chunk do
+			got = got + consume(chunk - got)
+		end
+		-- wall-clock time, zmq.now() is in nanoseconds
+		elapsed = elapsed + (zmq.now() - start) / 1e9
+		received = received + chunk
+	end
+	print(("%-10s %10d msgs %8.3f s %12.0f msgs/s"):format(name, N, elapsed, N / elapsed))
+	return elapsed
+end
+
+local single = run('recv', function(remaining)
+	assert(pull.recv())
+	return 1
+end)
+
+local t = {}
+local batched = run('recvBatch', function(remaining)
+	local _, count = assert(pull.recvBatch(math.min(BATCH, remaining), 0, t))
+	return count
+end)
+
+print(("speedup    %.2fx"):format(single / batched))
+
+push.close()
+pull.close()
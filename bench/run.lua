@@ -0,0 +1,34 @@
+--[[
+	Runs the whole benchmark suite, results are written as JSON lines.
+
+	Usage: lua run.lua [output file] [scale]
+	Scale multiplies the default number of messages, e.g. 0.1 for a quick run.
+--]]
+local dir = (arg and arg[0] or ''):match('^(.*[/\\])') or ''
+package.path = dir .. '?.lua;' .. package.path
+
+local bench = require 'common'
+local outputName = arg and arg[1]
+local scale = tonumber(arg and arg[2]) or 1
+
+if outputName and outputName ~= '-' then
+	bench.output = assert(io.open(outputName, 'w'))
+end
+
+local suites = {
+	{'sendrecv.lua', 200000},
+	{'poll.lua', 100000},
+	{'thread_spawn.lua', 200},
+}
+
+for _, suite in ipairs(suites) do
+	local name, messages = suite[1], suite[2]
+	local chunk = assert(loadfile(dir .. name))
+	arg = {[0] = dir .. name, tostring(math.max(1, math.floor(messages * scale)))}
+	chunk(unpack(arg))
+	collectgarbage()
+end
+
+if bench.output ~= io.stdout then
+	bench.output:close()
+end
@@ -0,0 +1,73 @@
+--[[
+	Compares per-message send() loop with sendBatch() on small PUSH/PULL messages over inproc.
+
+	Usage: lua send_batch.lua [messages] [batch size]
+--]]
+local zmq = require 'zmq'
+
+local N = tonumber(arg and arg[1]) or 1000000
+local BATCH = tonumber(arg and arg[2]) or 256
+local HWM = 100000
+
+local context = assert(zmq.context())
+local pull = assert(context.socket(zmq.ZMQ_PULL))
+local push = assert(context.socket(zmq.ZMQ_PUSH))
+pull.options.RCVHWM = HWM
+push.options.SNDHWM = HWM
+assert(pull.bind("inproc://send_batch"))
+assert(push.connect("inproc://send_batch"))
+
+local payload = "tick:EURUSD:1.0842"
+local batch = {}
+for i=1,BATCH do
+	batch[i] = payload
+end
+
+local function drain(count)
+	local t = {}
+	local got = 0
+	while got < count do
+		local _, n = assert(pull.recvBatch(count - got, 0, t))
+		got = got + n
+	end
+end
+
+local function run(name, produce)
+	local sent = 0
+	local elapsed = 0
+	while sent < N do
+		local chunk = math.min(HWM, N - sent)
+		local start = zmq.now()
+		local done = 0
+		while done < chunk do
+			done = done + produce(chunk - done)
+		end
+		-- wall-clock time, zmq.now() is in nanoseconds
+		elapsed = elapsed + (zmq.now() - start) / 1e9
+		drain(chunk)
+		sent = sent + chunk
+	end
+	print(("%-10s %10d msgs %8.3f s %12.0f msgs/s"):format(name, N, elapsed, N / elapsed))
+	return elapsed
+end
+
+local single = run('send', function(remaining)
+	assert(push.send(payload))
+	return 1
+end)
+
+local batched = run('sendBatch', function(remaining)
+	if remaining < BATCH then
+		local t = {}
+		for i=1,remaining do
+			t[i] = payload
+		end
+		return assert(push.sendBatch(t, zmq.ZMQ_DONTWAIT))
+	end
+	return assert(push.sendBatch(batch, zmq.ZMQ_DONTWAIT))
+end)
+
+print(("speedup    %.2fx"):format(single / batched))
+
+push.close()
+pull.close()
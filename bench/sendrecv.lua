@@ -0,0 +1,148 @@
+--[[
+	Throughput and round trip latency of send/recv, sendMultipart/recvMultipart, msg send/recv
+	and message objects created per frame
+	over inproc, ipc and loopback tcp.
+
+	Throughput: PUSH/PULL in one thread, messages are sent in chunks below the high water mark
+	and then drained. Latency: REQ/REP ping-pong, each round trip is recorded into a histogram.
+
+	Usage: lua sendrecv.lua [messages] [size]
+--]]
+local dir = (arg and arg[0] or ''):match('^(.*[/\\])') or ''
+package.path = dir .. '?.lua;' .. package.path
+
+local zmq = require 'zmq'
+local bench = require 'common'
+
+local N = tonumber(arg and arg[1]) or 200000
+local SIZE = tonumber(arg and arg[2]) or 64
+local ROUNDTRIPS = math.max(1, math.floor(N / 10))
+local HWM = 100000
+local CHUNK = 10000
+
+local payload = ('x'):rep(SIZE)
+local half = payload:sub(1, math.floor(SIZE / 2))
+local parts = {half, payload:sub(#half + 1)}
+
+-- every api has a sender and a receiver, both are created for a pair of sockets
+local apis = {
+	{'send', function(push, pull)
+		return function()
+			push.send(payload)
+		end, function()
+			pull.recv()
+		end
+	end},
+	{'multipart', function(push, pull)
+		return function()
+			push.sendMultipart(parts)
+		end, function()
+			pull.recvMultipart()
+		end
+	end},
+	{'msg', function(push, pull)
+		local out = push.msg(SIZE)
+		local input = pull.msg()
+		return function()
+			out:setData(payload)
+			out:send(push)
+		end, function()
+			input:recv(pull)
+			return input:data()
+		end
+	end},
+	-- a new message object per frame, measures message allocation and collection
+	{'msgObject', function(push, pull)
+		return function()
+			zmq.msg(payload):send(push)
+		end, function()
+			return pull.recvMsg():size()
+		end
+	end},
+}
+
+local context = bench.context()
+
+local function pair(transport, name, serverType, clientType)
+	local endpoint = bench.endpoint(transport, name)
+	if not endpoint then
+		return nil
+	end
+	local server = assert(context.socket(serverType))
+	local client = assert(context.socket(clientType))
+	server.options.RCVHWM = HWM
+	client.options.SNDHWM = HWM
+	server.options.LINGER = 0
+	client.options.LINGER = 0
+	assert(server.bind(endpoint))
+	assert(client.connect(endpoint))
+	return client, server
+end
+
+local function throughput(transport, api, setup)
+	local push, pull = pair(transport, 'throughput_' .. api, zmq.ZMQ_PULL, zmq.ZMQ_PUSH)
+	if not push then
+		return
+	end
+	local send, recv = setup(push, pull)
+
+	-- warm up the connection
+	send()
+	recv()
+
+	local sent = 0
+	local start = zmq.now()
+	while sent < N do
+		local chunk = math.min(CHUNK, N - sent)
+		for i=1,chunk do
+			send()
+		end
+		for i=1,chunk do
+			recv()
+		end
+		sent = sent + chunk
+	end
+	local seconds = (zmq.now() - start) / 1e9
+
+	bench.report {
+		bench = 'throughput', api = api, transport = transport, size = SIZE,
+		messages = N, seconds = seconds, msgs_per_sec = N / seconds,
+	}
+	push.close()
+	pull.close()
+end
+
+local function latency(transport, api, setup)
+	local req, rep = pair(transport, 'latency_' .. api, zmq.ZMQ_REP, zmq.ZMQ_REQ)
+	if not req then
+		return
+	end
+	local requestSend, replyRecv = setup(req, rep)
+	local replySend, requestRecv = setup(rep, req)
+	local histogram = zmq.histogram()
+
+	local start = zmq.now()
+	for i=1,ROUNDTRIPS do
+		local t0 = zmq.now()
+		requestSend()
+		replyRecv()
+		replySend()
+		requestRecv()
+		histogram.record(zmq.now() - t0)
+	end
+	local seconds = (zmq.now() - start) / 1e9
+
+	bench.report(bench.percentiles({
+		bench = 'latency', api = api, transport = transport, size = SIZE,
+		messages = ROUNDTRIPS, seconds = seconds, msgs_per_sec = ROUNDTRIPS / seconds,
+	}, histogram))
+	req.close()
+	rep.close()
+end
+
+for _, transport in ipairs(bench.transports) do
+	for _, api in ipairs(apis) do
+		throughput(transport, api[1], api[2])
+		latency(transport, api[1], api[2])
+	end
+end
@@ -0,0 +1,34 @@
+--[[
+	Cost of starting and joining a thread2 worker with a preloaded Lua state.
+	Each sample covers thread creation, state setup, running an empty function and join.
+
+	Usage: lua thread_spawn.lua [threads]
+--]]
+local dir = (arg and arg[0] or ''):match('^(.*[/\\])') or ''
+package.path = dir .. '?.lua;' .. package.path
+
+local zmq = require 'zmq'
+local bench = require 'common'
+
+local N = tonumber(arg and arg[1]) or 200
+
+local context = bench.context()
+local histogram = zmq.histogram()
+
+local worker = function(context, i)
+	return i
+end
+
+local start = zmq.now()
+for i=1,N do
+	local t0 = zmq.now()
+	local thread = assert(context.thread2(worker, i))
+	thread.join()
+	histogram.record(zmq.now() - t0)
+end
+local seconds = (zmq.now() - start) / 1e9
+
+bench.report(bench.percentiles({
+	bench = 'spawn', api = 'thread2', transport = 'inproc',
+	messages = N, seconds = seconds, msgs_per_sec = N / seconds,
+}, histogram))
@@ -0,0 +1,207 @@
+/*
+	LuaZMQ - Lua binding for ZeroMQ library
+
+	Copyright 2013, 2014, 2015 Mário Kašuba
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are
+	met:
+
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+	"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+	A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+	OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+	SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+	LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "common.h"
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "main.h"
+#include "queue.h"
+#include "shared.h"
+
+namespace LuaZMQ {
+	/*
+		Channel passes ownership of zmq_msg_t objects between Lua states in the same process.
+		Message content is moved with zmq_msg_move so only message handles go through the queue,
+		payload is never copied. Queue cells hold zmq_msg_t by value (libzmq pipes relocate
+		zmq_msg_t the same way), so pushing and popping a message allocates nothing.
+		Channel is reference counted, every channel userdata holds one reference.
+	*/
+	struct msgChannel_t {
+		std::atomic<int> references;
+		mpmcQueue<zmq_msg_t> queue;
+		//consumers waiting for a message in channelPop with timeout
+		std::atomic<int> waiters;
+		std::mutex m;
+		std::condition_variable cv;
+
+		explicit msgChannel_t(size_t capacity) : references(1), queue(capacity), waiters(0) {}
+	};
+
+	const size_t defaultChannelCapacity = 1024;
+
+	static void lua_zmqChannelRelease(msgChannel_t * channel){
+		if (channel && (--channel->references == 0)){
+			zmq_msg_t msg;
+			while (channel->queue.pop(msg)){
+				zmq_msg_close(&msg);
+			}
+			delete channel;
+		}
+	}
+
+	static void lua_zmqChannelAcquireShared(void * channel){
+		static_cast<msgChannel_t *>(channel)->references++;
+	}
+
+	static void lua_zmqChannelReleaseShared(void * channel){
+		lua_zmqChannelRelease(static_cast<msgChannel_t *>(channel));
+	}
+
+	const sharedObjectType_t channelObjectType = {lua_zmqChannelAcquireShared, lua_zmqChannelReleaseShared};
+
+	int lua_zmqChannelNew(lutok2::State & state){
+		Stack * stack = state.stack;
+		size_t capacity = defaultChannelCapacity;
+		if (stack->is<LUA_TNUMBER>(1) && (stack->to<int>(1) > 0)){
+			capacity = static_cast<size_t>(stack->to<int>(1));
+		}
+		lua_zmqPushSharedObject(state, new msgChannel_t(capacity), &channelObjectType);
+		return 1;
+	}
+
+	int lua_zmqChannelFree(lutok2::State & state){
+		return lua_zmqSharedObjectFree(state);
+	}
+
+	//freed channels and closed messages keep a null pointer
+	static int lua_zmqChannelPushError(lutok2::State & state, const char * message){
+		Stack * stack = state.stack;
+		stack->push<bool>(false);
+		stack->push<const std::string &>(message);
+		return 2;
+	}
+
+	/*
+		Moves message content into the channel. Source message object stays valid and empty.
+		Returns false and "full" if the channel is full.
+	*/
+	int lua_zmqChannelPush(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TUSERDATA>(2)){
+			msgChannel_t * channel = static_cast<msgChannel_t *>(getZMQobject(1));
+			zmq_msg_t * source = static_cast<zmq_msg_t *>(getZMQobject(2));
+			if (!channel){
+				return lua_zmqChannelPushError(state, "channel is closed");
+			}
+			if (!source){
+				return lua_zmqChannelPushError(state, "message is closed");
+			}
+			zmq_msg_t msg;
+
+			zmq_msg_init(&msg);
+			if (zmq_msg_move(&msg, source) != 0){
+				zmq_msg_close(&msg);
+				stack->push<bool>(false);
+				lua_pushZMQ_error(state);
+				return 2;
+			}
+
+			if (!channel->queue.push(msg)){
+				zmq_msg_move(source, &msg);
+				zmq_msg_close(&msg);
+				stack->push<bool>(false);
+				stack->push<const std::string &>("full");
+				return 2;
+			}
+
+			//pairs with the fence in lua_zmqChannelPop so that a waiting consumer can't miss this message
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (channel->waiters.load() > 0){
+				std::lock_guard<std::mutex> lk(channel->m);
+				channel->cv.notify_one();
+			}
+			stack->push<bool>(true);
+			return 1;
+		}
+		return 0;
+	}
+
+	/*
+		Takes the oldest message from the channel and moves it into a new message object.
+		Waits up to timeout milliseconds (-1 - indefinitely) if the channel is empty,
+		by default it doesn't wait at all and returns nil.
+	*/
+	int lua_zmqChannelPop(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			msgChannel_t * channel = static_cast<msgChannel_t *>(getZMQobject(1));
+			if (!channel){
+				return lua_zmqChannelPushError(state, "channel is closed");
+			}
+			int timeout = 0;
+			if (stack->is<LUA_TNUMBER>(2)){
+				timeout = stack->to<int>(2);
+			}
+
+			zmq_msg_t msg;
+			bool found = channel->queue.pop(msg);
+
+			if (!found && (timeout != 0)){
+				auto ready = [&]{ return channel->queue.pop(msg); };
+
+				channel->waiters++;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				{
+					std::unique_lock<std::mutex> lk(channel->m);
+					if (timeout < 0){
+						channel->cv.wait(lk, ready);
+						found = true;
+					}else{
+						found = channel->cv.wait_for(lk, std::chrono::milliseconds(timeout), ready);
+					}
+				}
+				channel->waiters--;
+			}
+
+			if (found){
+				zmq_msg_move(lua_zmqPushMsgObject(state), &msg);
+				zmq_msg_close(&msg);
+			}else{
+				stack->pushNil();
+			}
+			return 1;
+		}
+		return 0;
+	}
+
+	int lua_zmqChannelSize(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			msgChannel_t * channel = static_cast<msgChannel_t *>(getZMQobject(1));
+			if (!channel){
+				return lua_zmqChannelPushError(state, "channel is closed");
+			}
+			stack->push<LUA_NUMBER>(static_cast<LUA_NUMBER>(channel->queue.size()));
+			return 1;
+		}
+		return 0;
+	}
+};
@@ -50,4 +50,14 @@ using namespace lutok2;
 
 #define _alloca	alloca
 
-#endif
\ No newline at end of file
+#endif
+
+#define getZMQobject(n) *(static_cast<void**>(stack->to<void*>((n))))
+#define pushUData(v) {void ** s = static_cast<void**>(stack->newUserData(sizeof(void*))); *s = (v); stack->newTable(); stack->setMetatable();}
+#define pushSocket(v) {void ** s = static_cast<void**>(stack->newUserData(sizeof(void*)));	*s = (v); stack->newTable(); stack->setField<void*>("__raw", (v)); stack->setMetatable();}
+
+namespace LuaZMQ {
+	inline void lua_pushZMQ_error(lutok2::State & state){
+		state.stack->push<const std::string &>(zmq_strerror(zmq_errno()));
+	}
+};
@@ -0,0 +1,240 @@
+/*
+	LuaZMQ - Lua binding for ZeroMQ library
+
+	Copyright 2013, 2014, 2015 Mário Kašuba
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are
+	met:
+
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+	"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+	A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+	OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+	SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+	LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "common.h"
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <stdint.h>
+#include "main.h"
+#include "histogram.h"
+#include "shared.h"
+
+namespace LuaZMQ {
+	static void lua_zmqHistogramClear(histogram_t * histogram){
+		histogram->count.store(0, std::memory_order_relaxed);
+		histogram->sum.store(0, std::memory_order_relaxed);
+		histogram->min.store(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+		histogram->max.store(0, std::memory_order_relaxed);
+		for (size_t index = 0; index < histogramBuckets; index++){
+			histogram->buckets[index].store(0, std::memory_order_relaxed);
+		}
+	}
+
+	histogram_t * lua_zmqHistogramCreate(){
+		histogram_t * histogram = new histogram_t;
+		histogram->references = 1;
+		lua_zmqHistogramClear(histogram);
+		return histogram;
+	}
+
+	void lua_zmqHistogramRelease(histogram_t * histogram){
+		if (--histogram->references == 0){
+			delete histogram;
+		}
+	}
+
+	static void lua_zmqHistogramAcquireShared(void * histogram){
+		static_cast<histogram_t *>(histogram)->references++;
+	}
+
+	static void lua_zmqHistogramReleaseShared(void * histogram){
+		lua_zmqHistogramRelease(static_cast<histogram_t *>(histogram));
+	}
+
+	//histograms recorded in worker threads are handed over as shared objects (shared.h), see zmq.histogram(ud)
+	const sharedObjectType_t histogramObjectType = {lua_zmqHistogramAcquireShared, lua_zmqHistogramReleaseShared};
+
+	//middle of the value range covered by a bucket
+	static uint64_t lua_zmqHistogramBucketValue(size_t index){
+		if (index < histogramSubCount){
+			return index;
+		}
+		uint64_t offset = index - histogramSubCount;
+		int msb = static_cast<int>(offset / histogramHalfCount) + histogramSubBits;
+		uint64_t mantissa = (offset % histogramHalfCount) + histogramHalfCount;
+		int shift = msb - (histogramSubBits - 1);
+		return (mantissa << shift) + (((static_cast<uint64_t>(1) << shift) - 1) / 2);
+	}
+
+	//converts a Lua number into uint64_t, NaN and negative numbers give 0, fractions are truncated
+	static uint64_t lua_zmqHistogramToUnsigned(double value){
+		const double limit = static_cast<double>(std::numeric_limits<uint64_t>::max());
+		if (!(value > 0.0)){
+			return 0;
+		}else if (value >= limit){
+			return std::numeric_limits<uint64_t>::max();
+		}
+		return static_cast<uint64_t>(value);
+	}
+
+	/*
+		Value at given percentile (0-100), clamped into recorded min and max.
+		Buckets are read without locking, concurrent recording may shift the result by a few samples.
+	*/
+	static uint64_t lua_zmqHistogramPercentile(histogram_t * histogram, double percentile){
+		uint64_t count = histogram->count.load(std::memory_order_relaxed);
+		if (count == 0){
+			return 0;
+		}
+		if (!(percentile >= 0.0)){
+			percentile = 0.0;
+		}else if (percentile > 100.0){
+			percentile = 100.0;
+		}
+		uint64_t target = lua_zmqHistogramToUnsigned(percentile / 100.0 * static_cast<double>(count) + 0.5);
+		if (target < 1){
+			target = 1;
+		}
+
+		uint64_t total = 0;
+		uint64_t value = histogram->max.load(std::memory_order_relaxed);
+		for (size_t index = 0; index < histogramBuckets; index++){
+			total += histogram->buckets[index].load(std::memory_order_relaxed);
+			if (total >= target){
+				value = lua_zmqHistogramBucketValue(index);
+				break;
+			}
+		}
+		uint64_t min = histogram->min.load(std::memory_order_relaxed);
+		uint64_t max = histogram->max.load(std::memory_order_relaxed);
+		return (value < min) ? min : ((value > max) ? max : value);
+	}
+
+	int lua_zmqHistogramNew(lutok2::State & state){
+		lua_zmqPushSharedObject(state, lua_zmqHistogramCreate(), &histogramObjectType);
+		return 1;
+	}
+
+	int lua_zmqHistogramFree(lutok2::State & state){
+		return lua_zmqSharedObjectFree(state);
+	}
+
+	/*
+		Records a value: histogramRecord(histogram, value, count)
+		Negative and NaN values are ignored, fractions are truncated and values over UINT64_MAX are clamped.
+	*/
+	int lua_zmqHistogramRecordLua(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TNUMBER>(2)){
+			LUA_NUMBER value = stack->to<LUA_NUMBER>(2);
+			uint64_t count = 1;
+			if (stack->is<LUA_TNUMBER>(3)){
+				count = lua_zmqHistogramToUnsigned(stack->to<LUA_NUMBER>(3));
+			}
+			if ((value >= 0) && (count > 0)){
+				lua_zmqHistogramRecord(static_cast<histogram_t *>(getZMQobject(1)), lua_zmqHistogramToUnsigned(value), count);
+			}
+		}
+		return 0;
+	}
+
+	//adds all values of the second histogram into the first one
+	int lua_zmqHistogramMerge(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TUSERDATA>(2)){
+			histogram_t * histogram = static_cast<histogram_t *>(getZMQobject(1));
+			histogram_t * other = static_cast<histogram_t *>(getZMQobject(2));
+			if (histogram == other){
+				return 0;
+			}
+			for (size_t index = 0; index < histogramBuckets; index++){
+				uint64_t count = other->buckets[index].load(std::memory_order_relaxed);
+				if (count > 0){
+					histogram->buckets[index].fetch_add(count, std::memory_order_relaxed);
+				}
+			}
+			histogram->count.fetch_add(other->count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			histogram->sum.fetch_add(other->sum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+			uint64_t value = other->min.load(std::memory_order_relaxed);
+			uint64_t current = histogram->min.load(std::memory_order_relaxed);
+			while ((value < current) && !histogram->min.compare_exchange_weak(current, value, std::memory_order_relaxed)){
+			}
+			value = other->max.load(std::memory_order_relaxed);
+			current = histogram->max.load(std::memory_order_relaxed);
+			while ((value > current) && !histogram->max.compare_exchange_weak(current, value, std::memory_order_relaxed)){
+			}
+		}
+		return 0;
+	}
+
+	//returns values at all given percentiles: histogramPercentile(histogram, 50, 99, ...)
+	int lua_zmqHistogramPercentileLua(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			histogram_t * histogram = static_cast<histogram_t *>(getZMQobject(1));
+			int count = stack->getTop() - 1;
+			if (!stack->checkStack(count)){
+				return 0;
+			}
+			for (int index = 0; index < count; index++){
+				double percentile = stack->is<LUA_TNUMBER>(2 + index) ? stack->to<LUA_NUMBER>(2 + index) : 50.0;
+				stack->push<LUA_NUMBER>(static_cast<LUA_NUMBER>(lua_zmqHistogramPercentile(histogram, percentile)));
+			}
+			return count;
+		}
+		return 0;
+	}
+
+	//summary: {count, min, max, mean, p50, p90, p99, p999}
+	int lua_zmqHistogramSummary(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			histogram_t * histogram = static_cast<histogram_t *>(getZMQobject(1));
+			uint64_t count = histogram->count.load(std::memory_order_relaxed);
+			stack->newTable();
+			stack->setField<LUA_NUMBER>("count", static_cast<LUA_NUMBER>(count));
+			stack->setField<LUA_NUMBER>("min", (count > 0) ? static_cast<LUA_NUMBER>(histogram->min.load(std::memory_order_relaxed)) : 0);
+			stack->setField<LUA_NUMBER>("max", static_cast<LUA_NUMBER>(histogram->max.load(std::memory_order_relaxed)));
+			stack->setField<LUA_NUMBER>("mean", (count > 0) ? static_cast<LUA_NUMBER>(histogram->sum.load(std::memory_order_relaxed)) / count : 0);
+			stack->setField<LUA_NUMBER>("p50", static_cast<LUA_NUMBER>(lua_zmqHistogramPercentile(histogram, 50.0)));
+			stack->setField<LUA_NUMBER>("p90", static_cast<LUA_NUMBER>(lua_zmqHistogramPercentile(histogram, 90.0)));
+			stack->setField<LUA_NUMBER>("p99", static_cast<LUA_NUMBER>(lua_zmqHistogramPercentile(histogram, 99.0)));
+			stack->setField<LUA_NUMBER>("p999", static_cast<LUA_NUMBER>(lua_zmqHistogramPercentile(histogram, 99.9)));
+			return 1;
+		}
+		return 0;
+	}
+
+	int lua_zmqHistogramReset(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			lua_zmqHistogramClear(static_cast<histogram_t *>(getZMQobject(1)));
+		}
+		return 0;
+	}
+
+	//monotonic clock in nanoseconds, used to time code without allocating stopwatch objects
+	int lua_zmqNow(lutok2::State & state){
+		Stack * stack = state.stack;
+		stack->push<LUA_NUMBER>(static_cast<LUA_NUMBER>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()));
+		return 1;
+	}
+};
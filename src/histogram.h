@@ -0,0 +1,68 @@
+#ifndef LUAZMQ_HISTOGRAM_H
+#define LUAZMQ_HISTOGRAM_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace LuaZMQ {
+	/*
+		Log-linear histogram of non-negative integer values (HDR histogram layout).
+		Values below 2^histogramSubBits have their own buckets, every higher power of two range
+		is split into 2^(histogramSubBits-1) linear buckets, so the relative error stays below 1/64.
+		Memory is fixed, recording is a single relaxed atomic add, so one histogram can be
+		shared by several threads.
+	*/
+	const int histogramSubBits = 7;
+	const uint64_t histogramSubCount = 1u << histogramSubBits;
+	const uint64_t histogramHalfCount = histogramSubCount / 2;
+	const size_t histogramBuckets = static_cast<size_t>(histogramSubCount + (64 - histogramSubBits) * histogramHalfCount);
+
+	struct histogram_t {
+		std::atomic<uint32_t> references;
+		std::atomic<uint64_t> count;
+		std::atomic<uint64_t> sum;
+		std::atomic<uint64_t> min;
+		std::atomic<uint64_t> max;
+		std::atomic<uint64_t> buckets[histogramBuckets];
+	};
+
+	inline int lua_zmqHistogramMSB(uint64_t value){
+#if defined(__GNUC__)
+		return 63 - __builtin_clzll(value);
+#else
+		int msb = 0;
+		while (value >>= 1){
+			msb++;
+		}
+		return msb;
+#endif
+	}
+
+	inline size_t lua_zmqHistogramIndex(uint64_t value){
+		if (value < histogramSubCount){
+			return static_cast<size_t>(value);
+		}
+		int msb = lua_zmqHistogramMSB(value);
+		uint64_t mantissa = value >> (msb - (histogramSubBits - 1));
+		return static_cast<size_t>(histogramSubCount + (msb - histogramSubBits) * histogramHalfCount + (mantissa - histogramHalfCount));
+	}
+
+	inline void lua_zmqHistogramRecord(histogram_t * histogram, uint64_t value, uint64_t count = 1){
+		histogram->buckets[lua_zmqHistogramIndex(value)].fetch_add(count, std::memory_order_relaxed);
+		histogram->count.fetch_add(count, std::memory_order_relaxed);
+		histogram->sum.fetch_add(value * count, std::memory_order_relaxed);
+
+		uint64_t current = histogram->min.load(std::memory_order_relaxed);
+		while ((value < current) && !histogram->min.compare_exchange_weak(current, value, std::memory_order_relaxed)){
+		}
+		current = histogram->max.load(std::memory_order_relaxed);
+		while ((value > current) && !histogram->max.compare_exchange_weak(current, value, std::memory_order_relaxed)){
+		}
+	}
+
+	histogram_t * lua_zmqHistogramCreate();
+	void lua_zmqHistogramRelease(histogram_t * histogram);
+};
+
+#endif
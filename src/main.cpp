@@ -30,23 +30,76 @@
 #include "common.h"
 #include <thread>
 #include <vector>
+#include <deque>
+#include <unordered_map>
 #include <math.h>
+#include <ctype.h>
 #include <memory.h>
 #include <stdint.h>
+#include <errno.h>
 #include <atomic>
 #include <mutex>
 #include <condition_variable>
 #include <iostream>
 #include <sstream>
+#include <algorithm>
+#include <stdexcept>
 #include "main.h"
+#include "serializer.h"
+#include "stats.h"
 
 namespace LuaZMQ {
+	/*
+		Poll items are kept in a dense array that can be passed to zmq_poll directly.
+		Every item has a stable handle (slot) and removal swaps the last item into
+		the freed position, so add, modify and remove are all O(1).
+	*/
 	struct pollArray_t {
 		std::vector<zmq_pollitem_t> items;
+		//true if the item has a callback in the callbacks table of its poll object
+		std::vector<bool> callbacks;
+		//dense index -> handle
+		std::vector<size_t> handles;
+		//handle -> dense index
+		std::vector<size_t> slots;
+		std::vector<size_t> freeSlots;
+		std::unordered_map<void *, size_t> sockets;
+		//removals requested from callbacks are applied after dispatch
+		bool dispatching;
+		std::vector<size_t> pendingRemovals;
+
+		pollArray_t() : dispatching(false) {}
 	};
 
-	inline void lua_pushZMQ_error(lutok2::State & state){
-		state.stack->push<const std::string &>(zmq_strerror(zmq_errno()));
+	const size_t invalidPollSlot = static_cast<size_t>(-1);
+
+	/*
+		Pushes message payload as a Lua string.
+		Data are copied only once - directly from message memory into Lua heap.
+	*/
+	inline void lua_pushZMQ_msgData(lutok2::State & state, zmq_msg_t * msg){
+		state.stack->pushLString(static_cast<const char *>(zmq_msg_data(msg)), zmq_msg_size(msg));
+	}
+
+	/*
+		Closed sockets keep a null pointer in their userdata. Pushes false and ENOTSOCK error message,
+		callers return before a null socket reaches stats probes or libzmq.
+	*/
+	static int lua_zmqPushClosedSocket(lutok2::State & state){
+		Stack * stack = state.stack;
+		stack->push<bool>(false);
+		stack->push<const std::string &>(zmq_strerror(ENOTSOCK));
+		return 2;
+	}
+
+	/*
+		Converts Lua string position (1-based, negative values count from the end) into absolute position.
+	*/
+	inline int lua_zmqRelativePosition(int position, size_t length){
+		if (position < 0){
+			position += static_cast<int>(length) + 1;
+		}
+		return (position >= 0) ? position : 0;
 	}
 
 	struct threadData {
@@ -63,12 +116,8 @@ namespace LuaZMQ {
 	const std::string threadSocketNamePrefix = "inproc://luathread_";
 
 #define BUFFER_SIZE	4096
-#define MAX_BUFFER_SIZE 1024*1024*16	//Maximum buffer size for recvMultipart
 
-#define getZMQobject(n) *(static_cast<void**>(stack->to<void*>((n))))
 #define getThread(n) *(static_cast<threadData **>(stack->to<void*>((n))))
-#define pushUData(v) {void ** s = static_cast<void**>(stack->newUserData(sizeof(void*))); *s = (v); stack->newTable(); stack->setMetatable();}
-#define pushSocket(v) {void ** s = static_cast<void**>(stack->newUserData(sizeof(void*)));	*s = (v); stack->newTable(); stack->setField<void*>("__raw", (v)); stack->setMetatable();}
 
 	int lua_zmqInit(lutok2::State & state){
 		void * context = zmq_ctx_new();
@@ -178,173 +227,29 @@ namespace LuaZMQ {
 		return buffer;
 	}
 
-	const int lua_zmqRecvInt(void * socket, int & more) {
-		int buffer = -1;
-		zmq_msg_t msg;
-		int rc = 0;
-
-		zmq_msg_init(&msg);
-		rc = zmq_msg_recv(&msg, socket, 0);
-		assert(rc >= 0);
-		if (zmq_msg_size(&msg) >= sizeof(buffer)) {
-			memcpy(&buffer, zmq_msg_data(&msg), sizeof(buffer));
-		}
-		more = zmq_msg_more(&msg);
-		zmq_msg_close(&msg);
-		return buffer;
-	}
-
-	const LUA_NUMBER lua_zmqRecvNumber(void * socket, int & more) {
-		LUA_NUMBER buffer = -1;
-		zmq_msg_t msg;
-		int rc = 0;
-
-		zmq_msg_init(&msg);
-		rc = zmq_msg_recv(&msg, socket, 0);
-		assert(rc >= 0);
-		if (zmq_msg_size(&msg) >= sizeof(buffer)) {
-			memcpy(&buffer, zmq_msg_data(&msg), sizeof(buffer));
-		}
-		more = zmq_msg_more(&msg);
-		zmq_msg_close(&msg);
-		return buffer;
-	}
-
-	const intptr_t lua_zmqRecvIntptr(void * socket, int & more) {
-		intptr_t buffer = -1;
+	/*
+		Thread arguments are passed in a single message frame encoded with lua_zmqEncodeValues.
+	*/
+	int lua_zmqGetThreadArguments(lutok2::State & state, void * socket) {
 		zmq_msg_t msg;
+		int argumentsCount = 0;
 		int rc = 0;
 
 		zmq_msg_init(&msg);
 		rc = zmq_msg_recv(&msg, socket, 0);
 		assert(rc >= 0);
-		if (zmq_msg_size(&msg) >= sizeof(buffer)) {
-			memcpy(&buffer, zmq_msg_data(&msg), sizeof(buffer));
-		}
-		more = zmq_msg_more(&msg);
+		argumentsCount = lua_zmqDecodeValues(state, reinterpret_cast<char*>(zmq_msg_data(&msg)), zmq_msg_size(&msg));
+		lua_zmqReleaseValues(reinterpret_cast<char*>(zmq_msg_data(&msg)), zmq_msg_size(&msg));
 		zmq_msg_close(&msg);
-		return buffer;
-	}
-
-	int lua_zmqGetThreadArguments(lutok2::State & state, void * socket) {
-		int argumentsCount = 0;
-		int rc = 0;
-		Stack * stack = state.stack;
-		int more = 0;
-		
-		std::string buffer;
-
-		buffer = lua_zmqRecvString(socket, more);
-		if ((buffer.compare("set_arguments") == 0) && more) {
-			argumentsCount = lua_zmqRecvInt(socket, more);
-		}
-
-		for (int index=0; index < argumentsCount; index++) {
-			int argumentIndex = 0;
-			int argumentType = 0;
-
-			LUA_NUMBER argumentValueNumber;
-			std::string argumentValue;
-			intptr_t argumentValuePointer;
-			void ** argumentValuePointerSpecial;
-
-			argumentIndex = lua_zmqRecvInt(socket, more);
-			if (more) {
-				argumentType = lua_zmqRecvInt(socket, more);
-				if (more) {
-					if (argumentType == LUA_TNUMBER) {
-						argumentValueNumber = lua_zmqRecvNumber(socket, more);
-					}else if ((argumentType == LUA_TLIGHTUSERDATA) || (argumentType == LUA_TUSERDATA)) {
-						argumentValuePointer = lua_zmqRecvIntptr(socket, more);
-					}else {
-						argumentValue = lua_zmqRecvString(socket, more);
-					}
 
-					switch (argumentType) {
-						case LUA_TNUMBER:
-							stack->push<LUA_NUMBER>(argumentValueNumber);
-							break;
-						case LUA_TSTRING:
-							stack->pushLString(argumentValue.c_str(), argumentValue.length());
-							break;
-						case LUA_TFUNCTION:
-							state.loadString(argumentValue);
-							break;
-						case LUA_TLIGHTUSERDATA:
-							stack->push<void*>(reinterpret_cast<void*>(argumentValuePointer));
-							break;
-						case LUA_TUSERDATA:
-							argumentValuePointerSpecial = static_cast<void**>(stack->newUserData(sizeof(void*)));
-							*argumentValuePointerSpecial = reinterpret_cast<void*>(argumentValuePointer);
-							stack->newTable();
-							stack->setMetatable();
-							break;
-							//set nil for unsupported type
-						case LUA_TNIL:
-						default:
-							stack->pushNil();
-							break;
-					}
-				}
-			}
+		if (argumentsCount < 0) {
+			throw std::runtime_error("Malformed thread arguments");
 		}
-
 		return argumentsCount;
 	}
 
-	void lua_zmqSetThreadArguments(lutok2::State & state, void * socket, int argumentsCount) {
-		Stack * stack = state.stack;
-		const std::string strMsg = "set_arguments";
-		int outArgumentsCount = argumentsCount;
-		zmq_send(socket, strMsg.c_str(), strMsg.length(), ZMQ_SNDMORE);
-		zmq_send(socket, &outArgumentsCount, sizeof(outArgumentsCount), 0);
-
-		if (argumentsCount>=1) {
-			for (int index = 2; index <= argumentsCount+1; index++) {
-				int argumentType = stack->type(index);
-
-				int argNum = (index - 1);
-				int argType = argumentType;
-
-				LUA_NUMBER argValueNum;
-				std::string argValue;
-				intptr_t argValuePtr;
-
-				switch (argumentType) {
-					case LUA_TNUMBER:
-						argValueNum = stack->to<LUA_NUMBER>(index);
-						break;
-					case LUA_TSTRING:
-						argValue = stack->toLString(index);
-						break;
-					case LUA_TFUNCTION:
-						argValue = stack->dumpFunction(index);
-						break;
-					case LUA_TLIGHTUSERDATA:
-						argValuePtr = reinterpret_cast<intptr_t>(getZMQobject(index));
-						break;
-					case LUA_TUSERDATA:
-						argValuePtr = reinterpret_cast<intptr_t>(getZMQobject(index));
-						break;
-						//set nil for unsupported type
-					case LUA_TNIL:
-					default:
-						argType = LUA_TNIL;
-						argValue = "";
-						break;
-				}
-
-				zmq_send(socket, &argNum, sizeof(argNum), ZMQ_SNDMORE);
-				zmq_send(socket, &argType, sizeof(argType), ZMQ_SNDMORE);
-				if (argType == LUA_TNUMBER) {
-					zmq_send(socket, &argValueNum, sizeof(argValueNum), 0);
-				}else if ((argType == LUA_TLIGHTUSERDATA) || ((argType == LUA_TUSERDATA))) {
-					zmq_send(socket, &argValuePtr, sizeof(argValuePtr), 0);
-				}else {
-					zmq_send(socket, argValue.c_str(), argValue.length(), 0);
-				}
-			}
-		}
+	void lua_zmqSetThreadArguments(void * socket, const std::string & arguments) {
+		zmq_send(socket, arguments.c_str(), arguments.length(), 0);
 	}
 
 	void lua_zmqThreadFunction(void * context, std::string code) {
@@ -373,6 +278,7 @@ namespace LuaZMQ {
 
 		try{
 			state.openLibs();
+			lua_zmqWarmState(state);
 
 			state.loadString(code);
 
@@ -434,10 +340,7 @@ namespace LuaZMQ {
 		assert(rc == 0);
 
 		if (more == 1) {
-			char msg[BUFFER_SIZE];
-			rc = zmq_recv(socket, msg, BUFFER_SIZE, 0);
-			assert(rc >= 0);
-			buffer.assign(std::string(msg, rc));
+			buffer = lua_zmqRecvString(socket, more);
 
 			return 2;
 		} else {
@@ -451,7 +354,30 @@ namespace LuaZMQ {
 		if ((parameters_count >= 1) && (stack->is<LUA_TFUNCTION>(1) || stack->is<LUA_TSTRING>(1))) {
 			int rc = 0;
 			std::string code;
+			std::string arguments;
+			std::string argumentsError;
 			void * context = nullptr;
+
+			// arguments are encoded before the thread is started so that unsupported ones can be reported here
+			if (!lua_zmqEncodeValuesToString(state, 2, parameters_count - 1, arguments, argumentsError)) {
+				stack->push<bool>(false);
+				stack->push<const std::string &>(argumentsError);
+				return 2;
+			}
+
+			// source code is compiled here just once, threads only load bytecode
+			try {
+				if (stack->is<LUA_TFUNCTION>(1)) {
+					code = stack->dumpFunction(1);
+				}else {
+					code = lua_zmqCompileCached(state, stack->toLString(1));
+				}
+			}catch(std::exception & e){
+				stack->push<bool>(false);
+				stack->push<const std::string &>(e.what());
+				return 2;
+			}
+
 			threadData * luaThread = new threadData;
 
 			if (stack->is<LUA_TUSERDATA>(2)) {
@@ -464,12 +390,6 @@ namespace LuaZMQ {
 			luaThread->context = context;
 
 			try {
-				if (stack->is<LUA_TFUNCTION>(1)) {
-					code = stack->dumpFunction(1);
-				}else {
-					code = stack->toLString(1);
-				}
-
 				luaThread->socket = zmq_socket(context, ZMQ_PAIR);
 				assert(luaThread->socket);
 
@@ -488,11 +408,12 @@ namespace LuaZMQ {
 				rc = lua_zmqThreadRead(luaThread->socket, thread_rc, message);
 
 				if ((thread_rc == 0) && (message.compare("ok_init") == 0)){
-					lua_zmqSetThreadArguments(state, luaThread->socket, parameters_count-1);
+					lua_zmqSetThreadArguments(luaThread->socket, arguments);
 
 					pushUData(luaThread);
 					return 1;
 				}else {
+					lua_zmqReleaseValues(arguments.c_str(), arguments.length());
 					if (rc == 2) {
 						stack->push<bool>(false);
 						stack->push<const std::string &>(message);
@@ -511,6 +432,7 @@ namespace LuaZMQ {
 					return return_values;
 				}
 			}catch(std::exception & e){
+				lua_zmqReleaseValues(arguments.c_str(), arguments.length());
 				rc = lua_zmqGracefulThreadQuit(state, luaThread, [&](std::exception & e) -> int {
 					state.error("%s", e.what());
 					return 0;
@@ -588,6 +510,7 @@ namespace LuaZMQ {
 				lutok2::State thread_state = lutok2::State();
 				thread_state.openLibs();
 				try{
+					lua_zmqWarmState(thread_state);
 					{
 						thread_state.loadString(code);
 						std::lock_guard<std::mutex> lk(m);
@@ -783,7 +706,16 @@ namespace LuaZMQ {
 	int lua_zmqClose(lutok2::State & state){
 		Stack * stack = state.stack;
 		if (stack->is<LUA_TUSERDATA>(1)){
-			int result = zmq_close(getZMQobject(1));
+			void * socket = getZMQobject(1);
+			if (!socket){
+				return lua_zmqPushClosedSocket(state);
+			}
+			//the userdata is a socket pointer or a socket object, both keep a null socket once closed
+			*(static_cast<void**>(stack->to<void*>(1))) = nullptr;
+			//counters may exist even if counting was disabled meanwhile
+			lua_zmqSocketStatsForget(socket);
+			lua_zmqMonitorForget(socket);
+			int result = zmq_close(socket);
 			if (result == -1){
 				stack->push<bool>(false);
 				lua_pushZMQ_error(state);
@@ -969,205 +901,1053 @@ namespace LuaZMQ {
 		return 0;
 	}
 
-	int lua_zmqPollNew(lutok2::State & state){
-		Stack * stack = state.stack;
-		pollArray_t * poll = new pollArray_t;
-		if (poll){
-			if (stack->is<LUA_TNUMBER>(1)){
-				poll->items.reserve(stack->to<int>(1));
-			}
+	/*
+		Socket option metadata. Option names are resolved into ids once (socketOptionID)
+		and getters and setters dispatch on the type from this table without any string handling.
+	*/
+	enum socketOptionType_t {
+		OPTION_INT,
+		OPTION_INT64,
+		OPTION_FD,
+		OPTION_STRING,
+		OPTION_BOOL,
+	};
 
-			pushUData(poll);
+	struct socketOption_t {
+		const char * name;
+		int id;
+		socketOptionType_t type;
+	};
+
+	static const socketOption_t socketOptions[] = {
+		{"AFFINITY", ZMQ_AFFINITY, OPTION_INT64},
+		{"IDENTITY", ZMQ_IDENTITY, OPTION_STRING},
+		{"SUBSCRIBE", ZMQ_SUBSCRIBE, OPTION_STRING},
+		{"UNSUBSCRIBE", ZMQ_UNSUBSCRIBE, OPTION_STRING},
+		{"RATE", ZMQ_RATE, OPTION_INT},
+		{"RECOVERY_IVL", ZMQ_RECOVERY_IVL, OPTION_INT},
+		{"SNDBUF", ZMQ_SNDBUF, OPTION_INT},
+		{"RCVBUF", ZMQ_RCVBUF, OPTION_INT},
+		{"RCVMORE", ZMQ_RCVMORE, OPTION_BOOL},
+		{"FD", ZMQ_FD, OPTION_FD},
+		{"EVENTS", ZMQ_EVENTS, OPTION_INT},
+		{"TYPE", ZMQ_TYPE, OPTION_INT},
+		{"LINGER", ZMQ_LINGER, OPTION_INT},
+		{"RECONNECT_IVL", ZMQ_RECONNECT_IVL, OPTION_INT},
+		{"BACKLOG", ZMQ_BACKLOG, OPTION_INT},
+		{"RECONNECT_IVL_MAX", ZMQ_RECONNECT_IVL_MAX, OPTION_INT},
+		{"MAXMSGSIZE", ZMQ_MAXMSGSIZE, OPTION_INT64},
+		{"SNDHWM", ZMQ_SNDHWM, OPTION_INT},
+		{"RCVHWM", ZMQ_RCVHWM, OPTION_INT},
+		{"MULTICAST_HOPS", ZMQ_MULTICAST_HOPS, OPTION_INT},
+		{"RCVTIMEO", ZMQ_RCVTIMEO, OPTION_INT},
+		{"SNDTIMEO", ZMQ_SNDTIMEO, OPTION_INT},
+		{"LAST_ENDPOINT", ZMQ_LAST_ENDPOINT, OPTION_STRING},
+		{"ROUTER_MANDATORY", ZMQ_ROUTER_MANDATORY, OPTION_INT},
+		{"TCP_KEEPALIVE", ZMQ_TCP_KEEPALIVE, OPTION_INT},
+		{"TCP_KEEPALIVE_CNT", ZMQ_TCP_KEEPALIVE_CNT, OPTION_INT},
+		{"TCP_KEEPALIVE_IDLE", ZMQ_TCP_KEEPALIVE_IDLE, OPTION_INT},
+		{"TCP_KEEPALIVE_INTVL", ZMQ_TCP_KEEPALIVE_INTVL, OPTION_INT},
+		{"TCP_ACCEPT_FILTER", ZMQ_TCP_ACCEPT_FILTER, OPTION_STRING},
+		{"IMMEDIATE", ZMQ_IMMEDIATE, OPTION_INT},
+		{"XPUB_VERBOSE", ZMQ_XPUB_VERBOSE, OPTION_INT},
+		{"ROUTER_RAW", ZMQ_ROUTER_RAW, OPTION_BOOL},
+		{"IPV6", ZMQ_IPV6, OPTION_BOOL},
+		{"MECHANISM", ZMQ_MECHANISM, OPTION_INT},
+		{"PLAIN_SERVER", ZMQ_PLAIN_SERVER, OPTION_BOOL},
+		{"PLAIN_USERNAME", ZMQ_PLAIN_USERNAME, OPTION_STRING},
+		{"PLAIN_PASSWORD", ZMQ_PLAIN_PASSWORD, OPTION_STRING},
+		{"CURVE_SERVER", ZMQ_CURVE_SERVER, OPTION_BOOL},
+		{"CURVE_PUBLICKEY", ZMQ_CURVE_PUBLICKEY, OPTION_STRING},
+		{"CURVE_SECRETKEY", ZMQ_CURVE_SECRETKEY, OPTION_STRING},
+		{"CURVE_SERVERKEY", ZMQ_CURVE_SERVERKEY, OPTION_STRING},
+		{"PROBE_ROUTER", ZMQ_PROBE_ROUTER, OPTION_INT},
+		{"REQ_CORRELATE", ZMQ_REQ_CORRELATE, OPTION_BOOL},
+		{"REQ_RELAXED", ZMQ_REQ_RELAXED, OPTION_BOOL},
+		{"CONFLATE", ZMQ_CONFLATE, OPTION_BOOL},
+		{"ZAP_DOMAIN", ZMQ_ZAP_DOMAIN, OPTION_STRING},
+		{"ROUTER_HANDOVER", ZMQ_ROUTER_HANDOVER, OPTION_BOOL},
+		{"TOS", ZMQ_TOS, OPTION_INT},
+		{"CONNECT_RID", ZMQ_CONNECT_RID, OPTION_STRING},
+		{"GSSAPI_SERVER", ZMQ_GSSAPI_SERVER, OPTION_BOOL},
+		{"GSSAPI_PRINCIPAL", ZMQ_GSSAPI_PRINCIPAL, OPTION_STRING},
+		{"GSSAPI_SERVICE_PRINCIPAL", ZMQ_GSSAPI_SERVICE_PRINCIPAL, OPTION_STRING},
+		{"GSSAPI_PLAINTEXT", ZMQ_GSSAPI_PLAINTEXT, OPTION_BOOL},
+		{"HANDSHAKE_IVL", ZMQ_HANDSHAKE_IVL, OPTION_INT},
+		{"SOCKS_PROXY", ZMQ_SOCKS_PROXY, OPTION_STRING},
+		{"XPUB_NODROP", ZMQ_XPUB_NODROP, OPTION_BOOL},
+		{"XPUB_MANUAL", ZMQ_XPUB_MANUAL, OPTION_BOOL},
+		{"XPUB_WELCOME_MSG", ZMQ_XPUB_WELCOME_MSG, OPTION_STRING},
+		{"STREAM_NOTIFY", ZMQ_STREAM_NOTIFY, OPTION_BOOL},
+	};
+
+	const size_t socketOptionCount = sizeof(socketOptions) / sizeof(socketOptions[0]);
+
+	static const socketOption_t * lua_zmqFindSocketOption(int id){
+		//options are indexed by id on first use, ids are small integers
+		static std::vector<const socketOption_t *> index;
+		static std::once_flag indexed;
+		std::call_once(indexed, [](){
+			for (size_t position = 0; position < socketOptionCount; position++){
+				size_t id = static_cast<size_t>(socketOptions[position].id);
+				if (id >= index.size()){
+					index.resize(id + 1, nullptr);
+				}
+				index[id] = &socketOptions[position];
+			}
+		});
+		return ((id >= 0) && (static_cast<size_t>(id) < index.size())) ? index[id] : nullptr;
+	}
+
+	//finds option by name (case insensitive) or id at stack index, returns nullptr for an unknown option
+	static const socketOption_t * lua_zmqResolveSocketOption(lutok2::State & state, int index){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TNUMBER>(index)){
+			return lua_zmqFindSocketOption(stack->to<int>(index));
+		}else if (stack->is<LUA_TSTRING>(index)){
+			//names are indexed on first use in upper and lower case, mixed case names are normalized on a miss
+			static std::unordered_map<std::string, const socketOption_t *> names;
+			static std::once_flag indexed;
+			std::call_once(indexed, [](){
+				for (size_t position = 0; position < socketOptionCount; position++){
+					std::string name = socketOptions[position].name;
+					names[name] = &socketOptions[position];
+					std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+					names[name] = &socketOptions[position];
+				}
+			});
+			std::string name = stack->toLString(index);
+			std::unordered_map<std::string, const socketOption_t *>::const_iterator iter = names.find(name);
+			if (iter == names.end()){
+				std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+				iter = names.find(name);
+			}
+			return (iter != names.end()) ? iter->second : nullptr;
+		}
+		return nullptr;
+	}
+
+	/*
+		Resolves option name (case insensitive) into option id, numeric ids are only validated.
+		Returns option id or nothing for an unknown option.
+	*/
+	int lua_zmqSocketOptionID(lutok2::State & state){
+		const socketOption_t * option = lua_zmqResolveSocketOption(state, 1);
+		if (option){
+			state.stack->push<int>(option->id);
 			return 1;
 		}
 		return 0;
 	}
-	int lua_zmqPollFree(lutok2::State & state){
+
+	//pushes option value or false and error message, returns the number of pushed values
+	static int lua_zmqPushSocketOption(lutok2::State & state, void * socket, const socketOption_t * option){
 		Stack * stack = state.stack;
-		if (stack->is<LUA_TUSERDATA>(1)){
-			pollArray_t * poll = static_cast<pollArray_t *>(getZMQobject(1));
-			if (poll){
-				poll->items.clear();
-				delete poll;
+		int result = -1;
+		switch (option->type){
+			case OPTION_INT:
+			case OPTION_BOOL:
+			{
+				int v = 0;
+				size_t size = sizeof(v);
+				if ((result = zmq_getsockopt(socket, option->id, &v, &size)) == 0){
+					if (option->type == OPTION_BOOL){
+						stack->push<bool>(v != 0);
+					}else{
+						stack->push<int>(v);
+					}
+				}
+				break;
+			}
+			case OPTION_INT64:
+			{
+				int64_t v = 0;
+				size_t size = sizeof(v);
+				if ((result = zmq_getsockopt(socket, option->id, &v, &size)) == 0){
+					stack->push<LUA_NUMBER>(static_cast<LUA_NUMBER>(v));
+				}
+				break;
+			}
+			case OPTION_FD:
+			{
+#if defined(_WIN32)
+				SOCKET fd = 0;
+#else
+				int fd = 0;
+#endif
+				size_t size = sizeof(fd);
+				if ((result = zmq_getsockopt(socket, option->id, &fd, &size)) == 0){
+					stack->push<LUA_NUMBER>(static_cast<LUA_NUMBER>(fd));
+				}
+				break;
+			}
+			case OPTION_STRING:
+			{
+				char v[4096];
+				size_t size = sizeof(v);
+				if ((result = zmq_getsockopt(socket, option->id, v, &size)) == 0){
+					stack->pushLString(std::string(v, size));
+				}
+				break;
 			}
 		}
-		return 0;
+		if (result != 0){
+			stack->push<bool>(false);
+			lua_pushZMQ_error(state);
+			return 2;
+		}
+		return 1;
 	}
 
-	int lua_zmqPollGet(lutok2::State & state){
+	//sets option from value at stack index, pushes true or false and error message
+	static int lua_zmqSetSocketOption(lutok2::State & state, void * socket, const socketOption_t * option, int index){
 		Stack * stack = state.stack;
-		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TNUMBER>(2)){
-			pollArray_t * poll = static_cast<pollArray_t *>(getZMQobject(1));
-			if (poll){
-				size_t index = stack->to<int>(2);
-				if (index<poll->items.size()){
-					zmq_pollitem_t & item = poll->items[index];
-					stack->newTable();
-						stack->push<const std::string &>("socket");
-						pushSocket(item.socket);
-						stack->setTable();
-
-						stack->setField<LUA_NUMBER>("fd", static_cast<intptr_t>(item.fd));
-						stack->setField<int>("events", static_cast<int>(item.events));
-						stack->setField<int>("revents", static_cast<int>(item.revents));
-					return 1;
+		int result = -1;
+		switch (option->type){
+			case OPTION_INT:
+			case OPTION_BOOL:
+			{
+				int32_t v = 0;
+				if (stack->is<LUA_TBOOLEAN>(index)){
+					v = stack->to<bool>(index) ? 1 : 0;
+				}else if (stack->is<LUA_TNUMBER>(index)){
+					v = stack->to<int>(index);
+				}else{
+					errno = EINVAL;
+					break;
+				}
+				result = zmq_setsockopt(socket, option->id, &v, sizeof(v));
+				break;
+			}
+			case OPTION_INT64:
+			{
+				if (!stack->is<LUA_TNUMBER>(index)){
+					errno = EINVAL;
+					break;
 				}
+				int64_t v = static_cast<int64_t>(stack->to<LUA_NUMBER>(index));
+				result = zmq_setsockopt(socket, option->id, &v, sizeof(v));
+				break;
+			}
+			case OPTION_STRING:
+			{
+				if (!stack->is<LUA_TSTRING>(index) && !stack->is<LUA_TNUMBER>(index)){
+					errno = EINVAL;
+					break;
+				}
+				const std::string value = stack->toLString(index);
+				result = zmq_setsockopt(socket, option->id, value.data(), value.length());
+				break;
 			}
+			default:
+				//read-only option
+				errno = EINVAL;
+				break;
 		}
-		return 0;
+		if (result == -1){
+			stack->push<bool>(false);
+			lua_pushZMQ_error(state);
+			return 2;
+		}
+		stack->push<bool>(true);
+		return 1;
 	}
 
-	int lua_zmqPollSet(lutok2::State & state){
+	//typed option getter: socketGetOption(socket, id)
+	int lua_zmqSocketGetOption(lutok2::State & state){
 		Stack * stack = state.stack;
-		if (stack->is<LUA_TUSERDATA>(1)){
-			pollArray_t * poll = static_cast<pollArray_t *>(getZMQobject(1));
-			if (poll){
-				if (stack->is<LUA_TNUMBER>(2) && stack->is<LUA_TTABLE>(3)){
-					size_t index = stack->to<int>(2);
-					if (index<poll->items.size()){
-						zmq_pollitem_t & item = poll->items[index];
-
-						stack->getField("socket", 3);
-						if (stack->is<LUA_TUSERDATA>(-1)){
-							item.socket = getZMQobject(-1);
-						}
-						stack->pop(1);
-
-						stack->getField("fd", 3);
-						if (stack->is<LUA_TNUMBER>(-1)){
-							item.fd = static_cast<intptr_t>(stack->to<LUA_NUMBER>(-1));
-						}
-						stack->pop(1);
-
-						stack->getField("events", 3);
-						if (stack->is<LUA_TNUMBER>(-1)){
-							item.events = static_cast<short>(stack->to<int>(-1));
-						}
-						stack->pop(1);
-
-						stack->getField("revents", 3);
-						if (stack->is<LUA_TNUMBER>(-1)){
-							item.revents = static_cast<short>(stack->to<int>(-1));
-						}
-						stack->pop(1);
-
-						stack->push<bool>(true);
-						return 1;
-					}
-				}else if (stack->is<LUA_TTABLE>(2)){
-					zmq_pollitem_t item;
-
-					stack->getField("socket", 2);
-					if (stack->is<LUA_TUSERDATA>(-1)){
-						item.socket = getZMQobject(-1);
-					}
-					stack->pop(1);
-
-					stack->getField("fd", 2);
-					if (stack->is<LUA_TNUMBER>(-1)){
-						item.fd = static_cast<intptr_t>(stack->to<LUA_NUMBER>(-1));
-					}
-					stack->pop(1);
-
-					stack->getField("events", 2);
-					if (stack->is<LUA_TNUMBER>(-1)){
-						item.events = static_cast<short>(stack->to<int>(-1));
-					}
-					stack->pop(1);
-
-					stack->getField("revents", 2);
-					if (stack->is<LUA_TNUMBER>(-1)){
-						item.revents = static_cast<short>(stack->to<int>(-1));
-					}
-					stack->pop(1);
-
-					poll->items.push_back(item);
-					stack->push<bool>(true);
-					return 1;
-				}
+		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TNUMBER>(2)){
+			const socketOption_t * option = lua_zmqFindSocketOption(stack->to<int>(2));
+			if (!option){
+				stack->push<bool>(false);
+				stack->push<const std::string &>("Unknown socket option");
+				return 2;
 			}
+			return lua_zmqPushSocketOption(state, getZMQobject(1), option);
 		}
 		return 0;
 	}
 
-	int lua_zmqPollSize(lutok2::State & state){
+	//typed option setter: socketSetOption(socket, id, value)
+	int lua_zmqSocketSetOption(lutok2::State & state){
 		Stack * stack = state.stack;
-		if (stack->is<LUA_TUSERDATA>(1)){
-			pollArray_t * poll = static_cast<pollArray_t *>(getZMQobject(1));
-			if (poll){
-				stack->push<int>(poll->items.size());
-				return 1;
+		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TNUMBER>(2)){
+			const socketOption_t * option = lua_zmqFindSocketOption(stack->to<int>(2));
+			if (!option){
+				stack->push<bool>(false);
+				stack->push<const std::string &>("Unknown socket option");
+				return 2;
 			}
+			return lua_zmqSetSocketOption(state, getZMQobject(1), option, 3);
 		}
 		return 0;
 	}
 
-	int lua_zmqPoll(lutok2::State & state){
+	//fast read-only options used in receive loops and event loops
+
+	int lua_zmqSocketRcvMore(lutok2::State & state){
 		Stack * stack = state.stack;
 		if (stack->is<LUA_TUSERDATA>(1)){
-			pollArray_t * poll = static_cast<pollArray_t *>(getZMQobject(1));
-			if (poll){
-				zmq_pollitem_t *items = poll->items.data();
-				if (items && poll->items.size()>0){
-					int timeout = -1;
-					if (stack->is<LUA_TNUMBER>(2)){
-						timeout = stack->to<int>(2);
-					}
-					int result = zmq_poll(items, poll->items.size(), timeout);
-					if (result < 0){
-						stack->push<bool>(false);
-						lua_pushZMQ_error(state);
-						return 2;
-					}else{
-						stack->push<int>(result);
-						return 1;
-					}
-				}
+			int v = 0;
+			size_t size = sizeof(v);
+			if (zmq_getsockopt(getZMQobject(1), ZMQ_RCVMORE, &v, &size) == -1){
+				stack->push<bool>(false);
+				lua_pushZMQ_error(state);
+				return 2;
 			}
+			stack->push<bool>(v != 0);
+			return 1;
 		}
 		return 0;
 	}
 
-	int lua_zmqBind(lutok2::State & state){
+	int lua_zmqSocketEvents(lutok2::State & state){
 		Stack * stack = state.stack;
-		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TSTRING>(2)){
-			if (zmq_bind(getZMQobject(1), stack->to<const std::string>(2).c_str()) != 0){
+		if (stack->is<LUA_TUSERDATA>(1)){
+			int v = 0;
+			size_t size = sizeof(v);
+			if (zmq_getsockopt(getZMQobject(1), ZMQ_EVENTS, &v, &size) == -1){
 				stack->push<bool>(false);
 				lua_pushZMQ_error(state);
 				return 2;
-			}else{
-				stack->push<bool>(true);
-				return 1;
 			}
+			stack->push<int>(v);
+			return 1;
 		}
 		return 0;
 	}
 
-	int lua_zmqUnbind(lutok2::State & state){
+	int lua_zmqSocketFD(lutok2::State & state){
 		Stack * stack = state.stack;
-		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TSTRING>(2)){
-			if (zmq_unbind(getZMQobject(1), stack->to<const std::string>(2).c_str()) != 0){
+		if (stack->is<LUA_TUSERDATA>(1)){
+#if defined(_WIN32)
+			SOCKET fd = 0;
+#else
+			int fd = 0;
+#endif
+			size_t size = sizeof(fd);
+			if (zmq_getsockopt(getZMQobject(1), ZMQ_FD, &fd, &size) == -1){
 				stack->push<bool>(false);
 				lua_pushZMQ_error(state);
 				return 2;
-			}else{
-				stack->push<bool>(true);
-				return 1;
 			}
+			stack->push<LUA_NUMBER>(static_cast<LUA_NUMBER>(fd));
+			return 1;
 		}
 		return 0;
 	}
 
-	int lua_zmqConnect(lutok2::State & state){
+	/*
+		Socket object: a full userdata with one metatable shared by all socket objects of a Lua state.
+		Methods are stored in a single __index table and take the object as the first argument
+		(socket:send(data)). The socket pointer is the first member, so all module functions
+		which take a socket accept a socket object too.
+	*/
+	struct socketObject_t {
+		void * socket;
+		void * context;
+	};
+
+	//registry keys of the shared metatable and method table
+	const char * socketObjectMetatable = "luazmq_socket";
+	const char * socketObjectMethods = "luazmq_socket_methods";
+
+	static socketObject_t * lua_zmqToSocketObject(lutok2::State & state, int index){
+		return static_cast<socketObject_t *>(state.stack->to<void*>(index));
+	}
+
+	int lua_zmqSocketObjectNew(lutok2::State & state){
 		Stack * stack = state.stack;
-		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TSTRING>(2)){
-			if (zmq_connect(getZMQobject(1), stack->to<const std::string>(2).c_str()) != 0){
+		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TNUMBER>(2)){
+			void * context = getZMQobject(1);
+			void * socket = zmq_socket(context, stack->to<int>(2));
+			if (!socket){
 				stack->push<bool>(false);
 				lua_pushZMQ_error(state);
 				return 2;
-			}else{
-				stack->push<bool>(true);
-				return 1;
+			}
+			socketObject_t * object = static_cast<socketObject_t *>(stack->newUserData(sizeof(socketObject_t)));
+			object->socket = socket;
+			object->context = context;
+			stack->push<const std::string &>(socketObjectMetatable);
+			stack->getTable(LUA_REGISTRYINDEX);
+			stack->setMetatable();
+			return 1;
+		}
+		return 0;
+	}
+
+	static int lua_zmqSocketObjectClose(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			socketObject_t * object = lua_zmqToSocketObject(state, 1);
+			if (object->socket){
+				void * socket = object->socket;
+				//closed object keeps a null socket, module functions then fail with ENOTSOCK
+				object->socket = nullptr;
+				lua_zmqSocketStatsForget(socket);
+				lua_zmqMonitorForget(socket);
+				if (zmq_close(socket) == -1){
+					stack->push<bool>(false);
+					lua_pushZMQ_error(state);
+					return 2;
+				}
+			}
+			stack->push<bool>(true);
+			return 1;
+		}
+		return 0;
+	}
+
+	static int lua_zmqSocketObjectGC(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			socketObject_t * object = lua_zmqToSocketObject(state, 1);
+			if (object->socket){
+				lua_zmqSocketStatsForget(object->socket);
+				lua_zmqMonitorForget(object->socket);
+				zmq_close(object->socket);
+				object->socket = nullptr;
+			}
+		}
+		return 0;
+	}
+
+	//socket:get(name or id), returns nothing for an unknown option
+	static int lua_zmqSocketObjectGet(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			const socketOption_t * option = lua_zmqResolveSocketOption(state, 2);
+			if (option){
+				return lua_zmqPushSocketOption(state, lua_zmqToSocketObject(state, 1)->socket, option);
+			}
+		}
+		return 0;
+	}
+
+	//socket:set(name or id, value)
+	static int lua_zmqSocketObjectSet(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			const socketOption_t * option = lua_zmqResolveSocketOption(state, 2);
+			if (!option){
+				stack->push<bool>(false);
+				stack->push<const std::string &>("Unknown socket option");
+				return 2;
+			}
+			return lua_zmqSetSocketOption(state, lua_zmqToSocketObject(state, 1)->socket, option, 3);
+		}
+		return 0;
+	}
+
+	//raw context object the socket was created in
+	static int lua_zmqSocketObjectContext(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			pushUData(lua_zmqToSocketObject(state, 1)->context);
+			return 1;
+		}
+		return 0;
+	}
+
+	static int lua_zmqSocketObjectToString(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			std::stringstream name;
+			name << "zmq socket: " << lua_zmqToSocketObject(state, 1)->socket;
+			stack->push<const std::string &>(name.str());
+			return 1;
+		}
+		return 0;
+	}
+
+	//shared method table, zmq.lua adds methods implemented in Lua
+	int lua_zmqSocketObjectMethods(lutok2::State & state){
+		Stack * stack = state.stack;
+		stack->push<const std::string &>(socketObjectMethods);
+		stack->getTable(LUA_REGISTRYINDEX);
+		return 1;
+	}
+
+	//creates the shared metatable of socket objects in the registry
+	void lua_zmqRegisterSocketObject(State * state){
+		Stack * stack = state->stack;
+		Module methods;
+		Module metamethods;
+
+		methods["connect"] = lua_zmqConnect;
+		methods["disconnect"] = lua_zmqDisconnect;
+		methods["bind"] = lua_zmqBind;
+		methods["unbind"] = lua_zmqUnbind;
+		methods["close"] = lua_zmqSocketObjectClose;
+		methods["send"] = lua_zmqSend;
+		methods["recv"] = lua_zmqRecv;
+		methods["recvAll"] = lua_zmqRecvAll;
+		methods["recvFrame"] = lua_zmqRecvFrame;
+		methods["recvFrames"] = lua_zmqRecvFrames;
+		methods["recvMsg"] = lua_zmqRecvMsg;
+		methods["sendFrames"] = lua_zmqSendFramesTable;
+		methods["recvBatch"] = lua_zmqRecvBatch;
+		methods["sendBatch"] = lua_zmqSendBatch;
+		methods["sendValue"] = lua_zmqSendValue;
+		methods["recvValue"] = lua_zmqRecvValue;
+		methods["monitor"] = lua_zmqSocketMonitor;
+		methods["stats"] = lua_zmqSocketStatsLua;
+		methods["recordLatency"] = lua_zmqSocketRecordLatency;
+		methods["get"] = lua_zmqSocketObjectGet;
+		methods["set"] = lua_zmqSocketObjectSet;
+		methods["more"] = lua_zmqSocketRcvMore;
+		methods["events"] = lua_zmqSocketEvents;
+		methods["fd"] = lua_zmqSocketFD;
+		methods["context"] = lua_zmqSocketObjectContext;
+
+		metamethods["__gc"] = lua_zmqSocketObjectGC;
+		metamethods["__tostring"] = lua_zmqSocketObjectToString;
+
+		stack->push<const std::string &>(socketObjectMethods);
+		stack->newTable();
+		state->registerLib(methods);
+		stack->setTable(LUA_REGISTRYINDEX);
+
+		stack->push<const std::string &>(socketObjectMetatable);
+		stack->newTable();
+		state->registerLib(metamethods);
+		stack->push<const std::string &>("__index");
+		stack->push<const std::string &>(socketObjectMethods);
+		stack->getTable(LUA_REGISTRYINDEX);
+		stack->setTable();
+		stack->setTable(LUA_REGISTRYINDEX);
+	}
+
+	/*
+		Socket objects and callbacks of poll items are kept in two tables stored in the poll metatable
+		and indexed by item handle. Both tables are owned by the poll object, so a callback that refers
+		to its own poll doesn't keep the poll alive.
+	*/
+	const char * pollObjectsField = "__pollObjects";
+	const char * pollCallbacksField = "__pollCallbacks";
+
+	/*
+		Pushes metatable of the poll object at stack index followed by its objects and callbacks tables.
+		Returns absolute stack index of the objects table, callbacks table is the next one.
+	*/
+	static int lua_zmqPollPushRefs(lutok2::State & state, int index){
+		Stack * stack = state.stack;
+		stack->getMetatable(index);
+		stack->getField(pollObjectsField, -1);
+		stack->getField(pollCallbacksField, -2);
+		return stack->getTop() - 1;
+	}
+
+	static void lua_zmqPollPopRefs(lutok2::State & state){
+		state.stack->pop(3);
+	}
+
+	//stores value on top of the stack into table[handle] and pops it
+	static void lua_zmqPollStoreRef(lutok2::State & state, int tableIndex, size_t handle){
+		Stack * stack = state.stack;
+		stack->push<int>(handle);
+		stack->pushValue(-2);
+		stack->setTable(tableIndex);
+		stack->pop(1);
+	}
+
+	static void lua_zmqPollClearRef(lutok2::State & state, int tableIndex, size_t handle){
+		Stack * stack = state.stack;
+		stack->push<int>(handle);
+		stack->pushNil();
+		stack->setTable(tableIndex);
+	}
+
+	static void lua_zmqPollPushRef(lutok2::State & state, int tableIndex, size_t handle){
+		Stack * stack = state.stack;
+		stack->push<int>(handle);
+		stack->getTable(tableIndex);
+	}
+
+	//replaces objects and callbacks tables in poll metatable at stack index with empty ones
+	static void lua_zmqPollResetRefs(lutok2::State & state, int index){
+		Stack * stack = state.stack;
+		stack->getMetatable(index);
+			stack->push<const std::string &>(pollObjectsField);
+			stack->newTable();
+			stack->setTable();
+			stack->push<const std::string &>(pollCallbacksField);
+			stack->newTable();
+			stack->setTable();
+		stack->pop(1);
+	}
+
+	int lua_zmqPollNew(lutok2::State & state){
+		Stack * stack = state.stack;
+		pollArray_t * poll = new pollArray_t;
+		if (poll){
+			if (stack->is<LUA_TNUMBER>(1)){
+				size_t size = stack->to<int>(1);
+				poll->items.reserve(size);
+				poll->callbacks.reserve(size);
+				poll->handles.reserve(size);
+				poll->slots.reserve(size);
+			}
+
+			pushUData(poll);
+			lua_zmqPollResetRefs(state, stack->getTop());
+			return 1;
+		}
+		return 0;
+	}
+
+	int lua_zmqPollFree(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			pollArray_t * poll = static_cast<pollArray_t *>(getZMQobject(1));
+			if (poll){
+				//drops references to all socket objects and callbacks
+				lua_zmqPollResetRefs(state, 1);
+				*(static_cast<void**>(stack->to<void*>(1))) = nullptr;
+				delete poll;
+			}
+		}
+		return 0;
+	}
+
+	static size_t lua_zmqPollAppend(pollArray_t * poll, const zmq_pollitem_t & item){
+		size_t handle;
+		if (!poll->freeSlots.empty()){
+			handle = poll->freeSlots.back();
+			poll->freeSlots.pop_back();
+		}else{
+			handle = poll->slots.size();
+			poll->slots.push_back(invalidPollSlot);
+		}
+
+		poll->slots[handle] = poll->items.size();
+		poll->items.push_back(item);
+		poll->callbacks.push_back(false);
+		poll->handles.push_back(handle);
+
+		if (item.socket){
+			poll->sockets[item.socket] = handle;
+		}
+		return handle;
+	}
+
+	/*
+		Removes socket -> handle mapping only if it belongs to the given handle.
+		The same socket may have been added again under a new handle while the old item was pending removal.
+	*/
+	static void lua_zmqPollUnmapSocket(pollArray_t * poll, void * socket, size_t handle){
+		if (socket){
+			auto it = poll->sockets.find(socket);
+			if ((it != poll->sockets.end()) && (it->second == handle)){
+				poll->sockets.erase(it);
+			}
+		}
+	}
+
+	static void lua_zmqPollErase(lutok2::State & state, pollArray_t * poll, size_t handle, int refsIndex){
+		size_t index = poll->slots[handle];
+		size_t last = poll->items.size() - 1;
+		void * socket = poll->items[index].socket;
+
+		lua_zmqPollClearRef(state, refsIndex, handle);
+		lua_zmqPollClearRef(state, refsIndex + 1, handle);
+		lua_zmqPollUnmapSocket(poll, socket, handle);
+
+		if (index != last){
+			poll->items[index] = poll->items[last];
+			poll->callbacks[index] = poll->callbacks[last];
+			poll->handles[index] = poll->handles[last];
+			poll->slots[poll->handles[index]] = index;
+		}
+		poll->items.pop_back();
+		poll->callbacks.pop_back();
+		poll->handles.pop_back();
+
+		poll->slots[handle] = invalidPollSlot;
+		poll->freeSlots.push_back(handle);
+	}
+
+	/*
+		Resolves poll item handle from a socket object or a numeric handle at stack index.
+		Returns invalidPollSlot if there's no such item.
+	*/
+	static size_t lua_zmqPollFindHandle(lutok2::State & state, pollArray_t * poll, int index){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(index)){
+			auto it = poll->sockets.find(getZMQobject(index));
+			if (it != poll->sockets.end()){
+				return it->second;
+			}
+		}else if (stack->is<LUA_TNUMBER>(index)){
+			size_t handle = stack->to<int>(index);
+			if ((handle < poll->slots.size()) && (poll->slots[handle] != invalidPollSlot)){
+				return handle;
+			}
+		}
+		return invalidPollSlot;
+	}
+
+	//returns poll item with given handle as a table
+	int lua_zmqPollGet(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TNUMBER>(2)){
+			pollArray_t * poll = static_cast<pollArray_t *>(getZMQobject(1));
+			if (poll){
+				size_t handle = lua_zmqPollFindHandle(state, poll, 2);
+				if (handle != invalidPollSlot){
+					size_t index = poll->slots[handle];
+					zmq_pollitem_t & item = poll->items[index];
+					int refsIndex = lua_zmqPollPushRefs(state, 1);
+
+					stack->newTable();
+						stack->push<const std::string &>("socket");
+						lua_zmqPollPushRef(state, refsIndex, handle);
+						if (!stack->is<LUA_TUSERDATA>(-1)){
+							stack->pop(1);
+							pushSocket(item.socket);
+						}
+						stack->setTable();
+
+						if (poll->callbacks[index]){
+							stack->push<const std::string &>("fn");
+							lua_zmqPollPushRef(state, refsIndex + 1, handle);
+							stack->setTable();
+						}
+
+						stack->setField<LUA_NUMBER>("fd", static_cast<intptr_t>(item.fd));
+						stack->setField<int>("events", static_cast<int>(item.events));
+						stack->setField<int>("revents", static_cast<int>(item.revents));
+						stack->setField<int>("handle", static_cast<int>(handle));
+					return 1;
+				}
+			}
+		}
+		return 0;
+	}
+
+	/*
+		Fills poll item with given handle from a Lua table with socket, fd, events, revents and fn fields.
+		Socket object and callback function are stored in poll tables at refsIndex so that
+		lua_zmqPollDispatch can pass them to the callback without any allocation.
+	*/
+	static void lua_zmqPollReadItem(lutok2::State & state, int tableIndex, pollArray_t * poll, size_t handle, int refsIndex){
+		Stack * stack = state.stack;
+		size_t index = poll->slots[handle];
+		zmq_pollitem_t & item = poll->items[index];
+
+		stack->getField("socket", tableIndex);
+		if (stack->is<LUA_TUSERDATA>(-1)){
+			item.socket = getZMQobject(-1);
+			lua_zmqPollStoreRef(state, refsIndex, handle);
+		}else{
+			stack->pop(1);
+		}
+
+		stack->getField("fd", tableIndex);
+		if (stack->is<LUA_TNUMBER>(-1)){
+			item.fd = static_cast<intptr_t>(stack->to<LUA_NUMBER>(-1));
+		}
+		stack->pop(1);
+
+		stack->getField("events", tableIndex);
+		if (stack->is<LUA_TNUMBER>(-1)){
+			item.events = static_cast<short>(stack->to<int>(-1));
+		}
+		stack->pop(1);
+
+		stack->getField("revents", tableIndex);
+		if (stack->is<LUA_TNUMBER>(-1)){
+			item.revents = static_cast<short>(stack->to<int>(-1));
+		}
+		stack->pop(1);
+
+		stack->getField("fn", tableIndex);
+		if (stack->is<LUA_TFUNCTION>(-1)){
+			lua_zmqPollStoreRef(state, refsIndex + 1, handle);
+			poll->callbacks[index] = true;
+		}else{
+			stack->pop(1);
+		}
+	}
+
+	/*
+		Adds a new poll item described by a table and returns its handle.
+		Adding a socket that is already present modifies the existing item.
+	*/
+	int lua_zmqPollAdd(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TTABLE>(2)){
+			pollArray_t * poll = static_cast<pollArray_t *>(getZMQobject(1));
+			if (poll){
+				size_t handle = invalidPollSlot;
+
+				stack->getField("socket", 2);
+				if (stack->is<LUA_TUSERDATA>(-1)){
+					auto it = poll->sockets.find(getZMQobject(-1));
+					if (it != poll->sockets.end()){
+						handle = it->second;
+					}
+				}
+				stack->pop(1);
+
+				if (handle == invalidPollSlot){
+					zmq_pollitem_t item = {nullptr, 0, 0, 0};
+					handle = lua_zmqPollAppend(poll, item);
+				}
+
+				int refsIndex = lua_zmqPollPushRefs(state, 1);
+				lua_zmqPollReadItem(state, 2, poll, handle, refsIndex);
+				lua_zmqPollPopRefs(state);
+
+				void * socket = poll->items[poll->slots[handle]].socket;
+				if (socket){
+					poll->sockets[socket] = handle;
+				}
+				stack->push<int>(handle);
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	int lua_zmqPollModify(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TNUMBER>(3)){
+			pollArray_t * poll = static_cast<pollArray_t *>(getZMQobject(1));
+			if (poll){
+				size_t handle = lua_zmqPollFindHandle(state, poll, 2);
+				if (handle != invalidPollSlot){
+					size_t index = poll->slots[handle];
+					poll->items[index].events = static_cast<short>(stack->to<int>(3));
+					if (stack->is<LUA_TFUNCTION>(4)){
+						int refsIndex = lua_zmqPollPushRefs(state, 1);
+						stack->pushValue(4);
+						lua_zmqPollStoreRef(state, refsIndex + 1, handle);
+						lua_zmqPollPopRefs(state);
+						poll->callbacks[index] = true;
+					}
+					stack->push<bool>(true);
+					return 1;
+				}
+			}
+		}
+		stack->push<bool>(false);
+		return 1;
+	}
+
+	int lua_zmqPollRemove(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			pollArray_t * poll = static_cast<pollArray_t *>(getZMQobject(1));
+			if (poll){
+				size_t handle = lua_zmqPollFindHandle(state, poll, 2);
+				if (handle != invalidPollSlot){
+					int refsIndex = lua_zmqPollPushRefs(state, 1);
+					if (poll->dispatching){
+						//item is disabled now and removed after dispatch loop
+						size_t index = poll->slots[handle];
+						zmq_pollitem_t & item = poll->items[index];
+						lua_zmqPollUnmapSocket(poll, item.socket, handle);
+						item.events = 0;
+						lua_zmqPollClearRef(state, refsIndex + 1, handle);
+						poll->callbacks[index] = false;
+						poll->pendingRemovals.push_back(handle);
+					}else{
+						lua_zmqPollErase(state, poll, handle, refsIndex);
+					}
+					lua_zmqPollPopRefs(state);
+					stack->push<bool>(true);
+					return 1;
+				}
+			}
+		}
+		stack->push<bool>(false);
+		return 1;
+	}
+
+	/*
+		Replaces poll item with given handle: pollSet(poll, handle, item)
+		pollSet(poll, item) adds a new item like pollAdd does.
+	*/
+	int lua_zmqPollSet(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			pollArray_t * poll = static_cast<pollArray_t *>(getZMQobject(1));
+			if (poll){
+				if (stack->is<LUA_TNUMBER>(2) && stack->is<LUA_TTABLE>(3)){
+					size_t handle = lua_zmqPollFindHandle(state, poll, 2);
+					if (handle != invalidPollSlot){
+						size_t index = poll->slots[handle];
+						zmq_pollitem_t & item = poll->items[index];
+
+						lua_zmqPollUnmapSocket(poll, item.socket, handle);
+						int refsIndex = lua_zmqPollPushRefs(state, 1);
+						//the table replaces the whole item, an item without fn has no callback
+						lua_zmqPollClearRef(state, refsIndex + 1, handle);
+						poll->callbacks[index] = false;
+						lua_zmqPollReadItem(state, 3, poll, handle, refsIndex);
+						lua_zmqPollPopRefs(state);
+						if (item.socket){
+							poll->sockets[item.socket] = handle;
+						}
+
+						stack->push<bool>(true);
+						return 1;
+					}
+				}else if (stack->is<LUA_TTABLE>(2)){
+					return lua_zmqPollAdd(state);
+				}
+			}
+		}
+		return 0;
+	}
+
+	int lua_zmqPollSize(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			pollArray_t * poll = static_cast<pollArray_t *>(getZMQobject(1));
+			if (poll){
+				stack->push<int>(poll->items.size());
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	int lua_zmqPoll(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			pollArray_t * poll = static_cast<pollArray_t *>(getZMQobject(1));
+			if (poll){
+				zmq_pollitem_t *items = poll->items.data();
+				if (items && poll->items.size()>0){
+					int timeout = -1;
+					if (stack->is<LUA_TNUMBER>(2)){
+						timeout = stack->to<int>(2);
+					}
+					int result = zmq_poll(items, poll->items.size(), timeout);
+					if (result < 0){
+						stack->push<bool>(false);
+						lua_pushZMQ_error(state);
+						return 2;
+					}else{
+						stack->push<int>(result);
+						return 1;
+					}
+				}
+			}
+		}
+		return 0;
+	}
+
+	static void lua_zmqPollFlushRemovals(lutok2::State & state, pollArray_t * poll, int refsIndex){
+		poll->dispatching = false;
+		for (size_t handle : poll->pendingRemovals){
+			if (poll->slots[handle] != invalidPollSlot){
+				lua_zmqPollErase(state, poll, handle, refsIndex);
+			}
+		}
+		poll->pendingRemovals.clear();
+	}
+
+	/*
+		Polls all items and invokes callback(socket, revents) for every signalled item.
+		Callbacks may add or remove items, new items are not dispatched until the next call.
+	*/
+	int lua_zmqPollDispatch(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			pollArray_t * poll = static_cast<pollArray_t *>(getZMQobject(1));
+			if (poll){
+				int refsIndex = lua_zmqPollPushRefs(state, 1);
+				//removals may be left over if previous dispatch was interrupted by an error
+				lua_zmqPollFlushRemovals(state, poll, refsIndex);
+
+				size_t size = poll->items.size();
+				int timeout = -1;
+				if (stack->is<LUA_TNUMBER>(2)){
+					timeout = stack->to<int>(2);
+				}
+
+				if (size == 0){
+					stack->push<int>(0);
+					return 1;
+				}
+
+				int result = zmq_poll(poll->items.data(), size, timeout);
+				if (result < 0){
+					stack->push<bool>(false);
+					lua_pushZMQ_error(state);
+					return 2;
+				}
+
+				poll->dispatching = true;
+				int signalled = result;
+				for (size_t index = 0; (index < size) && (signalled > 0); index++){
+					const zmq_pollitem_t & item = poll->items[index];
+					int revents = item.revents;
+
+					if (revents != 0){
+						signalled--;
+						if ((revents & item.events) && poll->callbacks[index]){
+							size_t handle = poll->handles[index];
+							lua_zmqPollPushRef(state, refsIndex + 1, handle);
+							lua_zmqPollPushRef(state, refsIndex, handle);
+							stack->push<int>(revents);
+							stack->call(2, 0);
+						}
+					}
+				}
+				lua_zmqPollFlushRemovals(state, poll, refsIndex);
+
+				stack->push<int>(result);
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	int lua_zmqBind(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TSTRING>(2)){
+			if (zmq_bind(getZMQobject(1), stack->to<const std::string>(2).c_str()) != 0){
+				stack->push<bool>(false);
+				lua_pushZMQ_error(state);
+				return 2;
+			}else{
+				stack->push<bool>(true);
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	int lua_zmqUnbind(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TSTRING>(2)){
+			if (zmq_unbind(getZMQobject(1), stack->to<const std::string>(2).c_str()) != 0){
+				stack->push<bool>(false);
+				lua_pushZMQ_error(state);
+				return 2;
+			}else{
+				stack->push<bool>(true);
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	int lua_zmqConnect(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TSTRING>(2)){
+			if (zmq_connect(getZMQobject(1), stack->to<const std::string>(2).c_str()) != 0){
+				stack->push<bool>(false);
+				lua_pushZMQ_error(state);
+				return 2;
+			}else{
+				stack->push<bool>(true);
+				return 1;
 			}
 		}
 		return 0;
@@ -1227,29 +2007,39 @@ namespace LuaZMQ {
 		return 3;
 	}
 
+	/*
+		All receive functions are built on zmq_msg_recv so that every frame is received
+		exactly once at its true size. Optional buffer size arguments are accepted
+		only for backward compatibility and they are ignored.
+	*/
 	int lua_zmqRecv(lutok2::State & state){
 		Stack * stack = state.stack;
 		if (stack->is<LUA_TUSERDATA>(1)){
-			size_t len = BUFFER_SIZE;
-			if (stack->is<LUA_TNUMBER>(2)){
-				len = stack->to<int>(2);
+			int flags = 0;
+			if (stack->is<LUA_TNUMBER>(3)){
+				flags = stack->to<int>(3);
+			}
+			void * socket = getZMQobject(1);
+			if (!socket){
+				return lua_zmqPushClosedSocket(state);
 			}
-			if (len>0){
-				int flags = 0;
-				if (stack->is<LUA_TNUMBER>(3)){
-					flags = stack->to<int>(3);
-				}
-				char * buffer = static_cast<char*>(_alloca(len));
-				int result = zmq_recv(getZMQobject(1), buffer, len, flags);
-				if (result < 0){
-					stack->push<bool>(false);
-					lua_pushZMQ_error(state);
-					return 2;
-				}else{
-					stack->pushLString(std::string(buffer, (result <= len) ? result : len));
-					stack->push<int>(result);
-					return 2;
-				}
+			zmq_msg_t msg;
+			zmq_msg_init(&msg);
+
+			socketStatsProbe_t probe;
+			lua_zmqStatsBegin(probe, socket, flags);
+			int result = zmq_msg_recv(&msg, socket, flags);
+			lua_zmqStatsEnd(probe, SOCKET_STATS_RECV, result, (result >= 0) && (zmq_msg_more(&msg) == 0) ? 1 : 0, (result >= 0) ? result : 0);
+			if (result < 0){
+				zmq_msg_close(&msg);
+				stack->push<bool>(false);
+				lua_pushZMQ_error(state);
+				return 2;
+			}else{
+				lua_pushZMQ_msgData(state, &msg);
+				stack->push<int>(result);
+				zmq_msg_close(&msg);
+				return 2;
 			}
 		}
 		return 0;
@@ -1262,33 +2052,45 @@ namespace LuaZMQ {
 			if (stack->is<LUA_TNUMBER>(2)){
 				flags = stack->to<int>(2);
 			}
-			//input buffer size
-			size_t bufferSize = BUFFER_SIZE;
-			if (stack->is<LUA_TNUMBER>(3)){
-				bufferSize = stack->to<int>(3);
-			}
 
-			char * buffer = static_cast<char*>(_alloca(bufferSize));
 			void * socket = getZMQobject(1);
-			int more=1;
-			size_t moreSize = sizeof(more);
-
-			std::string fullBuffer;
+			//zmq_msg_t must not be relocated once initialized
+			std::deque<zmq_msg_t> frames;
+			size_t totalSize = 0;
+			int more = 1;
 
-			while (more==1){
-				int result = zmq_recv(socket, buffer, bufferSize, flags);
+			while (more == 1){
+				frames.emplace_back();
+				zmq_msg_t & msg = frames.back();
+				zmq_msg_init(&msg);
 
+				int result = zmq_msg_recv(&msg, socket, flags);
 				if (result < 0){
+					for (zmq_msg_t & frame : frames){
+						zmq_msg_close(&frame);
+					}
 					stack->push<bool>(false);
 					lua_pushZMQ_error(state);
 					return 2;
-				}else{
-					fullBuffer.append(buffer, result);
 				}
-				zmq_getsockopt(socket, ZMQ_RCVMORE, &more, &moreSize);
+				totalSize += zmq_msg_size(&msg);
+				more = zmq_msg_more(&msg);
+			}
+
+			if (frames.size() == 1){
+				lua_pushZMQ_msgData(state, &frames.front());
+			}else{
+				std::string fullBuffer;
+				fullBuffer.reserve(totalSize);
+				for (zmq_msg_t & frame : frames){
+					fullBuffer.append(static_cast<const char *>(zmq_msg_data(&frame)), zmq_msg_size(&frame));
+				}
+				stack->pushLString(fullBuffer.c_str(), fullBuffer.length());
 			}
 
-			stack->pushLString(std::string(fullBuffer.c_str(), fullBuffer.size()));
+			for (zmq_msg_t & frame : frames){
+				zmq_msg_close(&frame);
+			}
 			return 1;
 		}
 		return 0;
@@ -1301,66 +2103,79 @@ namespace LuaZMQ {
 			if (stack->is<LUA_TNUMBER>(2)){
 				flags = stack->to<int>(2);
 			}
-			//input buffer size
-			size_t bufferSize = BUFFER_SIZE;
-			if (stack->is<LUA_TNUMBER>(3)){
-				bufferSize = stack->to<int>(3);
-			}
 
-			char * buffer = static_cast<char*>(_alloca(bufferSize));
 			void * socket = getZMQobject(1);
+			if (!socket){
+				return lua_zmqPushClosedSocket(state);
+			}
+			/*
+				The first chunk of a part is kept in its own message so that
+				single-chunk parts are pushed into Lua without an intermediate buffer.
+			*/
+			zmq_msg_t msg, firstChunk;
 			std::string fullBuffer;
-			int more=1;
-			size_t moreSize = sizeof(more);
+			int more = 1;
+
+			zmq_msg_init(&msg);
+			zmq_msg_init(&firstChunk);
 
 			stack->newTable();
 			size_t partNum = 1;
 			size_t filledPartNum = 0;
-			size_t bytesRead = 0;
+			size_t bytes = 0;
+			socketStatsProbe_t probe;
+			lua_zmqStatsBegin(probe, socket, flags);
+
+			auto flushPart = [&](){
+				stack->push<int>(partNum++);
+				if (filledPartNum == 1){
+					lua_pushZMQ_msgData(state, &firstChunk);
+				}else{
+					stack->pushLString(fullBuffer.c_str(), fullBuffer.length());
+				}
+				stack->setTable();
+				fullBuffer.clear();
+				filledPartNum = 0;
+			};
 
 			while (more == 1){
-				int result = zmq_recv(socket, buffer, bufferSize, flags);
+				int result = zmq_msg_recv(&msg, socket, flags);
 				if (result < 0){
+					lua_zmqStatsEnd(probe, SOCKET_STATS_RECV, result, 0, 0);
+					zmq_msg_close(&msg);
+					zmq_msg_close(&firstChunk);
 					stack->pop(1); //pop table
 					stack->push<bool>(false);
 					lua_pushZMQ_error(state);
 					return 2;
-				}else{
-					//is this part delimiter
-					if ((filledPartNum > 0) && (result == 0)){
-						//flush buffer
-						stack->push<int>(partNum++);
-						stack->pushLString(std::string(fullBuffer.c_str(), fullBuffer.length()));
-						stack->setTable();
-						fullBuffer.clear();
-						filledPartNum = 0;
-						bytesRead = 0;
-					//it's a message part
+				}
+				more = zmq_msg_more(&msg);
+				size_t size = zmq_msg_size(&msg);
+				bytes += size;
+
+				//is this part delimiter
+				if ((filledPartNum > 0) && (size == 0)){
+					flushPart();
+				//it's a message part
+				}else if (size > 0){
+					if (filledPartNum == 0){
+						zmq_msg_move(&firstChunk, &msg);
 					}else{
-						if (result > 0){
-							fullBuffer.append(buffer, result);
-							bytesRead += result;
-							filledPartNum++;
-							//is buffer full?
-							if (bytesRead > MAX_BUFFER_SIZE){
-								//flush buffer
-								stack->push<int>(partNum++);
-								stack->pushLString(std::string(fullBuffer.c_str(), fullBuffer.length()));
-								stack->setTable();
-								fullBuffer.clear();
-								filledPartNum = 0;
-								bytesRead = 0;
-							}
+						if (filledPartNum == 1){
+							fullBuffer.assign(static_cast<const char *>(zmq_msg_data(&firstChunk)), zmq_msg_size(&firstChunk));
 						}
+						fullBuffer.append(static_cast<const char *>(zmq_msg_data(&msg)), size);
 					}
+					filledPartNum++;
 				}
-				zmq_getsockopt(socket, ZMQ_RCVMORE, &more, &moreSize);
 			}
-			if (partNum>=1 && filledPartNum>0){
-				stack->push<int>(partNum);
-				stack->pushLString(std::string(fullBuffer.c_str(), fullBuffer.length()));
-				stack->setTable();
+			if (filledPartNum > 0){
+				flushPart();
 			}
+			lua_zmqStatsEnd(probe, SOCKET_STATS_RECV, 0, 1, bytes);
+
+			zmq_msg_close(&msg);
+			zmq_msg_close(&firstChunk);
 			return 1;
 		}
 		return 0;
@@ -1369,15 +2184,25 @@ namespace LuaZMQ {
 	int lua_zmqSend(lutok2::State & state){
 		Stack * stack = state.stack;
 		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TSTRING>(2)){
-			const std::string buffer = stack->toLString(2);
-			size_t len = buffer.length();
+			//data are sent straight from the Lua string
+			const char * buffer = stack->to<const char *>(2);
+			size_t len = stack->objLen(2);
 			int flags = 0;
 			if (stack->is<LUA_TNUMBER>(3)){
 				flags = stack->to<int>(3);
 			}
 
+			void * socket = getZMQobject(1);
+			if (!socket){
+				return lua_zmqPushClosedSocket(state);
+			}
+			socketStatsProbe_t probe;
+			lua_zmqStatsBegin(probe, socket, flags);
+			uint64_t messages = (flags & ZMQ_SNDMORE) ? 0 : 1;
+
 			if (len>0){
-				int result = zmq_send(getZMQobject(1), buffer.c_str(), len, flags);
+				int result = zmq_send(socket, buffer, len, flags);
+				lua_zmqStatsEnd(probe, SOCKET_STATS_SEND, result, messages, len);
 				if (result < 0){
 					stack->push<bool>(false);
 					lua_pushZMQ_error(state);
@@ -1387,7 +2212,8 @@ namespace LuaZMQ {
 					return 1;
 				}
 			}else{
-				int result = zmq_send(getZMQobject(1), nullptr, 0, flags);
+				int result = zmq_send(socket, nullptr, 0, flags);
+				lua_zmqStatsEnd(probe, SOCKET_STATS_SEND, result, messages, 0);
 				if (result < 0){
 					stack->push<bool>(false);
 					lua_pushZMQ_error(state);
@@ -1401,122 +2227,553 @@ namespace LuaZMQ {
 		return 0;
 	}
 
-	int lua_zmqSendMultipart(lutok2::State & state){
+	int lua_zmqSendMultipart(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TTABLE>(2)){
+			int flags = 0;
+			if (stack->is<LUA_TNUMBER>(3)){
+				flags = stack->to<int>(3);
+			}
+			//input buffer size
+			size_t bufferSize = BUFFER_SIZE;
+			if (stack->is<LUA_TNUMBER>(4)){
+				bufferSize = stack->to<int>(4);
+			}
+
+			void * socket = getZMQobject(1);
+			if (!socket){
+				return lua_zmqPushClosedSocket(state);
+			}
+			size_t parts = stack->objLen(2);
+			size_t partsSent = 0;
+			size_t bytes = 0;
+			socketStatsProbe_t probe;
+			lua_zmqStatsBegin(probe, socket, flags);
+			/*
+				Each part is represented by element in Lua table.
+				All parts are sent with ZMQ_SNDMORE flag on and divided with empty ZMQ frame.
+				See lua_zmqSendFrames for native ZeroMQ multipart format.
+			*/
+			for (size_t partIndex=1; partIndex <= parts; partIndex++){
+				stack->push<int>(partIndex);
+				stack->getTable(2);
+
+				if (stack->is<LUA_TSTRING>()){
+					const std::string buffer = stack->toLString();
+					size_t len = buffer.length();
+					size_t offset = 0;
+					const char * inputBuffer = buffer.c_str();
+					int finalFlags = (partIndex < parts) ? (flags | ZMQ_SNDMORE) : flags; 
+
+					if (len>0){
+						//send a part
+						do {
+							size_t outputSize = ((len-offset) > bufferSize) ? bufferSize : len-offset;
+
+							int result = zmq_send(getZMQobject(1), inputBuffer+offset, outputSize, finalFlags);
+							if (result < 0){
+								lua_zmqStatsEnd(probe, SOCKET_STATS_SEND, result, 0, 0);
+								stack->pop(1);
+								stack->push<bool>(false);
+								lua_pushZMQ_error(state);
+								return 2;
+							}else{
+								offset += result;
+							}
+						}
+						while (offset < len);
+						partsSent++;
+						bytes += len;
+					}
+					if (partIndex < parts){
+						// send a delimiter
+						int result = zmq_send(getZMQobject(1), nullptr, 0, finalFlags);
+						if (result < 0){
+							lua_zmqStatsEnd(probe, SOCKET_STATS_SEND, result, 0, 0);
+							stack->pop(1);
+							stack->push<bool>(false);
+							lua_pushZMQ_error(state);
+							return 2;
+						}
+					}
+				}
+				stack->pop(1);
+			}
+			lua_zmqStatsEnd(probe, SOCKET_STATS_SEND, 0, ((flags & ZMQ_SNDMORE) || (parts == 0)) ? 0 : 1, bytes);
+			stack->push<int>(partsSent);
+			return 1;
+		}
+		return 0;
+	}
+
+	/*
+		Receives all frames of one message into a new Lua table, one table element per frame.
+		Returns the number of frames received or -1 on error, in which case nothing is pushed.
+		Total size of received frames is stored in bytes.
+	*/
+	static int lua_zmqPushFrames(lutok2::State & state, void * socket, int flags, size_t & bytes){
+		Stack * stack = state.stack;
+		zmq_msg_t msg;
+		int more = 1;
+		int partNum = 0;
+
+		zmq_msg_init(&msg);
+		stack->newTable();
+
+		while (more == 1){
+			int result = zmq_msg_recv(&msg, socket, flags);
+			if (result < 0){
+				zmq_msg_close(&msg);
+				stack->pop(1); //pop table
+				return -1;
+			}
+			more = zmq_msg_more(&msg);
+			bytes += zmq_msg_size(&msg);
+
+			stack->push<int>(++partNum);
+			lua_pushZMQ_msgData(state, &msg);
+			stack->setTable();
+		}
+
+		zmq_msg_close(&msg);
+		return partNum;
+	}
+
+	//true if all elements of the table are strings
+	static bool lua_zmqCheckFrames(lutok2::State & state, int tableIndex){
+		Stack * stack = state.stack;
+		size_t parts = stack->objLen(tableIndex);
+		for (size_t partIndex = 1; partIndex <= parts; partIndex++){
+			stack->push<int>(partIndex);
+			stack->getTable(tableIndex);
+			bool valid = stack->is<LUA_TSTRING>();
+			stack->pop(1);
+			if (!valid){
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/*
+		Sends each element of a Lua table as exactly one frame of a single message.
+		Data are copied once from Lua string into message memory.
+		Returns the number of frames sent or -1 on error. Total size of sent frames is added to bytes.
+		All elements are checked first, so an invalid element doesn't leave a partially sent message.
+	*/
+	static int lua_zmqSendFrames(lutok2::State & state, void * socket, int tableIndex, int flags, size_t & bytes){
+		Stack * stack = state.stack;
+		size_t parts = stack->objLen(tableIndex);
+		int partsSent = 0;
+
+		if (!lua_zmqCheckFrames(state, tableIndex)){
+			errno = EINVAL;
+			return -1;
+		}
+
+		for (size_t partIndex = 1; partIndex <= parts; partIndex++){
+			stack->push<int>(partIndex);
+			stack->getTable(tableIndex);
+
+			const char * data = stack->to<const char *>();
+			size_t len = stack->objLen(-1);
+			int finalFlags = (partIndex < parts) ? (flags | ZMQ_SNDMORE) : flags;
+
+			zmq_msg_t msg;
+			if (zmq_msg_init_size(&msg, len) != 0){
+				stack->pop(1);
+				return -1;
+			}
+			if (len > 0){
+				memcpy(zmq_msg_data(&msg), data, len);
+			}
+			stack->pop(1);
+
+			if (zmq_msg_send(&msg, socket, finalFlags) < 0){
+				zmq_msg_close(&msg);
+				return -1;
+			}
+			partsSent++;
+			bytes += len;
+		}
+		return partsSent;
+	}
+
+	int lua_zmqRecvFrames(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			int flags = 0;
+			if (stack->is<LUA_TNUMBER>(2)){
+				flags = stack->to<int>(2);
+			}
+			void * socket = getZMQobject(1);
+			if (!socket){
+				return lua_zmqPushClosedSocket(state);
+			}
+			socketStatsProbe_t probe;
+			lua_zmqStatsBegin(probe, socket, flags);
+			size_t bytes = 0;
+			int frames = lua_zmqPushFrames(state, socket, flags, bytes);
+			lua_zmqStatsEnd(probe, SOCKET_STATS_RECV, frames, 1, bytes);
+			if (frames < 0){
+				stack->push<bool>(false);
+				lua_pushZMQ_error(state);
+				return 2;
+			}
+			return 1;
+		}
+		return 0;
+	}
+
+	int lua_zmqSendFramesTable(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TTABLE>(2)){
+			int flags = 0;
+			if (stack->is<LUA_TNUMBER>(3)){
+				flags = stack->to<int>(3);
+			}
+			void * socket = getZMQobject(1);
+			if (!socket){
+				return lua_zmqPushClosedSocket(state);
+			}
+			size_t bytes = 0;
+			socketStatsProbe_t probe;
+			lua_zmqStatsBegin(probe, socket, flags);
+			int result = lua_zmqSendFrames(state, socket, 2, flags, bytes);
+			lua_zmqStatsEnd(probe, SOCKET_STATS_SEND, result, (flags & ZMQ_SNDMORE) ? 0 : 1, bytes);
+			if (result < 0){
+				stack->push<bool>(false);
+				lua_pushZMQ_error(state);
+				return 2;
+			}
+			stack->push<int>(result);
+			return 1;
+		}
+		return 0;
+	}
+
+	/*
+		Drains up to max messages in one call.
+		The first message is received with given flags, the rest with ZMQ_DONTWAIT so the call
+		returns as soon as the socket is empty. Single frame messages are stored as strings,
+		multipart messages as tables of frames. An optional table can be passed to be reused.
+		A multipart message that fails in a later frame is dropped and ends the batch,
+		the error is returned if nothing else has been received.
+	*/
+	int lua_zmqRecvBatch(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TNUMBER>(2)){
+			void * socket = getZMQobject(1);
+			int max = stack->to<int>(2);
+			int flags = 0;
+			if (stack->is<LUA_TNUMBER>(3)){
+				flags = stack->to<int>(3);
+			}
+
+			size_t previousCount = 0;
+			if (stack->is<LUA_TTABLE>(4)){
+				previousCount = stack->objLen(4);
+				stack->pushValue(4);
+			}else{
+				stack->newTable();
+			}
+			int tableIndex = stack->getTop();
+
+			zmq_msg_t msg;
+			zmq_msg_init(&msg);
+			int count = 0;
+			int error = 0;
+			bool truncated = false;
+
+			while (count < max){
+				int result = zmq_msg_recv(&msg, socket, (count == 0) ? flags : (flags | ZMQ_DONTWAIT));
+				if (result < 0){
+					error = zmq_errno();
+					break;
+				}
+
+				stack->push<int>(++count);
+				if (zmq_msg_more(&msg) == 1){
+					stack->newTable();
+					stack->push<int>(1);
+					lua_pushZMQ_msgData(state, &msg);
+					stack->setTable();
+
+					int partNum = 1;
+					while (zmq_msg_more(&msg) == 1){
+						if (zmq_msg_recv(&msg, socket, 0) < 0){
+							error = zmq_errno();
+							truncated = true;
+							break;
+						}
+						stack->push<int>(++partNum);
+						lua_pushZMQ_msgData(state, &msg);
+						stack->setTable();
+					}
+					if (truncated){
+						//drop the key and the incomplete message
+						stack->pop(2);
+						count--;
+						break;
+					}
+				}else{
+					lua_pushZMQ_msgData(state, &msg);
+				}
+				stack->setTable(tableIndex);
+			}
+			zmq_msg_close(&msg);
+
+			//clear remaining elements of reused table
+			for (size_t index = count + 1; index <= previousCount; index++){
+				stack->push<int>(index);
+				stack->pushNil();
+				stack->setTable(tableIndex);
+			}
+
+			if ((count == 0) && (error != 0) && (truncated || (error != EAGAIN))){
+				stack->pop(1);
+				stack->push<bool>(false);
+				stack->push<const std::string &>(zmq_strerror(error));
+				return 2;
+			}
+			stack->push<int>(count);
+			return 2;
+		}
+		return 0;
+	}
+
+	/*
+		Sends all elements of a table in one call. String elements are sent as single frame
+		messages, table elements as multipart messages (one frame per element).
+		Stops on EAGAIN and returns the number of messages sent.
+		Elements other than strings and non-empty tables of strings fail the whole batch with EINVAL.
+	*/
+	int lua_zmqSendBatch(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TTABLE>(2)){
+			void * socket = getZMQobject(1);
+			int flags = 0;
+			if (stack->is<LUA_TNUMBER>(3)){
+				flags = stack->to<int>(3);
+			}
+
+			size_t messages = stack->objLen(2);
+			int messagesSent = 0;
+
+			//whole batch is checked first, invalid or empty elements don't send anything
+			for (size_t index = 1; index <= messages; index++){
+				stack->push<int>(index);
+				stack->getTable(2);
+				bool valid = stack->is<LUA_TSTRING>(-1) ||
+					(stack->is<LUA_TTABLE>(-1) && (stack->objLen(-1) > 0) && lua_zmqCheckFrames(state, stack->getTop()));
+				stack->pop(1);
+				if (!valid){
+					stack->push<bool>(false);
+					stack->push<const std::string &>(zmq_strerror(EINVAL));
+					stack->push<int>(0);
+					return 3;
+				}
+			}
+
+			for (size_t index = 1; index <= messages; index++){
+				int result = 0;
+				stack->push<int>(index);
+				stack->getTable(2);
+
+				if (stack->is<LUA_TTABLE>(-1)){
+					size_t bytes = 0;
+					result = lua_zmqSendFrames(state, socket, stack->getTop(), flags, bytes);
+				}else{
+					result = zmq_send(socket, stack->to<const char *>(), stack->objLen(-1), flags);
+				}
+				stack->pop(1);
+
+				if (result < 0){
+					int error = zmq_errno();
+					if (error == EAGAIN){
+						break;
+					}
+					stack->push<bool>(false);
+					stack->push<const std::string &>(zmq_strerror(error));
+					stack->push<int>(messagesSent);
+					return 3;
+				}
+				messagesSent++;
+			}
+
+			stack->push<int>(messagesSent);
+			return 1;
+		}
+		return 0;
+	}
+
+	/*
+		Encodes a Lua value (including nested tables) directly into a single message frame.
+		Flags are the same as for zmq_send.
+	*/
+	int lua_zmqSendValue(lutok2::State & state){
 		Stack * stack = state.stack;
-		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TTABLE>(2)){
+		if (stack->is<LUA_TUSERDATA>(1)){
 			int flags = 0;
 			if (stack->is<LUA_TNUMBER>(3)){
 				flags = stack->to<int>(3);
 			}
-			//input buffer size
-			size_t bufferSize = BUFFER_SIZE;
-			if (stack->is<LUA_TNUMBER>(4)){
-				bufferSize = stack->to<int>(4);
+			if (stack->getTop() < 2){
+				stack->pushNil();
 			}
 
-			size_t parts = stack->objLen(2);
-			size_t partsSent = 0;
-			/*
-				Each part is represented by element in Lua table.
-				All parts are sent with ZMQ_SNDMORE flag on and divided with empty ZMQ frame.
-			*/
-			for (size_t partIndex=1; partIndex <= parts; partIndex++){
-				stack->push<int>(partIndex);
-				stack->getTable(2);
+			valueEncoder_t encoder;
+			std::string error;
+			encoder.output = nullptr;
 
-				if (stack->is<LUA_TSTRING>()){
-					const std::string buffer = stack->toLString();
-					size_t len = buffer.length();
-					size_t offset = 0;
-					const char * inputBuffer = buffer.c_str();
-					int finalFlags = (partIndex < parts) ? (flags | ZMQ_SNDMORE) : flags; 
+			size_t size = lua_zmqEncodeValues(state, 2, 1, encoder, error);
+			if (size == 0){
+				stack->push<bool>(false);
+				stack->push<const std::string &>(error);
+				return 2;
+			}
 
-					if (len>0){
-						//send a part
-						do {
-							size_t outputSize = ((len-offset) > bufferSize) ? bufferSize : len-offset;
+			zmq_msg_t msg;
+			if (zmq_msg_init_size(&msg, size) != 0){
+				stack->push<bool>(false);
+				lua_pushZMQ_error(state);
+				return 2;
+			}
+			encoder.output = static_cast<char*>(zmq_msg_data(&msg));
+			lua_zmqEncodeValues(state, 2, 1, encoder, error);
 
-							int result = zmq_send(getZMQobject(1), inputBuffer+offset, outputSize, finalFlags);
-							if (result < 0){
-								stack->pop(1);
-								stack->push<bool>(false);
-								lua_pushZMQ_error(state);
-								return 2;
-							}else{
-								offset += result;
-							}
-						}
-						while (offset < len);
-						partsSent++;
-					}
-					if (partIndex < parts){
-						// send a delimiter
-						int result = zmq_send(getZMQobject(1), nullptr, 0, finalFlags);
-						if (result < 0){
-							stack->pop(1);
-							stack->push<bool>(false);
-							lua_pushZMQ_error(state);
-							return 2;
-						}
-					}
-				}
-				stack->pop(1);
+			if (zmq_msg_send(&msg, getZMQobject(1), flags) < 0){
+				lua_zmqReleaseValues(static_cast<char*>(zmq_msg_data(&msg)), zmq_msg_size(&msg));
+				zmq_msg_close(&msg);
+				stack->push<bool>(false);
+				lua_pushZMQ_error(state);
+				return 2;
 			}
-			stack->push<int>(partsSent);
+			stack->push<bool>(true);
 			return 1;
 		}
 		return 0;
 	}
 
-	void lua_zmqFreeData(void * data, void * hint){
-		delete reinterpret_cast<char*>(data);
-	}
-	
-	int lua_zmqMsgInit(lutok2::State & state){
+	/*
+		Receives a value encoded with sendValue.
+		Functions and userdata are accepted only if the third argument is true,
+		so keep it off for sockets with untrusted peers.
+	*/
+	int lua_zmqRecvValue(lutok2::State & state){
 		Stack * stack = state.stack;
-		zmq_msg_t * msg = new zmq_msg_t;
-		if (msg){
-			size_t size = 0;
-			int result = 0;
-			if (stack->is<LUA_TNUMBER>(1)){
-				result = zmq_msg_init_size(msg, stack->to<int>(1));
-			}
-			else if (stack->is<LUA_TSTRING>(1)){
-				const std::string dataObj = stack->toLString(1);
-				const size_t dataSize = dataObj.size();
-				char * data = new char[dataSize];
-				memcpy(data, dataObj.c_str(), dataSize);
-				result = zmq_msg_init_data(msg, data, dataSize, lua_zmqFreeData, nullptr);
-			} else{
-				result = zmq_msg_init(msg);
+		if (stack->is<LUA_TUSERDATA>(1)){
+			int flags = 0;
+			if (stack->is<LUA_TNUMBER>(2)){
+				flags = stack->to<int>(2);
 			}
+			bool trusted = stack->is<LUA_TBOOLEAN>(3) && stack->to<bool>(3);
+
+			zmq_msg_t msg;
+			zmq_msg_init(&msg);
 
-			if (result != 0){
-				delete msg;
+			if (zmq_msg_recv(&msg, getZMQobject(1), flags) < 0){
+				zmq_msg_close(&msg);
 				stack->push<bool>(false);
 				lua_pushZMQ_error(state);
 				return 2;
-			}else{
-				pushUData(msg);
-				return 1;
 			}
-		}else{
-			return 0; 
+
+			int count = lua_zmqDecodeValues(state, static_cast<char*>(zmq_msg_data(&msg)), zmq_msg_size(&msg), trusted);
+			/*
+				Frame owns references of shared objects sent by sendValue in the same process,
+				they're dropped even if untrusted decoding rejected the frame.
+				Only references recorded by the encoder are released, so forged frames can't release anything.
+			*/
+			lua_zmqReleaseValues(static_cast<char*>(zmq_msg_data(&msg)), zmq_msg_size(&msg));
+			zmq_msg_close(&msg);
+
+			if (count != 1){
+				if (count > 1){
+					stack->pop(count);
+				}
+				stack->push<bool>(false);
+				stack->push<const std::string &>("Malformed value");
+				return 2;
+			}
+			return 1;
+		}
+		return 0;
+	}
+
+	/*
+		Message userdata keeps zmq_msg_t inline, so a message costs a single allocation done by Lua.
+		Every message userdata has this layout (msgInit, msgObject, recvView, recvMsg and channel pops),
+		the pointer member comes first so all msg functions get the message with getZMQobject.
+		Closed message keeps a null pointer, storage is never freed separately.
+	*/
+	struct msgObject_t {
+		zmq_msg_t * msg;
+		zmq_msg_t storage;
+	};
+
+	//registry keys of the shared metatable and method table of message objects
+	const char * msgObjectMetatable = "luazmq_msg";
+	const char * msgObjectMethods = "luazmq_msg_methods";
+
+	//initializes message from a size or a string at index, empty message otherwise
+	static int lua_zmqMsgInitFrom(lutok2::State & state, zmq_msg_t * msg, int index){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TNUMBER>(index)){
+			return zmq_msg_init_size(msg, stack->to<int>(index));
+		}else if (stack->is<LUA_TSTRING>(index)){
+			const std::string data = stack->toLString(index);
+			//small payloads are stored inside zmq_msg_t without any allocation
+			int result = zmq_msg_init_size(msg, data.size());
+			if (result == 0){
+				memcpy(zmq_msg_data(msg), data.c_str(), data.size());
+			}
+			return result;
+		}
+		return zmq_msg_init(msg);
+	}
+
+	//pushes a new empty message userdata with inline zmq_msg_t and the shared metatable from the registry
+	zmq_msg_t * lua_zmqPushMsgObject(lutok2::State & state){
+		Stack * stack = state.stack;
+		msgObject_t * object = static_cast<msgObject_t *>(stack->newUserData(sizeof(msgObject_t)));
+		object->msg = &object->storage;
+		zmq_msg_init(object->msg);
+		stack->push<const std::string &>(msgObjectMetatable);
+		stack->getTable(LUA_REGISTRYINDEX);
+		stack->setMetatable();
+		return object->msg;
+	}
+
+	int lua_zmqMsgInit(lutok2::State & state){
+		Stack * stack = state.stack;
+		zmq_msg_t * msg = lua_zmqPushMsgObject(state);
+		zmq_msg_close(msg);
+		if (lua_zmqMsgInitFrom(state, msg, 1) != 0){
+			zmq_msg_init(msg);
+			stack->pop(1);
+			stack->push<bool>(false);
+			lua_pushZMQ_error(state);
+			return 2;
 		}
+		return 1;
 	}
 
 	int lua_zmqMsgClose(lutok2::State & state){
 		Stack * stack = state.stack;
 		if (stack->is<LUA_TUSERDATA>(1)){
-			zmq_msg_t * msg = static_cast<zmq_msg_t*>(getZMQobject(1));
+			zmq_msg_t ** object = static_cast<zmq_msg_t **>(stack->to<void*>(1));
+			zmq_msg_t * msg = *object;
 			if (msg){
-				if (zmq_msg_close(msg) != 0){
+				//closed message keeps a null pointer, so __gc after explicit close does nothing
+				*object = nullptr;
+				int result = zmq_msg_close(msg);
+				if (result != 0){
 					stack->push<bool>(false);
 					lua_pushZMQ_error(state);
-				}else{
-					delete msg;
-					return 0;
+					return 2;
 				}
+				return 0;
 			}
 		}
 		stack->push<bool>(false);
@@ -1571,8 +2828,7 @@ namespace LuaZMQ {
 					stack->push<bool>(false);
 					lua_pushZMQ_error(state);
 				}else{
-					size_t size = zmq_msg_size(msg);
-					stack->pushLString(std::string(static_cast<char *>(result), size));
+					lua_pushZMQ_msgData(state, msg);
 					return 1;
 				}
 			}
@@ -1581,6 +2837,10 @@ namespace LuaZMQ {
 		return 1;
 	}
 
+	/*
+		Replaces message payload with a string. Payload of the same size is overwritten in place,
+		otherwise the message is reinitialized with the new size, so the message holds exactly the new data.
+	*/
 	int lua_zmqMsgSetData(lutok2::State & state){
 		Stack * stack = state.stack;
 		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TSTRING>(2)){
@@ -1595,17 +2855,17 @@ namespace LuaZMQ {
 					const std::string src = stack->toLString(2);
 					size_t src_size = src.length();
 
-					if (src_size <= dest_size){
+					if (src_size == dest_size){
 						memcpy(result, src.c_str(), src_size);
 					}else{
 						zmq_msg_close(msg);
 						if (zmq_msg_init_size(msg, src_size) != 0){
-							delete msg;
+							zmq_msg_init(msg);
 							stack->push<bool>(false);
 							lua_pushZMQ_error(state);
 							return 2;
 						}else{
-							memcpy(result, src.c_str(), src_size);
+							memcpy(zmq_msg_data(msg), src.c_str(), src_size);
 						}
 					}
 					return 0;
@@ -1630,6 +2890,179 @@ namespace LuaZMQ {
 		return 1;
 	}
 
+	int lua_zmqMsgSub(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			zmq_msg_t * msg = static_cast<zmq_msg_t*>(getZMQobject(1));
+			if (msg){
+				const char * data = static_cast<const char *>(zmq_msg_data(msg));
+				size_t size = zmq_msg_size(msg);
+				int start = lua_zmqRelativePosition(stack->is<LUA_TNUMBER>(2) ? stack->to<int>(2) : 1, size);
+				int end = lua_zmqRelativePosition(stack->is<LUA_TNUMBER>(3) ? stack->to<int>(3) : -1, size);
+
+				if (start < 1){
+					start = 1;
+				}
+				if (end > static_cast<int>(size)){
+					end = static_cast<int>(size);
+				}
+				if (start <= end){
+					stack->pushLString(data + (start - 1), static_cast<size_t>(end - start + 1));
+				}else{
+					stack->pushLString("", 0);
+				}
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	int lua_zmqMsgByte(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			zmq_msg_t * msg = static_cast<zmq_msg_t*>(getZMQobject(1));
+			if (msg){
+				const unsigned char * data = static_cast<const unsigned char *>(zmq_msg_data(msg));
+				size_t size = zmq_msg_size(msg);
+				int start = lua_zmqRelativePosition(stack->is<LUA_TNUMBER>(2) ? stack->to<int>(2) : 1, size);
+				int end = lua_zmqRelativePosition(stack->is<LUA_TNUMBER>(3) ? stack->to<int>(3) : start, size);
+
+				if (start < 1){
+					start = 1;
+				}
+				if (end > static_cast<int>(size)){
+					end = static_cast<int>(size);
+				}
+				int count = 0;
+				for (int position = start; position <= end; position++, count++){
+					stack->push<int>(data[position - 1]);
+				}
+				return count;
+			}
+		}
+		return 0;
+	}
+
+	/*
+		Plain substring search over message payload (no Lua patterns).
+		Returns start and end position of the first occurrence or nil.
+	*/
+	int lua_zmqMsgFind(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TSTRING>(2)){
+			zmq_msg_t * msg = static_cast<zmq_msg_t*>(getZMQobject(1));
+			if (msg){
+				const char * data = static_cast<const char *>(zmq_msg_data(msg));
+				size_t size = zmq_msg_size(msg);
+				const std::string needle = stack->toLString(2);
+				int init = lua_zmqRelativePosition(stack->is<LUA_TNUMBER>(3) ? stack->to<int>(3) : 1, size);
+
+				if (init < 1){
+					init = 1;
+				}
+				if (static_cast<size_t>(init - 1) <= size){
+					const char * begin = data + (init - 1);
+					const char * end = data + size;
+					const char * result = std::search(begin, end, needle.begin(), needle.end());
+					if ((result != end) || needle.empty()){
+						int position = static_cast<int>(result - data) + 1;
+						stack->push<int>(position);
+						stack->push<int>(position + static_cast<int>(needle.length()) - 1);
+						return 2;
+					}
+				}
+				stack->pushNil();
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	int lua_zmqRecvFrame(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			int flags = 0;
+			if (stack->is<LUA_TNUMBER>(2)){
+				flags = stack->to<int>(2);
+			}
+			zmq_msg_t msg;
+			zmq_msg_init(&msg);
+
+			int result = zmq_msg_recv(&msg, getZMQobject(1), flags);
+			if (result < 0){
+				zmq_msg_close(&msg);
+				stack->push<bool>(false);
+				lua_pushZMQ_error(state);
+				return 2;
+			}else{
+				lua_pushZMQ_msgData(state, &msg);
+				stack->push<bool>(zmq_msg_more(&msg) == 1);
+				zmq_msg_close(&msg);
+				return 2;
+			}
+		}
+		return 0;
+	}
+
+	/*
+		Receives one frame into a new message object without copying its payload into Lua.
+		Payload can be accessed with msgSub, msgByte, msgFind and msgSize.
+	*/
+	int lua_zmqRecvView(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			int flags = 0;
+			if (stack->is<LUA_TNUMBER>(2)){
+				flags = stack->to<int>(2);
+			}
+			void * socket = getZMQobject(1);
+			zmq_msg_t * msg = lua_zmqPushMsgObject(state);
+
+			int result = zmq_msg_recv(msg, socket, flags);
+			if (result < 0){
+				stack->pop(1);
+				stack->push<bool>(false);
+				lua_pushZMQ_error(state);
+				return 2;
+			}
+			return 1;
+		}
+		return 0;
+	}
+
+	/*
+		Receives one frame into a new message object with the shared metatable.
+		Unlike recvView, the frame is counted in socket statistics.
+	*/
+	int lua_zmqRecvMsg(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			int flags = 0;
+			if (stack->is<LUA_TNUMBER>(2)){
+				flags = stack->to<int>(2);
+			}
+			void * socket = getZMQobject(1);
+			if (!socket){
+				return lua_zmqPushClosedSocket(state);
+			}
+			zmq_msg_t * msg = lua_zmqPushMsgObject(state);
+
+			socketStatsProbe_t probe;
+			lua_zmqStatsBegin(probe, socket, flags);
+			int result = zmq_msg_recv(msg, socket, flags);
+			lua_zmqStatsEnd(probe, SOCKET_STATS_RECV, result, (result >= 0) && (zmq_msg_more(msg) == 0) ? 1 : 0, (result >= 0) ? result : 0);
+
+			if (result < 0){
+				stack->pop(1);
+				stack->push<bool>(false);
+				lua_pushZMQ_error(state);
+				return 2;
+			}
+			return 1;
+		}
+		return 0;
+	}
+
 	int lua_zmqMsgMore(lutok2::State & state){
 		Stack * stack = state.stack;
 		if (stack->is<LUA_TUSERDATA>(1)){
@@ -1777,7 +3210,10 @@ namespace LuaZMQ {
 				if (stack->is<LUA_TNUMBER>(3)){
 					flags = stack->to<int>(3);
 				}
+				socketStatsProbe_t probe;
+				lua_zmqStatsBegin(probe, socket, flags);
 				int result = zmq_msg_recv(msg, socket, flags);
+				lua_zmqStatsEnd(probe, SOCKET_STATS_RECV, result, (result >= 0) && (zmq_msg_more(msg) == 0) ? 1 : 0, (result >= 0) ? result : 0);
 
 				if (result == -1){
 					stack->push<bool>(false);
@@ -1803,7 +3239,10 @@ namespace LuaZMQ {
 				if (stack->is<LUA_TNUMBER>(3)){
 					flags = stack->to<int>(3);
 				}
+				socketStatsProbe_t probe;
+				lua_zmqStatsBegin(probe, socket, flags);
 				int result = zmq_msg_send(msg, socket, flags);
+				lua_zmqStatsEnd(probe, SOCKET_STATS_SEND, result, (flags & ZMQ_SNDMORE) ? 0 : 1, (result >= 0) ? result : 0);
 
 				if (result == -1){
 					stack->push<bool>(false);
@@ -1818,6 +3257,101 @@ namespace LuaZMQ {
 		return 0;
 	}
 
+	//new message object from a size or a string
+	int lua_zmqMsgObjectNew(lutok2::State & state){
+		Stack * stack = state.stack;
+		zmq_msg_t * msg = lua_zmqPushMsgObject(state);
+		zmq_msg_close(msg);
+		if (lua_zmqMsgInitFrom(state, msg, 1) != 0){
+			zmq_msg_init(msg);
+			stack->pop(1);
+			stack->push<bool>(false);
+			lua_pushZMQ_error(state);
+			return 2;
+		}
+		return 1;
+	}
+
+	//payload as a string, closed message gives an empty string
+	int lua_zmqMsgToString(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			zmq_msg_t * msg = static_cast<zmq_msg_t*>(getZMQobject(1));
+			if (msg){
+				lua_pushZMQ_msgData(state, msg);
+				return 1;
+			}
+		}
+		stack->pushLString("", 0);
+		return 1;
+	}
+
+	static int lua_zmqMsgObjectMore(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			zmq_msg_t * msg = static_cast<zmq_msg_t*>(getZMQobject(1));
+			if (msg){
+				stack->push<bool>(zmq_msg_more(msg) == 1);
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	//shared method table, zmq.lua adds methods implemented in Lua
+	int lua_zmqMsgObjectMethods(lutok2::State & state){
+		Stack * stack = state.stack;
+		stack->push<const std::string &>(msgObjectMethods);
+		stack->getTable(LUA_REGISTRYINDEX);
+		return 1;
+	}
+
+	//creates the shared metatable of message objects in the registry
+	void lua_zmqRegisterMsgObject(State * state){
+		Stack * stack = state->stack;
+		Module methods;
+		Module metamethods;
+
+		methods["close"] = lua_zmqMsgClose;
+		methods["size"] = lua_zmqMsgSize;
+		methods["len"] = lua_zmqMsgSize;
+		methods["data"] = lua_zmqMsgGetData;
+		methods["setData"] = lua_zmqMsgSetData;
+		methods["sub"] = lua_zmqMsgSub;
+		methods["byte"] = lua_zmqMsgByte;
+		methods["find"] = lua_zmqMsgFind;
+		methods["more"] = lua_zmqMsgObjectMore;
+		methods["gets"] = lua_zmqMsgGets;
+		methods["get"] = lua_zmqMsgGet;
+		methods["set"] = lua_zmqMsgSet;
+		methods["group"] = lua_zmqMsgGetGroup;
+		methods["setGroup"] = lua_zmqMsgSetGroup;
+		methods["routingID"] = lua_zmqMsgGetRoutingID;
+		methods["setRoutingID"] = lua_zmqMsgSetRoutingID;
+		methods["copy"] = lua_zmqMsgCopy;
+		methods["move"] = lua_zmqMsgMove;
+		methods["send"] = lua_zmqMsgSend;
+		methods["recv"] = lua_zmqMsgRecv;
+
+		metamethods["__gc"] = lua_zmqMsgClose;
+		metamethods["__len"] = lua_zmqMsgSize;
+		metamethods["__tostring"] = lua_zmqMsgToString;
+
+		stack->push<const std::string &>(msgObjectMethods);
+		stack->newTable();
+		state->registerLib(methods);
+		stack->setTable(LUA_REGISTRYINDEX);
+
+		stack->push<const std::string &>(msgObjectMetatable);
+		stack->newTable();
+		state->registerLib(metamethods);
+		stack->push<const std::string &>("__index");
+		stack->push<const std::string &>(msgObjectMethods);
+		stack->getTable(LUA_REGISTRYINDEX);
+		stack->setTable();
+		stack->setTable(LUA_REGISTRYINDEX);
+	}
+
 	int lua_zmqSleep(lutok2::State & state){
 		Stack * stack = state.stack;
 		if (stack->is<LUA_TNUMBER>(1)){
@@ -1994,11 +3528,13 @@ namespace LuaZMQ {
 
 };
 
-extern "C" LIBLUAZMQ_DLL_EXPORTED int luaopen_luazmq(lua_State * L){
-	State * state = new State(L);
+//pushes a new table with all module functions
+void LuaZMQ::lua_zmqPushModule(State * state){
 	Stack * stack = state->stack;
 	Module luazmq_module;
 
+	LuaZMQ::lua_zmqRegisterSocketObject(state);
+	LuaZMQ::lua_zmqRegisterMsgObject(state);
 	stack->newTable();
 	
 	luazmq_module["version"] = LuaZMQ::lua_zmqVersion;
@@ -2016,6 +3552,14 @@ extern "C" LIBLUAZMQ_DLL_EXPORTED int luaopen_luazmq(lua_State * L){
 	luazmq_module["socketGetOptionI64"] = LuaZMQ::lua_zmqGetSockOptI64;
 	luazmq_module["socketGetOptionIptr"] = LuaZMQ::lua_zmqGetSockOptIptr;
 	luazmq_module["socketGetOptionS"] = LuaZMQ::lua_zmqGetSockOptS;
+	luazmq_module["socketOptionID"] = LuaZMQ::lua_zmqSocketOptionID;
+	luazmq_module["socketGetOption"] = LuaZMQ::lua_zmqSocketGetOption;
+	luazmq_module["socketSetOption"] = LuaZMQ::lua_zmqSocketSetOption;
+	luazmq_module["socketRcvMore"] = LuaZMQ::lua_zmqSocketRcvMore;
+	luazmq_module["socketEvents"] = LuaZMQ::lua_zmqSocketEvents;
+	luazmq_module["socketFD"] = LuaZMQ::lua_zmqSocketFD;
+	luazmq_module["socketObject"] = LuaZMQ::lua_zmqSocketObjectNew;
+	luazmq_module["socketObjectMethods"] = LuaZMQ::lua_zmqSocketObjectMethods;
 
 	luazmq_module["bind"] = LuaZMQ::lua_zmqBind;
 	luazmq_module["unbind"] = LuaZMQ::lua_zmqUnbind;
@@ -2032,9 +3576,18 @@ extern "C" LIBLUAZMQ_DLL_EXPORTED int luaopen_luazmq(lua_State * L){
 	luazmq_module["recvAll"] = LuaZMQ::lua_zmqRecvAll;
 	luazmq_module["recvMultipart"] = LuaZMQ::lua_zmqRecvMultipart;
 	luazmq_module["sendMultipart"] = LuaZMQ::lua_zmqSendMultipart;
+	luazmq_module["recvFrames"] = LuaZMQ::lua_zmqRecvFrames;
+	luazmq_module["sendFrames"] = LuaZMQ::lua_zmqSendFramesTable;
+	luazmq_module["recvBatch"] = LuaZMQ::lua_zmqRecvBatch;
+	luazmq_module["sendBatch"] = LuaZMQ::lua_zmqSendBatch;
+	luazmq_module["sendValue"] = LuaZMQ::lua_zmqSendValue;
+	luazmq_module["recvValue"] = LuaZMQ::lua_zmqRecvValue;
 
 	luazmq_module["msgInit"] = LuaZMQ::lua_zmqMsgInit;
 	luazmq_module["msgClose"] = LuaZMQ::lua_zmqMsgClose;
+	luazmq_module["msgObject"] = LuaZMQ::lua_zmqMsgObjectNew;
+	luazmq_module["msgToString"] = LuaZMQ::lua_zmqMsgToString;
+	luazmq_module["msgObjectMethods"] = LuaZMQ::lua_zmqMsgObjectMethods;
 	luazmq_module["msgCopy"] = LuaZMQ::lua_zmqMsgCopy;
 	luazmq_module["msgMove"] = LuaZMQ::lua_zmqMsgMove;
 	luazmq_module["msgGetData"] = LuaZMQ::lua_zmqMsgGetData;
@@ -2052,6 +3605,12 @@ extern "C" LIBLUAZMQ_DLL_EXPORTED int luaopen_luazmq(lua_State * L){
 	luazmq_module["msgSize"] = LuaZMQ::lua_zmqMsgSize;
 	luazmq_module["msgSend"] = LuaZMQ::lua_zmqMsgSend;
 	luazmq_module["msgRecv"] = LuaZMQ::lua_zmqMsgRecv;
+	luazmq_module["msgSub"] = LuaZMQ::lua_zmqMsgSub;
+	luazmq_module["msgByte"] = LuaZMQ::lua_zmqMsgByte;
+	luazmq_module["msgFind"] = LuaZMQ::lua_zmqMsgFind;
+	luazmq_module["recvFrame"] = LuaZMQ::lua_zmqRecvFrame;
+	luazmq_module["recvView"] = LuaZMQ::lua_zmqRecvView;
+	luazmq_module["recvMsg"] = LuaZMQ::lua_zmqRecvMsg;
 
 	luazmq_module["pollNew"] = LuaZMQ::lua_zmqPollNew;
 	luazmq_module["pollFree"] = LuaZMQ::lua_zmqPollFree;
@@ -2059,6 +3618,10 @@ extern "C" LIBLUAZMQ_DLL_EXPORTED int luaopen_luazmq(lua_State * L){
 	luazmq_module["pollGet"] = LuaZMQ::lua_zmqPollGet;
 	luazmq_module["pollSet"] = LuaZMQ::lua_zmqPollSet;
 	luazmq_module["poll"] = LuaZMQ::lua_zmqPoll;
+	luazmq_module["pollDispatch"] = LuaZMQ::lua_zmqPollDispatch;
+	luazmq_module["pollAdd"] = LuaZMQ::lua_zmqPollAdd;
+	luazmq_module["pollModify"] = LuaZMQ::lua_zmqPollModify;
+	luazmq_module["pollRemove"] = LuaZMQ::lua_zmqPollRemove;
 
 	luazmq_module["atomicCounterNew"] = LuaZMQ::lua_zmqAtomicCounterNew;
 	luazmq_module["atomicCounterDestroy"] = LuaZMQ::lua_zmqAtomicCounterDestroy;
@@ -2069,8 +3632,39 @@ extern "C" LIBLUAZMQ_DLL_EXPORTED int luaopen_luazmq(lua_State * L){
 
 	luazmq_module["proxy"] = LuaZMQ::lua_zmqProxy;
 	luazmq_module["proxySteerable"] = LuaZMQ::lua_zmqProxySteerable;
+	luazmq_module["proxyRun"] = LuaZMQ::lua_zmqProxyRun;
+	luazmq_module["proxyStatsNew"] = LuaZMQ::lua_zmqProxyStatsNew;
+	luazmq_module["proxyStatsFree"] = LuaZMQ::lua_zmqProxyStatsFree;
+	luazmq_module["proxyStatsGet"] = LuaZMQ::lua_zmqProxyStatsGet;
+	luazmq_module["proxyStart"] = LuaZMQ::lua_zmqProxyStart;
+	luazmq_module["proxyCommand"] = LuaZMQ::lua_zmqProxyCommand;
+	luazmq_module["proxySetRules"] = LuaZMQ::lua_zmqProxySetRules;
+	luazmq_module["proxyRulesEncode"] = LuaZMQ::lua_zmqProxyRulesEncode;
+	luazmq_module["proxyStatistics"] = LuaZMQ::lua_zmqProxyStatistics;
+	luazmq_module["proxyJoin"] = LuaZMQ::lua_zmqProxyJoin;
+	luazmq_module["proxyFree"] = LuaZMQ::lua_zmqProxyFree;
 
 	luazmq_module["socketMonitor"] = LuaZMQ::lua_zmqSocketMonitor;
+	luazmq_module["statsEnable"] = LuaZMQ::lua_zmqStatsEnable;
+	luazmq_module["stats"] = LuaZMQ::lua_zmqStats;
+	luazmq_module["statsReset"] = LuaZMQ::lua_zmqStatsReset;
+	luazmq_module["socketStats"] = LuaZMQ::lua_zmqSocketStatsLua;
+	luazmq_module["socketRecordLatency"] = LuaZMQ::lua_zmqSocketRecordLatency;
+	luazmq_module["histogramNew"] = LuaZMQ::lua_zmqHistogramNew;
+	luazmq_module["histogramFree"] = LuaZMQ::lua_zmqHistogramFree;
+	luazmq_module["histogramRecord"] = LuaZMQ::lua_zmqHistogramRecordLua;
+	luazmq_module["histogramMerge"] = LuaZMQ::lua_zmqHistogramMerge;
+	luazmq_module["histogramPercentile"] = LuaZMQ::lua_zmqHistogramPercentileLua;
+	luazmq_module["histogramSummary"] = LuaZMQ::lua_zmqHistogramSummary;
+	luazmq_module["histogramReset"] = LuaZMQ::lua_zmqHistogramReset;
+	luazmq_module["now"] = LuaZMQ::lua_zmqNow;
+	luazmq_module["monitorNew"] = LuaZMQ::lua_zmqMonitorNew;
+	luazmq_module["monitorProcess"] = LuaZMQ::lua_zmqMonitorProcess;
+	luazmq_module["monitorCounters"] = LuaZMQ::lua_zmqMonitorCounters;
+	luazmq_module["monitorReset"] = LuaZMQ::lua_zmqMonitorReset;
+	luazmq_module["monitorFD"] = LuaZMQ::lua_zmqMonitorFD;
+	luazmq_module["monitorStop"] = LuaZMQ::lua_zmqMonitorStop;
+	luazmq_module["monitorFree"] = LuaZMQ::lua_zmqMonitorFree;
 
 	luazmq_module["sleep"] = LuaZMQ::lua_zmqSleep;
 	luazmq_module["stopwatchStart"] = LuaZMQ::lua_zmqStopwatchStart;
@@ -2083,11 +3677,44 @@ extern "C" LIBLUAZMQ_DLL_EXPORTED int luaopen_luazmq(lua_State * L){
 
 	luazmq_module["thread2"] = LuaZMQ::lua_zmqThread2;
 	luazmq_module["freeThread2"] = LuaZMQ::lua_zmqFreeThread2;
+	luazmq_module["setPreload"] = LuaZMQ::lua_zmqSetPreload;
+	luazmq_module["loadCached"] = LuaZMQ::lua_zmqLoadCached;
+
+	luazmq_module["poolNew"] = LuaZMQ::lua_zmqPoolNew;
+	luazmq_module["poolSubmit"] = LuaZMQ::lua_zmqPoolSubmit;
+	luazmq_module["poolWait"] = LuaZMQ::lua_zmqPoolWait;
+	luazmq_module["poolResize"] = LuaZMQ::lua_zmqPoolResize;
+	luazmq_module["poolStats"] = LuaZMQ::lua_zmqPoolStats;
+	luazmq_module["poolFree"] = LuaZMQ::lua_zmqPoolFree;
+	luazmq_module["poolFutureID"] = LuaZMQ::lua_zmqPoolFutureID;
+	luazmq_module["poolFutureReady"] = LuaZMQ::lua_zmqPoolFutureReady;
+	luazmq_module["poolFutureNotify"] = LuaZMQ::lua_zmqPoolFutureNotify;
+	luazmq_module["poolFutureGet"] = LuaZMQ::lua_zmqPoolFutureGet;
+	luazmq_module["poolFutureFree"] = LuaZMQ::lua_zmqPoolFutureFree;
+
+	luazmq_module["channelNew"] = LuaZMQ::lua_zmqChannelNew;
+	luazmq_module["channelFree"] = LuaZMQ::lua_zmqChannelFree;
+	luazmq_module["channelPush"] = LuaZMQ::lua_zmqChannelPush;
+	luazmq_module["channelPop"] = LuaZMQ::lua_zmqChannelPop;
+	luazmq_module["channelSize"] = LuaZMQ::lua_zmqChannelSize;
+
+	luazmq_module["queueNew"] = LuaZMQ::lua_zmqQueueNew;
+	luazmq_module["queueFree"] = LuaZMQ::lua_zmqQueueFree;
+	luazmq_module["queuePush"] = LuaZMQ::lua_zmqQueuePush;
+	luazmq_module["queuePop"] = LuaZMQ::lua_zmqQueuePop;
+	luazmq_module["queuePopBatch"] = LuaZMQ::lua_zmqQueuePopBatch;
+	luazmq_module["queueSize"] = LuaZMQ::lua_zmqQueueSize;
+	luazmq_module["queueFD"] = LuaZMQ::lua_zmqQueueFD;
 
 	luazmq_module["Z85Encode"] = LuaZMQ::lua_zmqZ85Encode;
 	luazmq_module["Z85Decode"] = LuaZMQ::lua_zmqZ85Decode;
 	luazmq_module["curveKeypair"] = LuaZMQ::lua_zmqCurveKeypair;
 
 	state->registerLib(luazmq_module);
+}
+
+extern "C" LIBLUAZMQ_DLL_EXPORTED int luaopen_luazmq(lua_State * L){
+	State * state = new State(L);
+	LuaZMQ::lua_zmqPushModule(state);
 	return 1;
 }
\ No newline at end of file
@@ -1,5 +1,11 @@
 namespace LuaZMQ {
 	extern "C" LIBLUAZMQ_DLL_EXPORTED int luaopen_luazmq(lua_State *);
+	void lua_zmqPushModule(State *);
+
+	//thread state templates (preload.cpp)
+	void lua_zmqWarmState(State &);
+	const std::string lua_zmqCompileCached(State &, const std::string &);
+	void lua_zmqLoadCachedChunk(State &, const char *, size_t);
 	
 	int lua_zmqVersion(State &);
 	int lua_zmqInit(State &);
@@ -16,6 +22,16 @@ namespace LuaZMQ {
 	int lua_zmqGetSockOptI64(State &);
 	int lua_zmqGetSockOptIptr(State &);
 	int lua_zmqGetSockOptS(State &);
+	int lua_zmqSocketOptionID(State &);
+	int lua_zmqSocketGetOption(State &);
+	int lua_zmqSocketSetOption(State &);
+	int lua_zmqSocketRcvMore(State &);
+	int lua_zmqSocketEvents(State &);
+	int lua_zmqSocketFD(State &);
+	void lua_zmqRegisterSocketObject(State *);
+	int lua_zmqSocketObjectNew(State &);
+	int lua_zmqSocketObjectMethods(State &);
+	int lua_zmqSocketMonitor(State &);
 
 	int lua_zmqBind(State &);
 	int lua_zmqUnbind(State &);
@@ -32,8 +48,19 @@ namespace LuaZMQ {
 	int lua_zmqRecvAll(State &);
 	int lua_zmqRecvMultipart(State &);
 	int lua_zmqSendMultipart(State &);
+	int lua_zmqRecvFrames(State &);
+	int lua_zmqSendFramesTable(State &);
+	int lua_zmqRecvBatch(State &);
+	int lua_zmqSendBatch(State &);
+	int lua_zmqSendValue(State &);
+	int lua_zmqRecvValue(State &);
 
 	int lua_zmqMsgInit(State &);
+	int lua_zmqMsgObjectNew(State &);
+	int lua_zmqMsgToString(State &);
+	int lua_zmqMsgObjectMethods(State &);
+	void lua_zmqRegisterMsgObject(State *);
+	zmq_msg_t * lua_zmqPushMsgObject(State &);
 	int lua_zmqMsgClose(State &);
 	int lua_zmqMsgCopy(State &);
 	int lua_zmqMsgMove(State &);
@@ -50,6 +77,12 @@ namespace LuaZMQ {
 	int lua_zmqMsgSetRoutingID(State & state);
 	int lua_zmqMsgGetGroup(State & state);
 	int lua_zmqMsgSetGroup(State & state);
+	int lua_zmqMsgSub(State &);
+	int lua_zmqMsgByte(State &);
+	int lua_zmqMsgFind(State &);
+	int lua_zmqRecvFrame(State &);
+	int lua_zmqRecvView(State &);
+	int lua_zmqRecvMsg(State &);
 
 	int lua_zmqPollNew(State &);
 	int lua_zmqPollFree(State &);
@@ -57,6 +90,10 @@ namespace LuaZMQ {
 	int lua_zmqPollGet(State &);
 	int lua_zmqPollSet(State &);
 	int lua_zmqPoll(State &);
+	int lua_zmqPollDispatch(State &);
+	int lua_zmqPollAdd(State &);
+	int lua_zmqPollModify(State &);
+	int lua_zmqPollRemove(State &);
 
 	int lua_zmqAtomicCounterNew(State &);
 	int lua_zmqAtomicCounterDestroy(State &);
@@ -67,6 +104,17 @@ namespace LuaZMQ {
 
 	int lua_zmqProxy(State &);
 	int lua_zmqProxySteerable(State &);
+	int lua_zmqProxyRun(State &);
+	int lua_zmqProxyStatsNew(State &);
+	int lua_zmqProxyStatsFree(State &);
+	int lua_zmqProxyStatsGet(State &);
+	int lua_zmqProxyStart(State &);
+	int lua_zmqProxyCommand(State &);
+	int lua_zmqProxySetRules(State &);
+	int lua_zmqProxyRulesEncode(State &);
+	int lua_zmqProxyStatistics(State &);
+	int lua_zmqProxyJoin(State &);
+	int lua_zmqProxyFree(State &);
 
 	int lua_zmqSleep(State &);
 	int lua_zmqStopwatchStart(State &);
@@ -76,6 +124,60 @@ namespace LuaZMQ {
 	int lua_zmqJoinThread(State &);
 	int lua_zmqFreeThread(State &);
 	int lua_zmqGetThreadResult(State &);
+	int lua_zmqSetPreload(State &);
+	int lua_zmqLoadCached(State &);
+
+	int lua_zmqPoolNew(State &);
+	int lua_zmqPoolSubmit(State &);
+	int lua_zmqPoolWait(State &);
+	int lua_zmqPoolResize(State &);
+	int lua_zmqPoolStats(State &);
+	int lua_zmqPoolFree(State &);
+	int lua_zmqPoolFutureID(State &);
+	int lua_zmqPoolFutureReady(State &);
+	int lua_zmqPoolFutureNotify(State &);
+	int lua_zmqPoolFutureGet(State &);
+	int lua_zmqPoolFutureFree(State &);
+
+	int lua_zmqChannelNew(State &);
+	int lua_zmqChannelFree(State &);
+	int lua_zmqChannelPush(State &);
+	int lua_zmqChannelPop(State &);
+	int lua_zmqChannelSize(State &);
+
+	int lua_zmqQueueNew(State &);
+	int lua_zmqQueueFree(State &);
+	int lua_zmqQueuePush(State &);
+	int lua_zmqQueuePop(State &);
+	int lua_zmqQueuePopBatch(State &);
+	int lua_zmqQueueSize(State &);
+	int lua_zmqQueueFD(State &);
+
+	int lua_zmqStatsEnable(State &);
+	int lua_zmqStats(State &);
+	int lua_zmqStatsReset(State &);
+	int lua_zmqSocketStatsLua(State &);
+
+	int lua_zmqSocketRecordLatency(State &);
+
+	int lua_zmqHistogramNew(State &);
+	int lua_zmqHistogramFree(State &);
+	int lua_zmqHistogramRecordLua(State &);
+	int lua_zmqHistogramMerge(State &);
+	int lua_zmqHistogramPercentileLua(State &);
+	int lua_zmqHistogramSummary(State &);
+	int lua_zmqHistogramReset(State &);
+	int lua_zmqNow(State &);
+
+	int lua_zmqMonitorNew(State &);
+	int lua_zmqMonitorProcess(State &);
+	int lua_zmqMonitorCounters(State &);
+	int lua_zmqMonitorReset(State &);
+	int lua_zmqMonitorFD(State &);
+	int lua_zmqMonitorStop(State &);
+	int lua_zmqMonitorFree(State &);
+	//stops monitors of a socket that is being closed (monitor.cpp)
+	void lua_zmqMonitorForget(void *);
 
 	int lua_zmqZ85Encode(State &);
 	int lua_zmqZ85Decode(State &);
@@ -0,0 +1,391 @@
+/*
+	LuaZMQ - Lua binding for ZeroMQ library
+
+	Copyright 2013, 2014, 2015 Mário Kašuba
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are
+	met:
+
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+	"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+	A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+	OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+	SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+	LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "common.h"
+#include <string>
+#include <sstream>
+#include <unordered_map>
+#include <mutex>
+#include <stdint.h>
+#include <string.h>
+#include "main.h"
+
+namespace LuaZMQ {
+	/*
+		Socket monitor with event decoding in C++.
+		Events from zmq_socket_monitor are read from an internal PAIR socket. They are counted
+		per endpoint and can be passed to a Lua callback as numbers without any decoding in Lua.
+		Monitor object belongs to the Lua state which created it.
+	*/
+	const int monitorEventCount = 16;
+
+	//counter names indexed by event bit (ZMQ_EVENT_CONNECTED = bit 0)
+	const char * monitorEventNames[monitorEventCount] = {
+		"connected",
+		"connectDelayed",
+		"connectRetried",
+		"listening",
+		"bindFailed",
+		"accepted",
+		"acceptFailed",
+		"closed",
+		"closeFailed",
+		"disconnected",
+		"monitorStopped",
+		"handshakeFailed",
+		"handshakeSucceeded",
+		"handshakeFailedProtocol",
+		"handshakeFailedAuth",
+		"other",
+	};
+
+	struct monitorCounters_t {
+		uint64_t events[monitorEventCount];
+		//last and maximal reconnect interval in milliseconds (value of ZMQ_EVENT_CONNECT_RETRIED)
+		uint32_t retryDelay;
+		uint32_t maxRetryDelay;
+	};
+
+	struct socketMonitor_t {
+		//receiving side of the monitor
+		void * socket;
+		//monitored socket
+		void * monitored;
+		monitorCounters_t total;
+		std::unordered_map<std::string, monitorCounters_t> endpoints;
+	};
+
+	/*
+		Monitor of each socket, libzmq supports only one monitor per socket. Closing a socket stops
+		its monitor, so a monitor never keeps a pointer to a closed socket. Sockets may be closed in any thread.
+	*/
+	static std::mutex monitorsMutex;
+	static std::unordered_map<void *, socketMonitor_t *> monitors;
+
+	//stops monitoring and unregisters the monitor, monitorsMutex must be locked
+	static void lua_zmqMonitorDetach(socketMonitor_t * monitor){
+		if (monitor->monitored){
+			auto it = monitors.find(monitor->monitored);
+			if ((it != monitors.end()) && (it->second == monitor)){
+				monitors.erase(it);
+			}
+			zmq_socket_monitor(monitor->monitored, nullptr, 0);
+			monitor->monitored = nullptr;
+		}
+	}
+
+	void lua_zmqMonitorForget(void * socket){
+		std::lock_guard<std::mutex> lock(monitorsMutex);
+		auto it = monitors.find(socket);
+		if (it != monitors.end()){
+			zmq_socket_monitor(socket, nullptr, 0);
+			it->second->monitored = nullptr;
+			monitors.erase(it);
+		}
+	}
+
+	static void lua_zmqMonitorResetCounters(monitorCounters_t & counters){
+		memset(&counters, 0, sizeof(counters));
+	}
+
+	static int lua_zmqMonitorEventIndex(uint16_t event){
+		for (int index = 0; index < monitorEventCount - 1; index++){
+			if (event == (1 << index)){
+				return index;
+			}
+		}
+		return monitorEventCount - 1;
+	}
+
+	static void lua_zmqMonitorCount(monitorCounters_t & counters, int index, uint16_t event, uint32_t value){
+		counters.events[index]++;
+		if (event == ZMQ_EVENT_CONNECT_RETRIED){
+			counters.retryDelay = value;
+			if (value > counters.maxRetryDelay){
+				counters.maxRetryDelay = value;
+			}
+		}
+	}
+
+	/*
+		Receives one event: the first frame holds 16-bit event id and 32-bit value,
+		the second frame holds the endpoint. Returns false if there's no event.
+	*/
+	static bool lua_zmqMonitorReceive(socketMonitor_t * monitor, int flags, uint16_t & event, uint32_t & value, std::string & endpoint){
+		zmq_msg_t msg;
+		zmq_msg_init(&msg);
+		if (zmq_msg_recv(&msg, monitor->socket, flags) < 0){
+			zmq_msg_close(&msg);
+			return false;
+		}
+		bool valid = (zmq_msg_size(&msg) >= sizeof(event) + sizeof(value)) && (zmq_msg_more(&msg) == 1);
+		if (valid){
+			const char * data = static_cast<const char *>(zmq_msg_data(&msg));
+			memcpy(&event, data, sizeof(event));
+			memcpy(&value, data + sizeof(event), sizeof(value));
+		}
+		bool more = (zmq_msg_more(&msg) == 1);
+		endpoint.clear();
+		while (more && (zmq_msg_recv(&msg, monitor->socket, 0) >= 0)){
+			more = (zmq_msg_more(&msg) == 1);
+			if (endpoint.empty()){
+				endpoint.assign(static_cast<const char *>(zmq_msg_data(&msg)), zmq_msg_size(&msg));
+			}
+		}
+		zmq_msg_close(&msg);
+		return valid;
+	}
+
+	static void lua_zmqMonitorPushCounters(lutok2::State & state, const monitorCounters_t & counters){
+		Stack * stack = state.stack;
+		stack->newTable();
+		for (int index = 0; index < monitorEventCount; index++){
+			stack->setField<LUA_NUMBER>(monitorEventNames[index], static_cast<LUA_NUMBER>(counters.events[index]));
+		}
+		stack->setField<LUA_NUMBER>("retryDelay", static_cast<LUA_NUMBER>(counters.retryDelay));
+		stack->setField<LUA_NUMBER>("maxRetryDelay", static_cast<LUA_NUMBER>(counters.maxRetryDelay));
+	}
+
+	/*
+		Creates a monitor: monitorNew(context, socket, events)
+		Events is a mask of ZMQ_EVENT_* values, all events are monitored by default.
+		Returns false and error message if the socket already has a monitor.
+	*/
+	int lua_zmqMonitorNew(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TUSERDATA>(2)){
+			void * context = getZMQobject(1);
+			int events = ZMQ_EVENT_ALL;
+			if (stack->is<LUA_TNUMBER>(3)){
+				events = stack->to<int>(3);
+			}
+
+			void * monitored = getZMQobject(2);
+			//the lock is held until the monitor is registered, so two monitors can't race for one socket
+			std::lock_guard<std::mutex> lock(monitorsMutex);
+			if (monitors.count(monitored) > 0){
+				stack->push<bool>(false);
+				stack->push<const std::string &>("socket is already monitored");
+				return 2;
+			}
+
+			socketMonitor_t * monitor = new socketMonitor_t;
+			monitor->monitored = monitored;
+			lua_zmqMonitorResetCounters(monitor->total);
+
+			std::stringstream endpoint;
+			endpoint << "inproc://luazmq_monitor_" << static_cast<void*>(monitor);
+
+			int linger = 0;
+			if (zmq_socket_monitor(monitor->monitored, endpoint.str().c_str(), events) != 0){
+				delete monitor;
+				stack->push<bool>(false);
+				lua_pushZMQ_error(state);
+				return 2;
+			}
+			monitor->socket = zmq_socket(context, ZMQ_PAIR);
+			if (!monitor->socket || (zmq_connect(monitor->socket, endpoint.str().c_str()) != 0)){
+				int error = zmq_errno();
+				if (monitor->socket){
+					zmq_close(monitor->socket);
+				}
+				zmq_socket_monitor(monitor->monitored, nullptr, 0);
+				delete monitor;
+				stack->push<bool>(false);
+				stack->push<const std::string &>(zmq_strerror(error));
+				return 2;
+			}
+			zmq_setsockopt(monitor->socket, ZMQ_LINGER, &linger, sizeof(linger));
+			monitors.emplace(monitor->monitored, monitor);
+
+			pushUData(monitor);
+			return 1;
+		}
+		return 0;
+	}
+
+	/*
+		Processes pending events: monitorProcess(monitor, timeout, callback)
+		Waits up to timeout milliseconds for the first event (0 by default, -1 waits forever).
+		Callback is called as callback(event, value, endpoint) for each event.
+		Returns the number of processed events or false and error message.
+	*/
+	int lua_zmqMonitorProcess(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			socketMonitor_t * monitor = static_cast<socketMonitor_t *>(getZMQobject(1));
+			long timeout = 0;
+			if (stack->is<LUA_TNUMBER>(2)){
+				timeout = static_cast<long>(stack->to<LUA_NUMBER>(2));
+			}
+			bool callback = stack->is<LUA_TFUNCTION>(3);
+
+			if (timeout != 0){
+				zmq_pollitem_t item = {monitor->socket, 0, ZMQ_POLLIN, 0};
+				if (zmq_poll(&item, 1, timeout) < 0){
+					stack->push<bool>(false);
+					lua_pushZMQ_error(state);
+					return 2;
+				}
+			}
+
+			uint16_t event = 0;
+			uint32_t value = 0;
+			std::string endpoint;
+			int processed = 0;
+
+			while (lua_zmqMonitorReceive(monitor, ZMQ_DONTWAIT, event, value, endpoint)){
+				int index = lua_zmqMonitorEventIndex(event);
+				lua_zmqMonitorCount(monitor->total, index, event, value);
+				auto it = monitor->endpoints.find(endpoint);
+				if (it == monitor->endpoints.end()){
+					it = monitor->endpoints.emplace(endpoint, monitorCounters_t()).first;
+					lua_zmqMonitorResetCounters(it->second);
+				}
+				lua_zmqMonitorCount(it->second, index, event, value);
+				processed++;
+
+				if (callback){
+					stack->pushValue(3);
+					stack->push<int>(event);
+					stack->push<LUA_NUMBER>(static_cast<LUA_NUMBER>(value));
+					stack->pushLString(endpoint.data(), endpoint.length());
+					if (stack->pcall(3, 0, 0) != 0){
+						stack->push<bool>(false);
+						stack->pushValue(-2);
+						return 2;
+					}
+				}
+			}
+
+			stack->push<int>(processed);
+			return 1;
+		}
+		return 0;
+	}
+
+	/*
+		Returns counters: {total = {...}, endpoints = {[endpoint] = {...}}}
+		or counters of one endpoint if it's specified.
+	*/
+	int lua_zmqMonitorCounters(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			socketMonitor_t * monitor = static_cast<socketMonitor_t *>(getZMQobject(1));
+			if (stack->is<LUA_TSTRING>(2)){
+				auto it = monitor->endpoints.find(stack->toLString(2));
+				if (it == monitor->endpoints.end()){
+					return 0;
+				}
+				lua_zmqMonitorPushCounters(state, it->second);
+				return 1;
+			}
+
+			stack->newTable();
+			stack->push<const std::string &>("total");
+			lua_zmqMonitorPushCounters(state, monitor->total);
+			stack->setTable();
+			stack->push<const std::string &>("endpoints");
+			stack->newTable();
+			for (const auto & entry : monitor->endpoints){
+				stack->pushLString(entry.first.data(), entry.first.length());
+				lua_zmqMonitorPushCounters(state, entry.second);
+				stack->setTable();
+			}
+			stack->setTable();
+			return 1;
+		}
+		return 0;
+	}
+
+	int lua_zmqMonitorReset(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			socketMonitor_t * monitor = static_cast<socketMonitor_t *>(getZMQobject(1));
+			lua_zmqMonitorResetCounters(monitor->total);
+			monitor->endpoints.clear();
+		}
+		return 0;
+	}
+
+	//file descriptor of the monitor socket (ZMQ_FD) for external event loops
+	int lua_zmqMonitorFD(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			socketMonitor_t * monitor = static_cast<socketMonitor_t *>(getZMQobject(1));
+#if defined(_WIN32)
+			SOCKET fd;
+#else
+			int fd;
+#endif
+			size_t size = sizeof(fd);
+			if (zmq_getsockopt(monitor->socket, ZMQ_FD, &fd, &size) != 0){
+				stack->push<bool>(false);
+				lua_pushZMQ_error(state);
+				return 2;
+			}
+			stack->push<LUA_NUMBER>(static_cast<LUA_NUMBER>(fd));
+			return 1;
+		}
+		return 0;
+	}
+
+	/*
+		Stops monitoring, it does nothing if the monitored socket has been closed already.
+		Remaining events can be still processed.
+	*/
+	int lua_zmqMonitorStop(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			socketMonitor_t * monitor = static_cast<socketMonitor_t *>(getZMQobject(1));
+			if (monitor){
+				std::lock_guard<std::mutex> lock(monitorsMutex);
+				lua_zmqMonitorDetach(monitor);
+			}
+		}
+		return 0;
+	}
+
+	int lua_zmqMonitorFree(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			socketMonitor_t * monitor = static_cast<socketMonitor_t *>(getZMQobject(1));
+			if (monitor){
+				{
+					std::lock_guard<std::mutex> lock(monitorsMutex);
+					lua_zmqMonitorDetach(monitor);
+				}
+				zmq_close(monitor->socket);
+				*(static_cast<void**>(stack->to<void*>(1))) = nullptr;
+				delete monitor;
+			}
+		}
+		return 0;
+	}
+};
@@ -0,0 +1,685 @@
+/*
+	LuaZMQ - Lua binding for ZeroMQ library
+
+	Copyright 2013, 2014, 2015 Mário Kašuba
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are
+	met:
+
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+	"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+	A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+	OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+	SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+	LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "common.h"
+#include <thread>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include "main.h"
+#include "serializer.h"
+
+namespace LuaZMQ {
+	/*
+		Thread pool with persistent Lua states and work stealing.
+		Every worker runs an optional init function once and then executes
+		jobs (code and arguments) from its own deque. Idle workers steal jobs
+		from the back of other workers' deques.
+	*/
+	/*
+		Result of a submitted job. It's shared by the job and the Lua future object,
+		whichever releases it last deletes it.
+	*/
+	struct poolFuture_t {
+		std::atomic<int> references;
+		size_t id;
+		std::mutex m;
+		std::condition_variable cv;
+		bool done;
+		bool failed;
+		//set by onDone, only such futures are announced on the notification endpoint
+		std::atomic<bool> notify;
+		//return values encoded with lua_zmqEncodeValues, shared objects in them are released with the future
+		std::string results;
+		std::string error;
+	};
+
+	struct poolJob_t {
+		std::string code;
+		//arguments encoded with lua_zmqEncodeValues, released once decoded by a worker or when the job is cancelled
+		std::string arguments;
+		poolFuture_t * future;
+
+		poolJob_t() : future(nullptr) {}
+	};
+
+	struct poolWorker_t {
+		std::thread thread;
+		size_t id;
+		bool finished;
+		std::mutex m;
+		std::deque<poolJob_t> jobs;
+	};
+
+	struct threadPool_t {
+		void * context;
+		std::string initCode;
+		//workers push IDs of finished jobs to this endpoint if it's set
+		std::string endpoint;
+
+		size_t minWorkers;
+		size_t maxWorkers;
+		//idle time in milliseconds after which workers above minWorkers quit, 0 - never
+		int idleTimeout;
+
+		//lock order: pool mutex first, then worker mutex
+		std::mutex m;
+		std::condition_variable jobCv;
+		std::condition_variable doneCv;
+		std::vector<std::unique_ptr<poolWorker_t>> workers;
+		std::atomic<size_t> pendingJobs;
+		std::atomic<size_t> runningJobs;
+		size_t activeWorkers;
+		size_t idleWorkers;
+		size_t nextWorkerId;
+		size_t nextWorker;
+		size_t nextFutureId;
+		bool stopping;
+	};
+
+	static void lua_zmqPoolReleaseFuture(poolFuture_t * future){
+		if (future && (--future->references == 0)){
+			lua_zmqReleaseValues(future->results.c_str(), future->results.length());
+			delete future;
+		}
+	}
+
+	static void lua_zmqPoolCompleteFuture(poolFuture_t * future, bool failed, const std::string & error){
+		if (future){
+			{
+				std::lock_guard<std::mutex> lk(future->m);
+				future->done = true;
+				future->failed = failed;
+				future->error = error;
+			}
+			future->cv.notify_all();
+		}
+	}
+
+	/*
+		Runs a job and stores its return values into the future.
+		Errors are reported on standard error output as in freeThread2 if there's no future.
+	*/
+	static void lua_zmqPoolRunJob(lutok2::State & state, void * context, poolJob_t & job){
+		Stack * stack = state.stack;
+		int base = stack->getTop();
+		bool failed = false;
+		std::string error;
+
+		try{
+			lua_zmqLoadCachedChunk(state, job.code.c_str(), job.code.length());
+			pushUData(context);
+			int argumentsCount = lua_zmqDecodeValues(state, job.arguments.c_str(), job.arguments.length());
+			lua_zmqReleaseValues(job.arguments.c_str(), job.arguments.length());
+			job.arguments.clear();
+			if (argumentsCount < 0){
+				failed = true;
+				error = "Malformed job arguments";
+			}else if (stack->pcall(argumentsCount + 1, LUA_MULTRET, 0) != 0){
+				failed = true;
+				error = stack->to<const std::string>(-1);
+			}else if (job.future){
+				if (!lua_zmqEncodeValuesToString(state, base + 1, stack->getTop() - base, job.future->results, error)){
+					failed = true;
+				}
+			}
+		}catch (std::exception & e){
+			failed = true;
+			error = e.what();
+		}
+		stack->pop(stack->getTop() - base);
+
+		if (failed && !job.future){
+			std::cerr << "Pool job error: " << error << "\n";
+		}
+		lua_zmqPoolCompleteFuture(job.future, failed, error);
+	}
+
+	//must be called with pool mutex locked
+	static bool lua_zmqPoolSteal(threadPool_t * pool, poolWorker_t * thief, poolJob_t & job){
+		size_t count = pool->workers.size();
+		size_t start = 0;
+		for (size_t index = 0; index < count; index++){
+			if (pool->workers[index].get() == thief){
+				start = index + 1;
+				break;
+			}
+		}
+		for (size_t offset = 0; offset < count; offset++){
+			poolWorker_t * victim = pool->workers[(start + offset) % count].get();
+			if (victim != thief){
+				std::lock_guard<std::mutex> vlk(victim->m);
+				if (!victim->jobs.empty()){
+					job = std::move(victim->jobs.back());
+					victim->jobs.pop_back();
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	static void lua_zmqPoolWorker(threadPool_t * pool, poolWorker_t * worker){
+		lutok2::State state = lutok2::State();
+		Stack * stack = state.stack;
+		void * notify = nullptr;
+
+		if (!pool->endpoint.empty()){
+			int linger = 0;
+			//unlimited, IDs of futures with a callback must never be dropped
+			int hwm = 0;
+			notify = zmq_socket(pool->context, ZMQ_PUSH);
+			if (notify){
+				zmq_setsockopt(notify, ZMQ_LINGER, &linger, sizeof(linger));
+				zmq_setsockopt(notify, ZMQ_SNDHWM, &hwm, sizeof(hwm));
+				zmq_connect(notify, pool->endpoint.c_str());
+			}
+		}
+
+		try{
+			state.openLibs();
+			lua_zmqWarmState(state);
+			if (!pool->initCode.empty()){
+				state.loadString(pool->initCode);
+				pushUData(pool->context);
+				stack->push<int>(static_cast<int>(worker->id));
+				if (stack->pcall(2, 0, 0) != 0){
+					std::cerr << "Pool init error: " << stack->to<const std::string>(-1) << "\n";
+					stack->pop(1);
+				}
+			}
+		}catch (std::exception & e){
+			std::cerr << "Pool init exception: " << e.what() << "\n";
+		}
+
+		while (true){
+			poolJob_t job;
+			bool haveJob = false;
+
+			{
+				std::lock_guard<std::mutex> wlk(worker->m);
+				if (!worker->jobs.empty()){
+					job = std::move(worker->jobs.front());
+					worker->jobs.pop_front();
+					haveJob = true;
+				}
+			}
+
+			if (!haveJob){
+				std::unique_lock<std::mutex> lk(pool->m);
+				haveJob = lua_zmqPoolSteal(pool, worker, job);
+
+				if (!haveJob){
+					bool quit = false;
+
+					pool->idleWorkers++;
+					while ((pool->pendingJobs == 0) && !pool->stopping){
+						if (pool->activeWorkers > pool->maxWorkers){
+							quit = true;
+							break;
+						}
+						if ((pool->idleTimeout > 0) && (pool->activeWorkers > pool->minWorkers)){
+							if (pool->jobCv.wait_for(lk, std::chrono::milliseconds(pool->idleTimeout)) == std::cv_status::timeout){
+								if ((pool->pendingJobs == 0) && (pool->activeWorkers > pool->minWorkers)){
+									quit = true;
+									break;
+								}
+							}
+						}else{
+							pool->jobCv.wait(lk);
+						}
+					}
+					pool->idleWorkers--;
+
+					if (quit || pool->stopping){
+						pool->activeWorkers--;
+						worker->finished = true;
+						break;
+					}
+					continue;
+				}
+			}
+
+			pool->runningJobs++;
+			pool->pendingJobs--;
+
+			lua_zmqPoolRunJob(state, pool->context, job);
+
+			if (job.future){
+				if (notify && job.future->notify.load()){
+					//ID is sent as a decimal string so Lua can use tonumber on it
+					const std::string id = std::to_string(job.future->id);
+					zmq_send(notify, id.c_str(), id.length(), ZMQ_DONTWAIT);
+				}
+				lua_zmqPoolReleaseFuture(job.future);
+			}
+
+			if ((--pool->runningJobs == 0) && (pool->pendingJobs == 0)){
+				std::lock_guard<std::mutex> lk(pool->m);
+				pool->doneCv.notify_all();
+			}
+		}
+
+		if (notify){
+			zmq_close(notify);
+		}
+	}
+
+	//must be called with pool mutex locked
+	static void lua_zmqPoolSpawn(threadPool_t * pool){
+		poolWorker_t * worker = new poolWorker_t;
+		worker->id = pool->nextWorkerId++;
+		worker->finished = false;
+		pool->activeWorkers++;
+		pool->workers.push_back(std::unique_ptr<poolWorker_t>(worker));
+		worker->thread = std::thread(lua_zmqPoolWorker, pool, worker);
+	}
+
+	//must be called with pool mutex locked
+	static void lua_zmqPoolReap(threadPool_t * pool){
+		for (auto it = pool->workers.begin(); it != pool->workers.end(); ){
+			if ((*it)->finished){
+				if ((*it)->thread.joinable()){
+					(*it)->thread.join();
+				}
+				it = pool->workers.erase(it);
+			}else{
+				++it;
+			}
+		}
+	}
+
+	//must be called with pool mutex locked
+	static poolWorker_t * lua_zmqPoolNextWorker(threadPool_t * pool){
+		size_t count = pool->workers.size();
+		for (size_t offset = 0; offset < count; offset++){
+			poolWorker_t * worker = pool->workers[(pool->nextWorker++) % count].get();
+			if (!worker->finished){
+				return worker;
+			}
+		}
+		return nullptr;
+	}
+
+	int lua_zmqPoolNew(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TNUMBER>(2)){
+			threadPool_t * pool = new threadPool_t;
+			pool->context = getZMQobject(1);
+			pool->minWorkers = stack->to<int>(2);
+			pool->maxWorkers = pool->minWorkers;
+			pool->idleTimeout = 0;
+			pool->pendingJobs = 0;
+			pool->runningJobs = 0;
+			pool->activeWorkers = 0;
+			pool->idleWorkers = 0;
+			pool->nextWorkerId = 1;
+			pool->nextWorker = 0;
+			pool->nextFutureId = 1;
+			pool->stopping = false;
+
+			try{
+				if (stack->is<LUA_TFUNCTION>(3)){
+					pool->initCode = stack->dumpFunction(3);
+				}else if (stack->is<LUA_TSTRING>(3)){
+					pool->initCode = stack->toLString(3);
+				}
+			}catch (std::exception & e){
+				delete pool;
+				stack->push<bool>(false);
+				stack->push<const std::string &>(e.what());
+				return 2;
+			}
+
+			//optional auto-scaling: {max = n, idle = ms}
+			if (stack->is<LUA_TTABLE>(4)){
+				stack->getField("max", 4);
+				if (stack->is<LUA_TNUMBER>(-1)){
+					pool->maxWorkers = stack->to<int>(-1);
+				}
+				stack->pop(1);
+
+				stack->getField("idle", 4);
+				if (stack->is<LUA_TNUMBER>(-1)){
+					pool->idleTimeout = stack->to<int>(-1);
+				}
+				stack->pop(1);
+			}
+			if (pool->maxWorkers < pool->minWorkers){
+				pool->maxWorkers = pool->minWorkers;
+			}
+
+			if (stack->is<LUA_TSTRING>(5)){
+				pool->endpoint = stack->toLString(5);
+			}
+
+			{
+				std::lock_guard<std::mutex> lk(pool->m);
+				for (size_t index = 0; index < pool->minWorkers; index++){
+					lua_zmqPoolSpawn(pool);
+				}
+			}
+
+			pushUData(pool);
+			return 1;
+		}
+		return 0;
+	}
+
+	//closed pools and freed futures keep a null pointer in their userdata
+	static int lua_zmqPoolPushClosed(lutok2::State & state, const char * message){
+		Stack * stack = state.stack;
+		stack->push<bool>(false);
+		stack->push<const std::string &>(message);
+		return 2;
+	}
+
+	/*
+		Submits a job and returns a future object.
+		Jobs are distributed round-robin, idle workers steal them when the load is uneven.
+	*/
+	int lua_zmqPoolSubmit(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1) && (stack->is<LUA_TFUNCTION>(2) || stack->is<LUA_TSTRING>(2))){
+			threadPool_t * pool = static_cast<threadPool_t *>(getZMQobject(1));
+			if (!pool){
+				return lua_zmqPoolPushClosed(state, "pool is closed");
+			}
+			poolJob_t job;
+
+			try{
+				if (stack->is<LUA_TFUNCTION>(2)){
+					job.code = stack->dumpFunction(2);
+				}else{
+					job.code = lua_zmqCompileCached(state, stack->toLString(2));
+				}
+			}catch (std::exception & e){
+				stack->push<bool>(false);
+				stack->push<const std::string &>(e.what());
+				return 2;
+			}
+
+			std::string error;
+			if (!lua_zmqEncodeValuesToString(state, 3, stack->getTop() - 2, job.arguments, error)){
+				stack->push<bool>(false);
+				stack->push<const std::string &>(error);
+				return 2;
+			}
+
+			poolFuture_t * future = new poolFuture_t;
+			future->references = 2;
+			future->done = false;
+			future->failed = false;
+			future->notify = false;
+			job.future = future;
+
+			{
+				std::lock_guard<std::mutex> lk(pool->m);
+				lua_zmqPoolReap(pool);
+				future->id = pool->nextFutureId++;
+
+				//grow if there's no idle worker left for queued jobs
+				if (((pool->pendingJobs + 1) > pool->idleWorkers) && (pool->activeWorkers < pool->maxWorkers)){
+					lua_zmqPoolSpawn(pool);
+				}
+
+				poolWorker_t * worker = lua_zmqPoolNextWorker(pool);
+				if (!worker){
+					lua_zmqPoolSpawn(pool);
+					worker = pool->workers.back().get();
+				}
+				{
+					std::lock_guard<std::mutex> wlk(worker->m);
+					worker->jobs.push_back(std::move(job));
+				}
+				pool->pendingJobs++;
+			}
+			pool->jobCv.notify_one();
+
+			pushUData(future);
+			return 1;
+		}
+		return 0;
+	}
+
+	int lua_zmqPoolFutureID(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			poolFuture_t * future = static_cast<poolFuture_t *>(getZMQobject(1));
+			if (!future){
+				return lua_zmqPoolPushClosed(state, "future is freed");
+			}
+			stack->push<LUA_NUMBER>(static_cast<LUA_NUMBER>(future->id));
+			return 1;
+		}
+		return 0;
+	}
+
+	int lua_zmqPoolFutureReady(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			poolFuture_t * future = static_cast<poolFuture_t *>(getZMQobject(1));
+			if (!future){
+				return lua_zmqPoolPushClosed(state, "future is freed");
+			}
+			std::lock_guard<std::mutex> lk(future->m);
+			stack->push<bool>(future->done);
+			return 1;
+		}
+		return 0;
+	}
+
+	/*
+		Requests notification of the future ID once the job is done.
+		Returns true if the job is already done, no notification may be sent then.
+	*/
+	int lua_zmqPoolFutureNotify(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			poolFuture_t * future = static_cast<poolFuture_t *>(getZMQobject(1));
+			if (!future){
+				return lua_zmqPoolPushClosed(state, "future is freed");
+			}
+			future->notify = true;
+			std::lock_guard<std::mutex> lk(future->m);
+			stack->push<bool>(future->done);
+			return 1;
+		}
+		return 0;
+	}
+
+	/*
+		Waits for job completion (optionally with timeout in milliseconds) and returns job results.
+		Returns false and error message if the job failed or the timeout expired.
+	*/
+	int lua_zmqPoolFutureGet(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			poolFuture_t * future = static_cast<poolFuture_t *>(getZMQobject(1));
+			if (!future){
+				return lua_zmqPoolPushClosed(state, "future is freed");
+			}
+			std::unique_lock<std::mutex> lk(future->m);
+			auto done = [&]{ return future->done; };
+
+			if (stack->is<LUA_TNUMBER>(2)){
+				if (!future->cv.wait_for(lk, std::chrono::milliseconds(stack->to<int>(2)), done)){
+					stack->push<bool>(false);
+					stack->push<const std::string &>("timeout");
+					return 2;
+				}
+			}else{
+				future->cv.wait(lk, done);
+			}
+
+			if (future->failed){
+				stack->push<bool>(false);
+				stack->push<const std::string &>(future->error);
+				return 2;
+			}
+			int resultsCount = lua_zmqDecodeValues(state, future->results.c_str(), future->results.length());
+			if (resultsCount < 0){
+				stack->push<bool>(false);
+				stack->push<const std::string &>("Malformed job results");
+				return 2;
+			}
+			return resultsCount;
+		}
+		return 0;
+	}
+
+	int lua_zmqPoolFutureFree(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			poolFuture_t * future = static_cast<poolFuture_t *>(getZMQobject(1));
+			if (future){
+				lua_zmqPoolReleaseFuture(future);
+				*(static_cast<void**>(stack->to<void*>(1))) = nullptr;
+			}
+		}
+		return 0;
+	}
+
+	int lua_zmqPoolWait(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			threadPool_t * pool = static_cast<threadPool_t *>(getZMQobject(1));
+			if (!pool){
+				return lua_zmqPoolPushClosed(state, "pool is closed");
+			}
+			std::unique_lock<std::mutex> lk(pool->m);
+			auto done = [&]{ return (pool->pendingJobs == 0) && (pool->runningJobs == 0); };
+
+			if (stack->is<LUA_TNUMBER>(2)){
+				stack->push<bool>(pool->doneCv.wait_for(lk, std::chrono::milliseconds(stack->to<int>(2)), done));
+			}else{
+				pool->doneCv.wait(lk, done);
+				stack->push<bool>(true);
+			}
+			return 1;
+		}
+		return 0;
+	}
+
+	int lua_zmqPoolResize(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TNUMBER>(2)){
+			threadPool_t * pool = static_cast<threadPool_t *>(getZMQobject(1));
+			if (!pool){
+				return lua_zmqPoolPushClosed(state, "pool is closed");
+			}
+			size_t size = stack->to<int>(2);
+			{
+				std::lock_guard<std::mutex> lk(pool->m);
+				lua_zmqPoolReap(pool);
+
+				pool->minWorkers = size;
+				if (stack->is<LUA_TNUMBER>(3)){
+					pool->maxWorkers = stack->to<int>(3);
+				}else if (size < pool->activeWorkers){
+					//shrinking without explicit maximum, workers above size quit when idle
+					pool->maxWorkers = size;
+				}
+				if (pool->maxWorkers < size){
+					pool->maxWorkers = size;
+				}
+				while (pool->activeWorkers < pool->minWorkers){
+					lua_zmqPoolSpawn(pool);
+				}
+			}
+			//surplus workers quit as soon as they're idle
+			pool->jobCv.notify_all();
+			return 0;
+		}
+		return 0;
+	}
+
+	int lua_zmqPoolStats(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			threadPool_t * pool = static_cast<threadPool_t *>(getZMQobject(1));
+			if (!pool){
+				return lua_zmqPoolPushClosed(state, "pool is closed");
+			}
+			std::lock_guard<std::mutex> lk(pool->m);
+			stack->newTable();
+			stack->setField<int>("workers", static_cast<int>(pool->activeWorkers));
+			stack->setField<int>("idle", static_cast<int>(pool->idleWorkers));
+			stack->setField<int>("running", static_cast<int>(pool->runningJobs));
+			stack->setField<int>("pending", static_cast<int>(pool->pendingJobs));
+			stack->setField<int>("min", static_cast<int>(pool->minWorkers));
+			stack->setField<int>("max", static_cast<int>(pool->maxWorkers));
+			return 1;
+		}
+		return 0;
+	}
+
+	/*
+		Stops all workers and frees the pool.
+		Queued jobs that haven't been started are cancelled.
+	*/
+	int lua_zmqPoolFree(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			threadPool_t * pool = static_cast<threadPool_t *>(getZMQobject(1));
+			if (pool){
+				{
+					std::lock_guard<std::mutex> lk(pool->m);
+					pool->stopping = true;
+					for (auto & worker : pool->workers){
+						std::lock_guard<std::mutex> wlk(worker->m);
+						for (poolJob_t & job : worker->jobs){
+							lua_zmqReleaseValues(job.arguments.c_str(), job.arguments.length());
+							lua_zmqPoolCompleteFuture(job.future, true, "cancelled");
+							lua_zmqPoolReleaseFuture(job.future);
+						}
+						worker->jobs.clear();
+					}
+					pool->pendingJobs = 0;
+				}
+				pool->jobCv.notify_all();
+
+				for (auto & worker : pool->workers){
+					if (worker->thread.joinable()){
+						worker->thread.join();
+					}
+				}
+				*(static_cast<void**>(stack->to<void*>(1))) = nullptr;
+				delete pool;
+			}
+		}
+		return 0;
+	}
+};
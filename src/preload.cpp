@@ -0,0 +1,173 @@
+/*
+	LuaZMQ - Lua binding for ZeroMQ library
+
+	Copyright 2013, 2014, 2015 Mário Kašuba
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are
+	met:
+
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+	"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+	A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+	OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+	SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+	LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "common.h"
+#include <mutex>
+#include <map>
+#include <unordered_map>
+#include <string>
+#include "main.h"
+
+namespace LuaZMQ {
+	/*
+		New thread states start from a warm template: luazmq module is installed directly
+		into package.loaded and modules registered with setPreload (zmq.lua registers itself)
+		are available in package.preload as bytecode. require 'zmq' in a thread then skips
+		searching package.path and parsing the source.
+	*/
+	std::mutex preloadMutex;
+	std::map<std::string, std::string> preloadModules;
+
+	//source code of thread bodies compiled into bytecode, shared by all states
+	std::mutex compiledMutex;
+	std::unordered_map<std::string, std::string> compiledSources;
+	const size_t maxCompiledSources = 256;
+
+	const std::string warmStateCode =
+		"local luazmq, modules = ...\n"
+		"package.loaded.luazmq = luazmq\n"
+		"for name, code in pairs(modules) do\n"
+		"	if package.preload[name] == nil then\n"
+		"		package.preload[name] = function(...)\n"
+		"			return assert(loadstring(code, '=' .. name))(...)\n"
+		"		end\n"
+		"	end\n"
+		"end\n";
+
+	const std::string bytecodeSignature = LUA_SIGNATURE;
+
+	/*
+		Registers module code (a function or bytecode string) used by require in thread states.
+		The first registration of a module name wins.
+	*/
+	int lua_zmqSetPreload(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TSTRING>(1) && (stack->is<LUA_TFUNCTION>(2) || stack->is<LUA_TSTRING>(2))){
+			const std::string name = stack->toLString(1);
+			{
+				std::lock_guard<std::mutex> lk(preloadMutex);
+				if (preloadModules.find(name) != preloadModules.end()){
+					stack->push<bool>(true);
+					return 1;
+				}
+			}
+
+			std::string code;
+			try{
+				if (stack->is<LUA_TFUNCTION>(2)){
+					code = stack->dumpFunction(2);
+				}else{
+					code = lua_zmqCompileCached(state, stack->toLString(2));
+				}
+			}catch (std::exception & e){
+				stack->push<bool>(false);
+				stack->push<const std::string &>(e.what());
+				return 2;
+			}
+
+			std::lock_guard<std::mutex> lk(preloadMutex);
+			preloadModules.insert(std::make_pair(name, code));
+			stack->push<bool>(true);
+			return 1;
+		}
+		return 0;
+	}
+
+	//must be called right after openLibs
+	void lua_zmqWarmState(lutok2::State & state){
+		Stack * stack = state.stack;
+
+		state.loadString(warmStateCode);
+		lua_zmqPushModule(&state);
+		stack->newTable();
+		{
+			std::lock_guard<std::mutex> lk(preloadMutex);
+			for (const auto & module : preloadModules){
+				stack->push<const std::string &>(module.first);
+				stack->pushLString(module.second.c_str(), module.second.length());
+				stack->setTable();
+			}
+		}
+		stack->call(2, 0);
+	}
+
+	/*
+		Returns bytecode of Lua source. Compiled chunks are cached by their source code,
+		bytecode is returned unchanged. Throws on syntax errors.
+	*/
+	const std::string lua_zmqCompileCached(lutok2::State & state, const std::string & code){
+		Stack * stack = state.stack;
+		if (code.compare(0, bytecodeSignature.length(), bytecodeSignature) == 0){
+			return code;
+		}
+		{
+			std::lock_guard<std::mutex> lk(compiledMutex);
+			auto it = compiledSources.find(code);
+			if (it != compiledSources.end()){
+				return it->second;
+			}
+		}
+
+		state.loadString(code);
+		const std::string bytecode = stack->dumpFunction(stack->getTop());
+		stack->pop(1);
+
+		std::lock_guard<std::mutex> lk(compiledMutex);
+		if (compiledSources.size() >= maxCompiledSources){
+			compiledSources.clear();
+		}
+		compiledSources.insert(std::make_pair(code, bytecode));
+		return bytecode;
+	}
+
+	/*
+		Pushes function loaded from code (source or bytecode). Source is compiled once per process
+		by lua_zmqCompileCached, every call undumps a new function from the cached bytecode,
+		so callers never share a function (and its environment). Throws on syntax errors.
+	*/
+	void lua_zmqLoadCachedChunk(lutok2::State & state, const char * code, size_t length){
+		state.loadString(lua_zmqCompileCached(state, std::string(code, length)));
+	}
+
+	//loads code like loadstring does, returns nil and error message on syntax errors
+	int lua_zmqLoadCached(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TSTRING>(1)){
+			try{
+				lua_zmqLoadCachedChunk(state, stack->to<const char *>(1), stack->objLen(1));
+			}catch (std::exception & e){
+				stack->pushNil();
+				stack->push<const std::string &>(e.what());
+				return 2;
+			}
+			return 1;
+		}
+		return 0;
+	}
+};
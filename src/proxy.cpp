@@ -0,0 +1,1039 @@
+/*
+	LuaZMQ - Lua binding for ZeroMQ library
+
+	Copyright 2013, 2014, 2015 Mário Kašuba
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are
+	met:
+
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+	"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+	A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+	OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+	SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+	LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "common.h"
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <limits>
+#include <string.h>
+#include <thread>
+#include <stdint.h>
+#include <errno.h>
+#include "main.h"
+#include "shared.h"
+
+namespace LuaZMQ {
+	/*
+		Instrumented proxy. Works like zmq_proxy_steerable but it counts messages, frames and bytes
+		in both directions, send attempts which would block (EAGAIN on high water mark) and dropped
+		messages. Counters are relaxed atomics in a shared stats object which can be read from
+		any Lua state while the proxy is running.
+	*/
+	const size_t proxyLatencyBuckets = 64;
+	//maximum number of messages forwarded in one direction before polling again
+	const int proxyBurstSize = 256;
+
+	struct proxyDirection_t {
+		std::atomic<uint64_t> messages;
+		std::atomic<uint64_t> frames;
+		std::atomic<uint64_t> bytes;
+		std::atomic<uint64_t> eagain;
+		std::atomic<uint64_t> dropped;
+		//messages discarded by routing rules
+		std::atomic<uint64_t> filtered;
+		//forwarding latency in nanoseconds, bucket n holds values below 2^n
+		std::atomic<uint64_t> latency[proxyLatencyBuckets];
+	};
+
+	struct proxyStats_t {
+		std::atomic<int> references;
+		//0 - frontend to backend, 1 - backend to frontend
+		proxyDirection_t directions[2];
+		std::chrono::steady_clock::time_point started;
+
+		//previous read, used to compute messages per second
+		std::mutex m;
+		std::chrono::steady_clock::time_point lastRead;
+		uint64_t lastMessages[2];
+	};
+
+	struct proxyOptions_t {
+		//drop messages instead of blocking when the peer is at high water mark
+		bool drop;
+		//record per-message forwarding latency
+		bool latency;
+
+		proxyOptions_t() : drop(false), latency(false) {}
+	};
+
+	const char * proxyDirectionNames[2] = {"frontend", "backend"};
+
+	static proxyStats_t * lua_zmqProxyStatsCreate(){
+		proxyStats_t * stats = new proxyStats_t;
+		stats->references = 1;
+		for (int direction = 0; direction < 2; direction++){
+			proxyDirection_t & d = stats->directions[direction];
+			d.messages = 0;
+			d.frames = 0;
+			d.bytes = 0;
+			d.eagain = 0;
+			d.dropped = 0;
+			d.filtered = 0;
+			for (size_t bucket = 0; bucket < proxyLatencyBuckets; bucket++){
+				d.latency[bucket] = 0;
+			}
+			stats->lastMessages[direction] = 0;
+		}
+		stats->started = stats->lastRead = std::chrono::steady_clock::now();
+		return stats;
+	}
+
+	static void lua_zmqProxyStatsRelease(proxyStats_t * stats){
+		if (stats && (--stats->references == 0)){
+			delete stats;
+		}
+	}
+
+	static void lua_zmqProxyStatsAcquireShared(void * stats){
+		static_cast<proxyStats_t *>(stats)->references++;
+	}
+
+	static void lua_zmqProxyStatsReleaseShared(void * stats){
+		lua_zmqProxyStatsRelease(static_cast<proxyStats_t *>(stats));
+	}
+
+	//stats are read live from other threads, the userdata is a shared object (shared.h) wrapped by zmq.proxyStats(ud)
+	const sharedObjectType_t proxyStatsObjectType = {lua_zmqProxyStatsAcquireShared, lua_zmqProxyStatsReleaseShared};
+
+	static void lua_zmqProxyRecordLatency(proxyDirection_t & stats, uint64_t nanoseconds){
+		size_t bucket = 0;
+		while ((bucket < proxyLatencyBuckets - 1) && ((nanoseconds >> bucket) > 0)){
+			bucket++;
+		}
+		stats.latency[bucket].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/*
+		Routing rules of frontend messages. The first frame of a message is matched against
+		topic prefixes, the longest matching prefix wins. Rule actions:
+		route - send to backend, drop - discard, sample - send every n-th message to backend, discard the rest.
+		Messages without matching rule go to the first backend. An empty prefix sets the default rule.
+	*/
+	enum proxyRuleAction_t {
+		PROXY_RULE_ROUTE = 'r',
+		PROXY_RULE_DROP = 'd',
+		PROXY_RULE_SAMPLE = 's',
+	};
+
+	struct proxyRule_t {
+		std::string prefix;
+		char action;
+		//0-based backend index
+		uint32_t backend;
+		uint32_t every;
+		uint64_t counter;
+	};
+
+	//byte trie of rule prefixes, children are sorted by byte
+	struct proxyTrieNode_t {
+		int rule;
+		std::vector<std::pair<unsigned char, size_t>> children;
+	};
+
+	struct proxyRules_t {
+		std::vector<proxyRule_t> rules;
+		std::vector<proxyTrieNode_t> nodes;
+	};
+
+	//rule serialized in one frame: action, backend (uint32), every (uint32), prefix
+	const size_t proxyRuleHeaderSize = 1 + 2 * sizeof(uint32_t);
+
+	static void lua_zmqProxyRulesCompile(proxyRules_t & rules){
+		rules.nodes.assign(1, proxyTrieNode_t());
+		rules.nodes[0].rule = -1;
+
+		for (size_t index = 0; index < rules.rules.size(); index++){
+			const std::string & prefix = rules.rules[index].prefix;
+			size_t node = 0;
+			for (size_t position = 0; position < prefix.length(); position++){
+				unsigned char byte = static_cast<unsigned char>(prefix[position]);
+				std::vector<std::pair<unsigned char, size_t>> & children = rules.nodes[node].children;
+				auto it = std::lower_bound(children.begin(), children.end(), std::make_pair(byte, static_cast<size_t>(0)));
+				if ((it != children.end()) && (it->first == byte)){
+					node = it->second;
+				}else{
+					size_t child = rules.nodes.size();
+					children.insert(it, std::make_pair(byte, child));
+					rules.nodes.push_back(proxyTrieNode_t());
+					rules.nodes.back().rule = -1;
+					node = child;
+				}
+			}
+			//later rules with the same prefix replace earlier ones
+			rules.nodes[node].rule = static_cast<int>(index);
+		}
+	}
+
+	static proxyRule_t * lua_zmqProxyRulesMatch(proxyRules_t & rules, const char * data, size_t size){
+		size_t node = 0;
+		int match = rules.nodes[0].rule;
+
+		for (size_t position = 0; position < size; position++){
+			const std::vector<std::pair<unsigned char, size_t>> & children = rules.nodes[node].children;
+			unsigned char byte = static_cast<unsigned char>(data[position]);
+			auto it = std::lower_bound(children.begin(), children.end(), std::make_pair(byte, static_cast<size_t>(0)));
+			if ((it == children.end()) || (it->first != byte)){
+				break;
+			}
+			node = it->second;
+			if (rules.nodes[node].rule >= 0){
+				match = rules.nodes[node].rule;
+			}
+		}
+		return (match >= 0) ? &rules.rules[match] : nullptr;
+	}
+
+	/*
+		Returns backend index for a message or -1 if the message should be discarded.
+	*/
+	static int lua_zmqProxyRoute(proxyRules_t * rules, const zmq_msg_t * msg){
+		if (!rules){
+			return 0;
+		}
+		proxyRule_t * rule = lua_zmqProxyRulesMatch(*rules, static_cast<const char*>(zmq_msg_data(const_cast<zmq_msg_t*>(msg))), zmq_msg_size(const_cast<zmq_msg_t*>(msg)));
+		if (!rule){
+			return 0;
+		}
+		switch (rule->action){
+			case PROXY_RULE_DROP:
+				return -1;
+			case PROXY_RULE_SAMPLE:
+				return ((rule->counter++ % rule->every) == 0) ? static_cast<int>(rule->backend) : -1;
+			default:
+				return static_cast<int>(rule->backend);
+		}
+	}
+
+	static bool lua_zmqProxyRuleDecode(const char * data, size_t size, proxyRule_t & rule){
+		if (size < proxyRuleHeaderSize){
+			return false;
+		}
+		rule.action = data[0];
+		memcpy(&rule.backend, data + 1, sizeof(rule.backend));
+		memcpy(&rule.every, data + 1 + sizeof(rule.backend), sizeof(rule.every));
+		rule.prefix.assign(data + proxyRuleHeaderSize, size - proxyRuleHeaderSize);
+		rule.counter = 0;
+		return ((rule.action == PROXY_RULE_ROUTE) || (rule.action == PROXY_RULE_DROP) || (rule.action == PROXY_RULE_SAMPLE)) && (rule.every > 0);
+	}
+
+	static const std::string lua_zmqProxyRuleEncode(const proxyRule_t & rule){
+		std::string frame(proxyRuleHeaderSize, '\0');
+		frame[0] = rule.action;
+		memcpy(&frame[1], &rule.backend, sizeof(rule.backend));
+		memcpy(&frame[1 + sizeof(rule.backend)], &rule.every, sizeof(rule.every));
+		frame.append(rule.prefix);
+		return frame;
+	}
+
+	/*
+		Forwards up to proxyBurstSize messages. Returns -1 on error.
+		A message is dropped as a whole, remaining frames are still read from the source socket.
+		Rules are applied to messages from frontend only.
+	*/
+	static int lua_zmqProxyForward(void * from, const std::vector<void *> & targets, proxyRules_t * rules, void * capture, proxyDirection_t & stats, const proxyOptions_t & options){
+		zmq_msg_t msg;
+		zmq_msg_init(&msg);
+
+		for (int count = 0; count < proxyBurstSize; count++){
+			std::chrono::steady_clock::time_point start;
+			bool first = true;
+			bool more = true;
+			bool dropping = false;
+			bool filtered = false;
+			void * to = nullptr;
+			uint64_t frames = 0;
+			uint64_t bytes = 0;
+
+			if (options.latency){
+				start = std::chrono::steady_clock::now();
+			}
+
+			while (more){
+				if (zmq_msg_recv(&msg, from, first ? ZMQ_DONTWAIT : 0) < 0){
+					int error = zmq_errno();
+					zmq_msg_close(&msg);
+					if (first && (error == EAGAIN)){
+						return 0;
+					}
+					return -1;
+				}
+				more = (zmq_msg_more(&msg) == 1);
+				size_t size = zmq_msg_size(&msg);
+
+				if (capture){
+					zmq_msg_t copy;
+					zmq_msg_init(&copy);
+					zmq_msg_copy(&copy, &msg);
+					if (zmq_msg_send(&copy, capture, more ? ZMQ_SNDMORE : 0) < 0){
+						zmq_msg_close(&copy);
+					}
+				}
+
+				if (first){
+					int target = lua_zmqProxyRoute(rules, &msg);
+					if (target < 0){
+						stats.filtered.fetch_add(1, std::memory_order_relaxed);
+						filtered = dropping = true;
+						first = false;
+						continue;
+					}
+					to = targets[target];
+				}
+
+				if (dropping){
+					continue;
+				}
+
+				int flags = more ? ZMQ_SNDMORE : 0;
+				int result = 0;
+				if (first){
+					result = zmq_msg_send(&msg, to, flags | ZMQ_DONTWAIT);
+					if ((result < 0) && (zmq_errno() == EAGAIN)){
+						stats.eagain.fetch_add(1, std::memory_order_relaxed);
+						if (options.drop){
+							stats.dropped.fetch_add(1, std::memory_order_relaxed);
+							dropping = true;
+							first = false;
+							continue;
+						}
+						result = zmq_msg_send(&msg, to, flags);
+					}
+				}else{
+					result = zmq_msg_send(&msg, to, flags);
+				}
+				if (result < 0){
+					zmq_msg_close(&msg);
+					return -1;
+				}
+				first = false;
+				frames++;
+				bytes += size;
+			}
+
+			if (!dropping && !filtered){
+				stats.messages.fetch_add(1, std::memory_order_relaxed);
+				stats.frames.fetch_add(frames, std::memory_order_relaxed);
+				stats.bytes.fetch_add(bytes, std::memory_order_relaxed);
+				if (options.latency){
+					uint64_t elapsed = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+					lua_zmqProxyRecordLatency(stats, elapsed);
+				}
+			}
+		}
+		zmq_msg_close(&msg);
+		return 0;
+	}
+
+	/*
+		Replies to STATISTICS command in the same format as zmq_proxy_steerable:
+		8 frames with 64-bit counters - frontend messages/bytes in and out, backend messages/bytes in and out.
+	*/
+	static void lua_zmqProxySendStatistics(void * control, proxyStats_t * stats){
+		const proxyDirection_t & in = stats->directions[0];
+		const proxyDirection_t & out = stats->directions[1];
+		uint64_t values[8] = {
+			in.messages.load(std::memory_order_relaxed), in.bytes.load(std::memory_order_relaxed),
+			out.messages.load(std::memory_order_relaxed), out.bytes.load(std::memory_order_relaxed),
+			out.messages.load(std::memory_order_relaxed), out.bytes.load(std::memory_order_relaxed),
+			in.messages.load(std::memory_order_relaxed), in.bytes.load(std::memory_order_relaxed),
+		};
+		for (int index = 0; index < 8; index++){
+			zmq_send(control, &values[index], sizeof(values[index]), (index < 7) ? ZMQ_SNDMORE : 0);
+		}
+	}
+
+	enum proxyCommand_t {
+		PROXY_NONE,
+		PROXY_PAUSE,
+		PROXY_RESUME,
+		PROXY_TERMINATE,
+		PROXY_RULES,
+	};
+
+	/*
+		Reads a command from control socket, STATISTICS is answered right away.
+		RULES command is followed by one frame per rule, new rules are returned in rules argument.
+		Rules with backend index out of range make the whole command invalid.
+	*/
+	static proxyCommand_t lua_zmqProxyReadCommand(void * control, proxyStats_t * stats, size_t backends, std::unique_ptr<proxyRules_t> & rules){
+		zmq_msg_t msg;
+		zmq_msg_init(&msg);
+		if (zmq_msg_recv(&msg, control, ZMQ_DONTWAIT) < 0){
+			zmq_msg_close(&msg);
+			return PROXY_NONE;
+		}
+		const std::string command(static_cast<char*>(zmq_msg_data(&msg)), zmq_msg_size(&msg));
+		bool more = (zmq_msg_more(&msg) == 1);
+		bool isRules = (command == "RULES");
+		bool valid = true;
+		std::unique_ptr<proxyRules_t> newRules(isRules ? new proxyRules_t : nullptr);
+
+		while (more && (zmq_msg_recv(&msg, control, 0) >= 0)){
+			more = (zmq_msg_more(&msg) == 1);
+			if (isRules){
+				proxyRule_t rule;
+				if (lua_zmqProxyRuleDecode(static_cast<char*>(zmq_msg_data(&msg)), zmq_msg_size(&msg), rule) && (rule.backend < backends)){
+					newRules->rules.push_back(rule);
+				}else{
+					valid = false;
+				}
+			}
+		}
+		zmq_msg_close(&msg);
+
+		if (command == "PAUSE"){
+			return PROXY_PAUSE;
+		}else if (command == "RESUME"){
+			return PROXY_RESUME;
+		}else if (command == "TERMINATE"){
+			return PROXY_TERMINATE;
+		}else if (command == "STATISTICS"){
+			lua_zmqProxySendStatistics(control, stats);
+		}else if (isRules && valid){
+			lua_zmqProxyRulesCompile(*newRules);
+			rules = std::move(newRules);
+			return PROXY_RULES;
+		}
+		return PROXY_NONE;
+	}
+
+	/*
+		Proxy loop, returns 0 after TERMINATE command or -1 on error.
+		Control sockets are optional (nullptr). The loop takes ownership of initial rules.
+	*/
+	static int lua_zmqProxyLoop(void * frontend, const std::vector<void *> & backends, void * capture, void * controls[2], proxyStats_t * stats, const proxyOptions_t & options, proxyRules_t * initialRules){
+		std::vector<zmq_pollitem_t> items;
+		std::vector<void *> frontendTarget(1, frontend);
+		std::unique_ptr<proxyRules_t> rules(initialRules);
+		void * controlSockets[2];
+		bool paused = false;
+
+		while (true){
+			int controlCount = 0;
+			items.clear();
+			for (int index = 0; index < 2; index++){
+				if (controls[index]){
+					items.push_back({controls[index], 0, ZMQ_POLLIN, 0});
+					controlSockets[controlCount++] = controls[index];
+				}
+			}
+			size_t dataIndex = items.size();
+			if (!paused){
+				items.push_back({frontend, 0, ZMQ_POLLIN, 0});
+				for (void * backend : backends){
+					if (backend != frontend){
+						items.push_back({backend, 0, ZMQ_POLLIN, 0});
+					}
+				}
+			}
+
+			if (zmq_poll(items.data(), static_cast<int>(items.size()), -1) < 0){
+				return -1;
+			}
+
+			for (int index = 0; index < controlCount; index++){
+				if (items[index].revents & ZMQ_POLLIN){
+					switch (lua_zmqProxyReadCommand(controlSockets[index], stats, backends.size(), rules)){
+						case PROXY_PAUSE:
+							paused = true;
+							break;
+						case PROXY_RESUME:
+							paused = false;
+							break;
+						case PROXY_TERMINATE:
+							return 0;
+						default:
+							break;
+					}
+				}
+			}
+
+			if (!paused && (dataIndex < items.size())){
+				if ((items[dataIndex].revents & ZMQ_POLLIN) && (lua_zmqProxyForward(frontend, backends, rules.get(), capture, stats->directions[0], options) < 0)){
+					return -1;
+				}
+				for (size_t index = dataIndex + 1; index < items.size(); index++){
+					if ((items[index].revents & ZMQ_POLLIN) && (lua_zmqProxyForward(items[index].socket, frontendTarget, nullptr, capture, stats->directions[1], options) < 0)){
+						return -1;
+					}
+				}
+			}
+		}
+	}
+
+	/*
+		Reads rule table from Lua:
+		{{prefix = 'topic', backend = 1}, {prefix = 'debug', drop = true}, {prefix = 'ticks', backend = 2, sample = 10}}
+		Backend indices start at 1. Returns false and error message on invalid rules.
+	*/
+	static bool lua_zmqProxyReadRules(lutok2::State & state, int index, size_t backends, std::vector<proxyRule_t> & rules, std::string & error){
+		Stack * stack = state.stack;
+		size_t count = stack->objLen(index);
+
+		for (size_t position = 1; position <= count; position++){
+			proxyRule_t rule;
+			rule.action = PROXY_RULE_ROUTE;
+			rule.backend = 0;
+			rule.every = 1;
+			rule.counter = 0;
+
+			stack->push<int>(static_cast<int>(position));
+			stack->getTable(index);
+			int entry = stack->getTop();
+			if (!stack->is<LUA_TTABLE>(entry)){
+				stack->pop(1);
+				error = "rule must be a table";
+				return false;
+			}
+
+			stack->getField("prefix", entry);
+			if (stack->is<LUA_TSTRING>(-1)){
+				rule.prefix = stack->toLString(-1);
+			}
+			stack->pop(1);
+
+			stack->getField("backend", entry);
+			if (stack->is<LUA_TNUMBER>(-1)){
+				int backend = stack->to<int>(-1);
+				if ((backend < 1) || (static_cast<size_t>(backend) > backends)){
+					stack->pop(2);
+					error = "backend index out of range";
+					return false;
+				}
+				rule.backend = static_cast<uint32_t>(backend - 1);
+			}
+			stack->pop(1);
+
+			stack->getField("sample", entry);
+			if (stack->is<LUA_TNUMBER>(-1)){
+				int every = stack->to<int>(-1);
+				if (every <= 0){
+					stack->pop(2);
+					error = "sample must be positive";
+					return false;
+				}
+				rule.action = PROXY_RULE_SAMPLE;
+				rule.every = static_cast<uint32_t>(every);
+			}
+			stack->pop(1);
+
+			stack->getField("drop", entry);
+			if (stack->is<LUA_TBOOLEAN>(-1) && stack->to<bool>(-1)){
+				rule.action = PROXY_RULE_DROP;
+			}
+			stack->pop(2);
+
+			rules.push_back(rule);
+		}
+		return true;
+	}
+
+	/*
+		Raises an argument error unless there's a backend socket or a non-empty table of backend sockets at index.
+		Rule backend indices refer to table positions, so a skipped entry would shift them.
+		It's called before any C++ objects are created because Lua errors don't unwind them.
+	*/
+	static void lua_zmqProxyCheckBackends(lutok2::State & state, int index){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TTABLE>(index)){
+			size_t count = stack->objLen(index);
+			if (count == 0){
+				state.error("bad argument #%d (no backend sockets)", index);
+			}
+			for (size_t position = 1; position <= count; position++){
+				stack->push<int>(static_cast<int>(position));
+				stack->getTable(index);
+				bool valid = stack->is<LUA_TUSERDATA>(-1);
+				stack->pop(1);
+				if (!valid){
+					state.error("bad argument #%d (backend %d is not a socket)", index, static_cast<int>(position));
+				}
+			}
+		}else if (!stack->is<LUA_TUSERDATA>(index)){
+			state.error("bad argument #%d (backend socket or table of sockets expected)", index);
+		}
+	}
+
+	//reads backend socket or a table of backend sockets checked by lua_zmqProxyCheckBackends
+	static void lua_zmqProxyReadBackends(lutok2::State & state, int index, std::vector<void *> & backends){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(index)){
+			backends.push_back(getZMQobject(index));
+		}else{
+			size_t count = stack->objLen(index);
+			for (size_t position = 1; position <= count; position++){
+				stack->push<int>(static_cast<int>(position));
+				stack->getTable(index);
+				backends.push_back(getZMQobject(-1));
+				stack->pop(1);
+			}
+		}
+	}
+
+	/*
+		Reads options.rules, returns false on invalid rules.
+		Compiled rules are stored in rules argument (nullptr if there are no rules).
+	*/
+	static bool lua_zmqProxyReadOptionRules(lutok2::State & state, int index, size_t backends, proxyRules_t * & rules, std::string & error){
+		Stack * stack = state.stack;
+		rules = nullptr;
+		if (!stack->is<LUA_TTABLE>(index)){
+			return true;
+		}
+		stack->getField("rules", index);
+		if (stack->is<LUA_TTABLE>(-1)){
+			std::unique_ptr<proxyRules_t> newRules(new proxyRules_t);
+			if (!lua_zmqProxyReadRules(state, stack->getTop(), backends, newRules->rules, error)){
+				stack->pop(1);
+				return false;
+			}
+			lua_zmqProxyRulesCompile(*newRules);
+			rules = newRules.release();
+		}
+		stack->pop(1);
+		return true;
+	}
+
+	static void lua_zmqProxyReadOptions(lutok2::State & state, int index, proxyOptions_t & options){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TTABLE>(index)){
+			stack->getField("drop", index);
+			options.drop = stack->is<LUA_TBOOLEAN>(-1) && stack->to<bool>(-1);
+			stack->pop(1);
+			stack->getField("latency", index);
+			options.latency = stack->is<LUA_TBOOLEAN>(-1) && stack->to<bool>(-1);
+			stack->pop(1);
+		}
+	}
+
+	int lua_zmqProxyStatsNew(lutok2::State & state){
+		lua_zmqPushSharedObject(state, lua_zmqProxyStatsCreate(), &proxyStatsObjectType);
+		return 1;
+	}
+
+	int lua_zmqProxyStatsFree(lutok2::State & state){
+		return lua_zmqSharedObjectFree(state);
+	}
+
+	//returns upper bound in nanoseconds of the latency bucket containing given fraction of messages
+	static uint64_t lua_zmqProxyLatencyPercentile(const proxyDirection_t & stats, uint64_t total, double fraction){
+		uint64_t limit = static_cast<uint64_t>(static_cast<double>(total) * fraction);
+		uint64_t count = 0;
+		for (size_t bucket = 0; bucket < proxyLatencyBuckets; bucket++){
+			count += stats.latency[bucket].load(std::memory_order_relaxed);
+			if ((count > 0) && (count >= limit)){
+				return (bucket < 63) ? (static_cast<uint64_t>(1) << bucket) : UINT64_MAX;
+			}
+		}
+		return 0;
+	}
+
+	/*
+		Returns a table with counters of both directions:
+		{elapsed = seconds, frontend = {messages, frames, bytes, eagain, dropped, rate, p50, p99}, backend = {...}}
+		Direction is named by the socket messages come from. Rate is in messages per second since
+		the previous call, p50 and p99 are latency upper bounds in nanoseconds (only with latency option).
+	*/
+	static void lua_zmqProxyPushStats(lutok2::State & state, proxyStats_t * stats){
+		Stack * stack = state.stack;
+		{
+			std::lock_guard<std::mutex> lk(stats->m);
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			double interval = std::chrono::duration<double>(now - stats->lastRead).count();
+
+			stack->newTable();
+			stack->setField<LUA_NUMBER>("elapsed", std::chrono::duration<double>(now - stats->started).count());
+
+			for (int direction = 0; direction < 2; direction++){
+				const proxyDirection_t & d = stats->directions[direction];
+				uint64_t messages = d.messages.load(std::memory_order_relaxed);
+				uint64_t latencyTotal = 0;
+				for (size_t bucket = 0; bucket < proxyLatencyBuckets; bucket++){
+					latencyTotal += d.latency[bucket].load(std::memory_order_relaxed);
+				}
+
+				stack->push<const std::string &>(proxyDirectionNames[direction]);
+				stack->newTable();
+				stack->setField<LUA_NUMBER>("messages", static_cast<LUA_NUMBER>(messages));
+				stack->setField<LUA_NUMBER>("frames", static_cast<LUA_NUMBER>(d.frames.load(std::memory_order_relaxed)));
+				stack->setField<LUA_NUMBER>("bytes", static_cast<LUA_NUMBER>(d.bytes.load(std::memory_order_relaxed)));
+				stack->setField<LUA_NUMBER>("eagain", static_cast<LUA_NUMBER>(d.eagain.load(std::memory_order_relaxed)));
+				stack->setField<LUA_NUMBER>("dropped", static_cast<LUA_NUMBER>(d.dropped.load(std::memory_order_relaxed)));
+				stack->setField<LUA_NUMBER>("filtered", static_cast<LUA_NUMBER>(d.filtered.load(std::memory_order_relaxed)));
+				stack->setField<LUA_NUMBER>("rate", (interval > 0) ? static_cast<LUA_NUMBER>(messages - stats->lastMessages[direction]) / interval : 0);
+				if (latencyTotal > 0){
+					stack->setField<LUA_NUMBER>("p50", static_cast<LUA_NUMBER>(lua_zmqProxyLatencyPercentile(d, latencyTotal, 0.5)));
+					stack->setField<LUA_NUMBER>("p99", static_cast<LUA_NUMBER>(lua_zmqProxyLatencyPercentile(d, latencyTotal, 0.99)));
+				}
+				stack->setTable();
+
+				stats->lastMessages[direction] = messages;
+			}
+			stats->lastRead = now;
+		}
+	}
+
+	int lua_zmqProxyStatsGet(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			lua_zmqProxyPushStats(state, static_cast<proxyStats_t *>(getZMQobject(1)));
+			return 1;
+		}
+		return 0;
+	}
+
+	/*
+		Blocking instrumented proxy: proxyRun(frontend, backend, capture, control, stats, options)
+		Backend may be a socket or a table of sockets. Capture, control and stats are optional.
+		Options: {drop = boolean, latency = boolean, rules = routing rules}
+		Returns true after TERMINATE command or false and error message.
+	*/
+	int lua_zmqProxyRun(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			lua_zmqProxyCheckBackends(state, 2);
+			std::vector<void *> backends;
+			lua_zmqProxyReadBackends(state, 2, backends);
+			void * frontend = getZMQobject(1);
+			void * capture = nullptr;
+			proxyRules_t * rules = nullptr;
+			std::string error;
+			void * controls[2] = {nullptr, nullptr};
+			proxyStats_t * stats = nullptr;
+			proxyOptions_t options;
+
+			if (stack->is<LUA_TUSERDATA>(3)){
+				capture = getZMQobject(3);
+			}
+			if (stack->is<LUA_TUSERDATA>(4)){
+				controls[0] = getZMQobject(4);
+			}
+			if (!lua_zmqProxyReadOptionRules(state, 6, backends.size(), rules, error)){
+				stack->push<bool>(false);
+				stack->push<const std::string &>(error);
+				return 2;
+			}
+			if (stack->is<LUA_TUSERDATA>(5)){
+				stats = static_cast<proxyStats_t *>(getZMQobject(5));
+				stats->references++;
+			}else{
+				stats = lua_zmqProxyStatsCreate();
+			}
+			lua_zmqProxyReadOptions(state, 6, options);
+
+			int result = lua_zmqProxyLoop(frontend, backends, capture, controls, stats, options, rules);
+			lua_zmqProxyStatsRelease(stats);
+
+			if (result < 0){
+				stack->push<bool>(false);
+				lua_pushZMQ_error(state);
+				return 2;
+			}
+			stack->push<bool>(true);
+			return 1;
+		}
+		return 0;
+	}
+
+	/*
+		Proxy running on a native thread without Lua state.
+		Commands are sent over an internal PAIR socket pair, frontend, backend and capture sockets
+		belong to the proxy thread until it finishes.
+	*/
+	struct proxyThread_t {
+		std::thread thread;
+		//Lua side of the internal control pair
+		void * control;
+		proxyStats_t * stats;
+		size_t backends;
+		std::atomic<bool> finished;
+		int result;
+		int error;
+	};
+
+	static void lua_zmqProxyThreadFunction(proxyThread_t * proxy, void * frontend, std::vector<void *> backends, void * capture, void * threadControl, void * userControl, proxyOptions_t options, proxyRules_t * rules){
+		void * controls[2] = {threadControl, userControl};
+		proxy->result = lua_zmqProxyLoop(frontend, backends, capture, controls, proxy->stats, options, rules);
+		proxy->error = (proxy->result < 0) ? zmq_errno() : 0;
+		//finished is set first, callers which still see the proxy running get EAGAIN from the closed pair
+		proxy->finished.store(true);
+		zmq_close(threadControl);
+	}
+
+	/*
+		Starts a proxy thread: proxyStart(context, frontend, backend, capture, options)
+		Backend may be a socket or a table of sockets.
+		Options: {control = socket, stats = stats object, drop = boolean, latency = boolean, rules = routing rules}
+		Returns proxy handle.
+	*/
+	int lua_zmqProxyStart(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TUSERDATA>(2)){
+			lua_zmqProxyCheckBackends(state, 3);
+			std::vector<void *> backends;
+			lua_zmqProxyReadBackends(state, 3, backends);
+			void * context = getZMQobject(1);
+			void * frontend = getZMQobject(2);
+			void * capture = nullptr;
+			proxyRules_t * rules = nullptr;
+			std::string message;
+			void * userControl = nullptr;
+			proxyStats_t * stats = nullptr;
+			proxyOptions_t options;
+
+			if (stack->is<LUA_TUSERDATA>(4)){
+				capture = getZMQobject(4);
+			}
+			if (!lua_zmqProxyReadOptionRules(state, 5, backends.size(), rules, message)){
+				stack->push<bool>(false);
+				stack->push<const std::string &>(message);
+				return 2;
+			}
+			if (stack->is<LUA_TTABLE>(5)){
+				lua_zmqProxyReadOptions(state, 5, options);
+				stack->getField("control", 5);
+				if (stack->is<LUA_TUSERDATA>(-1)){
+					userControl = getZMQobject(-1);
+				}
+				stack->pop(1);
+				stack->getField("stats", 5);
+				if (stack->is<LUA_TUSERDATA>(-1)){
+					stats = static_cast<proxyStats_t *>(getZMQobject(-1));
+					stats->references++;
+				}
+				stack->pop(1);
+			}
+			if (!stats){
+				stats = lua_zmqProxyStatsCreate();
+			}
+
+			proxyThread_t * proxy = new proxyThread_t;
+			proxy->stats = stats;
+			proxy->backends = backends.size();
+			proxy->finished = false;
+			proxy->result = 0;
+			proxy->error = 0;
+
+			std::stringstream endpoint;
+			endpoint << "inproc://luazmq_proxy_" << static_cast<void*>(proxy);
+
+			int linger = 0;
+			proxy->control = zmq_socket(context, ZMQ_PAIR);
+			void * threadControl = zmq_socket(context, ZMQ_PAIR);
+			if (!proxy->control || !threadControl ||
+				(zmq_bind(threadControl, endpoint.str().c_str()) != 0) ||
+				(zmq_connect(proxy->control, endpoint.str().c_str()) != 0)){
+				int error = zmq_errno();
+				if (proxy->control){
+					zmq_close(proxy->control);
+				}
+				if (threadControl){
+					zmq_close(threadControl);
+				}
+				lua_zmqProxyStatsRelease(stats);
+				delete rules;
+				delete proxy;
+				stack->push<bool>(false);
+				stack->push<const std::string &>(zmq_strerror(error));
+				return 2;
+			}
+			zmq_setsockopt(proxy->control, ZMQ_LINGER, &linger, sizeof(linger));
+
+			proxy->thread = std::thread(lua_zmqProxyThreadFunction, proxy, frontend, backends, capture, threadControl, userControl, options, rules);
+
+			pushUData(proxy);
+			return 1;
+		}
+		return 0;
+	}
+
+	/*
+		Sends command frame to the proxy thread without blocking.
+		Returns false if the proxy isn't running, EAGAIN means the thread has closed its end of the pair.
+	*/
+	static bool lua_zmqProxySendControl(proxyThread_t * proxy, const char * data, size_t length, int flags, int & error){
+		error = 0;
+		if (proxy->finished.load()){
+			return false;
+		}
+		if (zmq_send(proxy->control, data, length, flags | ZMQ_DONTWAIT) < 0){
+			error = zmq_errno();
+			if (error == EAGAIN){
+				error = 0;
+			}
+			return false;
+		}
+		return true;
+	}
+
+	//pushes false and error message after failed lua_zmqProxySendControl
+	static int lua_zmqProxyPushControlError(lutok2::State & state, int error){
+		Stack * stack = state.stack;
+		stack->push<bool>(false);
+		if (error == 0){
+			stack->push<const std::string &>("proxy is not running");
+		}else{
+			stack->push<const std::string &>(zmq_strerror(error));
+		}
+		return 2;
+	}
+
+	//sends PAUSE, RESUME or TERMINATE command to the proxy thread
+	int lua_zmqProxyCommand(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TSTRING>(2)){
+			proxyThread_t * proxy = static_cast<proxyThread_t *>(getZMQobject(1));
+			const std::string command = stack->toLString(2);
+			int error = 0;
+			if (!lua_zmqProxySendControl(proxy, command.c_str(), command.length(), 0, error)){
+				return lua_zmqProxyPushControlError(state, error);
+			}
+			stack->push<bool>(true);
+			return 1;
+		}
+		return 0;
+	}
+
+	/*
+		Encodes routing rules as frames of RULES command: proxyRulesEncode(rules)
+		Returns all frames, the command can be sent to a control socket with sendMultipart.
+	*/
+	int lua_zmqProxyRulesEncode(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TTABLE>(1)){
+			std::vector<proxyRule_t> rules;
+			std::string error;
+			if (!lua_zmqProxyReadRules(state, 1, std::numeric_limits<uint32_t>::max(), rules, error)){
+				stack->push<bool>(false);
+				stack->push<const std::string &>(error);
+				return 2;
+			}
+			if (!stack->checkStack(static_cast<int>(rules.size()) + 1)){
+				stack->push<bool>(false);
+				stack->push<const std::string &>("too many rules");
+				return 2;
+			}
+			stack->push<const std::string &>("RULES");
+			for (const proxyRule_t & rule : rules){
+				const std::string frame = lua_zmqProxyRuleEncode(rule);
+				stack->pushLString(frame.data(), frame.length());
+			}
+			return static_cast<int>(rules.size()) + 1;
+		}
+		return 0;
+	}
+
+	//replaces routing rules of a running proxy thread
+	int lua_zmqProxySetRules(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1) && stack->is<LUA_TTABLE>(2)){
+			proxyThread_t * proxy = static_cast<proxyThread_t *>(getZMQobject(1));
+			std::vector<proxyRule_t> rules;
+			std::string message;
+			if (!lua_zmqProxyReadRules(state, 2, proxy->backends, rules, message)){
+				stack->push<bool>(false);
+				stack->push<const std::string &>(message);
+				return 2;
+			}
+			int error = 0;
+			if (!lua_zmqProxySendControl(proxy, "RULES", 5, rules.empty() ? 0 : ZMQ_SNDMORE, error)){
+				return lua_zmqProxyPushControlError(state, error);
+			}
+			//remaining frames of an accepted message don't block
+			for (size_t index = 0; index < rules.size(); index++){
+				const std::string frame = lua_zmqProxyRuleEncode(rules[index]);
+				if (zmq_send(proxy->control, frame.data(), frame.length(), (index + 1 < rules.size()) ? ZMQ_SNDMORE : 0) < 0){
+					stack->push<bool>(false);
+					lua_pushZMQ_error(state);
+					return 2;
+				}
+			}
+			stack->push<bool>(true);
+			return 1;
+		}
+		return 0;
+	}
+
+	int lua_zmqProxyStatistics(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			proxyThread_t * proxy = static_cast<proxyThread_t *>(getZMQobject(1));
+			lua_zmqProxyPushStats(state, proxy->stats);
+			stack->setField<bool>("running", !proxy->finished.load());
+			return 1;
+		}
+		return 0;
+	}
+
+	/*
+		Terminates the proxy thread (if it's still running) and waits for it.
+		Returns true or false and error message if the proxy failed.
+	*/
+	int lua_zmqProxyJoin(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			proxyThread_t * proxy = static_cast<proxyThread_t *>(getZMQobject(1));
+			if (proxy->thread.joinable()){
+				int error = 0;
+				lua_zmqProxySendControl(proxy, "TERMINATE", 9, 0, error);
+				proxy->thread.join();
+			}
+			if (proxy->result < 0){
+				stack->push<bool>(false);
+				stack->push<const std::string &>(zmq_strerror(proxy->error));
+				return 2;
+			}
+			stack->push<bool>(true);
+			return 1;
+		}
+		return 0;
+	}
+
+	int lua_zmqProxyFree(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			proxyThread_t * proxy = static_cast<proxyThread_t *>(getZMQobject(1));
+			if (proxy->thread.joinable()){
+				int error = 0;
+				lua_zmqProxySendControl(proxy, "TERMINATE", 9, 0, error);
+				proxy->thread.join();
+			}
+			zmq_close(proxy->control);
+			lua_zmqProxyStatsRelease(proxy->stats);
+			delete proxy;
+		}
+		return 0;
+	}
+};
@@ -0,0 +1,396 @@
+/*
+	LuaZMQ - Lua binding for ZeroMQ library
+
+	Copyright 2013, 2014, 2015 Mário Kašuba
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are
+	met:
+
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+	"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+	A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+	OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+	SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+	LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "common.h"
+#include <atomic>
+#include <string.h>
+#include <errno.h>
+#include "main.h"
+#include "queue.h"
+#include "shared.h"
+
+#ifndef _WIN32
+#	include <unistd.h>
+#	include <fcntl.h>
+#	ifdef __linux__
+#		include <sys/eventfd.h>
+#	endif
+#endif
+
+namespace LuaZMQ {
+	const size_t maxQueueStringLength = 54;
+
+	//small value stored inline in queue cells
+	struct queueValue_t {
+		unsigned char type;
+		unsigned char length;
+		char data[maxQueueStringLength];
+		LUA_NUMBER number;
+	};
+
+	/*
+		Bounded lock-free queue of numbers, booleans and short strings shared by Lua states.
+		Optional file descriptor becomes readable when there's something to pop,
+		so the queue can be added into zmq_poll as a raw fd item.
+	*/
+	struct valueQueue_t {
+		std::atomic<int> references;
+		mpmcQueue<queueValue_t> queue;
+		//read end of eventfd or pipe, -1 if the queue isn't pollable
+		int fd;
+		int writeFd;
+		//true while fd is signalled
+		std::atomic<bool> signalled;
+
+		explicit valueQueue_t(size_t capacity) : references(1), queue(capacity), fd(-1), writeFd(-1), signalled(false) {}
+	};
+
+	const size_t defaultQueueCapacity = 1024;
+
+	static bool lua_zmqQueueOpenFD(valueQueue_t * queue){
+#if defined(_WIN32)
+		return false;
+#elif defined(__linux__)
+		queue->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		queue->writeFd = queue->fd;
+		return (queue->fd >= 0);
+#else
+		int fds[2];
+		if (pipe(fds) != 0){
+			return false;
+		}
+		for (int index = 0; index < 2; index++){
+			fcntl(fds[index], F_SETFL, fcntl(fds[index], F_GETFL) | O_NONBLOCK);
+			fcntl(fds[index], F_SETFD, FD_CLOEXEC);
+		}
+		queue->fd = fds[0];
+		queue->writeFd = fds[1];
+		return true;
+#endif
+	}
+
+	static void lua_zmqQueueCloseFD(valueQueue_t * queue){
+#ifndef _WIN32
+		if (queue->writeFd >= 0 && queue->writeFd != queue->fd){
+			close(queue->writeFd);
+		}
+		if (queue->fd >= 0){
+			close(queue->fd);
+		}
+#endif
+		queue->fd = queue->writeFd = -1;
+	}
+
+	static void lua_zmqQueueSignal(valueQueue_t * queue){
+#ifndef _WIN32
+		if (queue->fd >= 0 && !queue->signalled.exchange(true)){
+			uint64_t value = 1;
+			ssize_t rc = write(queue->writeFd, &value, (queue->writeFd == queue->fd) ? sizeof(value) : 1);
+			(void)rc;
+		}
+#endif
+	}
+
+	static void lua_zmqQueueClearSignal(valueQueue_t * queue){
+#ifndef _WIN32
+		uint64_t buffer[8];
+		while (read(queue->fd, buffer, sizeof(buffer)) > 0){
+		}
+		queue->signalled.store(false);
+#endif
+	}
+
+	/*
+		Pops one value. Signalled fd is cleared when the queue is found empty,
+		a value pushed meanwhile signals it again.
+	*/
+	static bool lua_zmqQueueTake(valueQueue_t * queue, queueValue_t & value){
+		if (queue->queue.pop(value)){
+			return true;
+		}
+		if ((queue->fd >= 0) && queue->signalled.load()){
+			lua_zmqQueueClearSignal(queue);
+			if (queue->queue.pop(value)){
+				lua_zmqQueueSignal(queue);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static bool lua_zmqQueueReadValue(lutok2::State & state, int index, queueValue_t & value){
+		Stack * stack = state.stack;
+		value.type = static_cast<unsigned char>(stack->type(index));
+		value.length = 0;
+
+		switch (value.type){
+			case LUA_TNUMBER:
+				value.number = stack->to<LUA_NUMBER>(index);
+				return true;
+			case LUA_TBOOLEAN:
+				value.number = stack->to<bool>(index) ? 1 : 0;
+				return true;
+			case LUA_TSTRING: {
+				size_t length = stack->objLen(index);
+				if (length > maxQueueStringLength){
+					return false;
+				}
+				memcpy(value.data, stack->to<const char *>(index), length);
+				value.length = static_cast<unsigned char>(length);
+				return true;
+			}
+			default:
+				return false;
+		}
+	}
+
+	//true if lua_zmqQueueReadValue accepts the value at stack index
+	static bool lua_zmqQueueCheckValue(lutok2::State & state, int index){
+		Stack * stack = state.stack;
+		switch (stack->type(index)){
+			case LUA_TNUMBER:
+			case LUA_TBOOLEAN:
+				return true;
+			case LUA_TSTRING:
+				return (stack->objLen(index) <= maxQueueStringLength);
+			default:
+				return false;
+		}
+	}
+
+	static void lua_zmqQueuePushValue(lutok2::State & state, const queueValue_t & value){
+		Stack * stack = state.stack;
+		switch (value.type){
+			case LUA_TNUMBER:
+				stack->push<LUA_NUMBER>(value.number);
+				break;
+			case LUA_TBOOLEAN:
+				stack->push<bool>(value.number != 0);
+				break;
+			case LUA_TSTRING:
+				stack->pushLString(value.data, value.length);
+				break;
+			default:
+				stack->pushNil();
+				break;
+		}
+	}
+
+	static void lua_zmqQueueRelease(valueQueue_t * queue){
+		if (queue && (--queue->references == 0)){
+			lua_zmqQueueCloseFD(queue);
+			delete queue;
+		}
+	}
+
+	static void lua_zmqQueueAcquireShared(void * queue){
+		static_cast<valueQueue_t *>(queue)->references++;
+	}
+
+	static void lua_zmqQueueReleaseShared(void * queue){
+		lua_zmqQueueRelease(static_cast<valueQueue_t *>(queue));
+	}
+
+	/*
+		Queue userdata is a shared object (shared.h), so a queue passed as a thread2 or pool job argument
+		holds its own reference until zmq.queue(ud) wraps it, even if the creating state collects the queue first.
+	*/
+	const sharedObjectType_t queueObjectType = {lua_zmqQueueAcquireShared, lua_zmqQueueReleaseShared};
+
+	//freed queue objects keep a null pointer
+	static int lua_zmqQueuePushClosed(lutok2::State & state){
+		Stack * stack = state.stack;
+		stack->push<bool>(false);
+		stack->push<const std::string &>("queue is closed");
+		return 2;
+	}
+
+	/*
+		Creates a new queue with the given capacity.
+		Set the second argument to true to get a pollable queue.
+	*/
+	int lua_zmqQueueNew(lutok2::State & state){
+		Stack * stack = state.stack;
+		size_t capacity = defaultQueueCapacity;
+		if (stack->is<LUA_TNUMBER>(1) && (stack->to<int>(1) > 0)){
+			capacity = static_cast<size_t>(stack->to<int>(1));
+		}
+		valueQueue_t * queue = new valueQueue_t(capacity);
+		if (stack->is<LUA_TBOOLEAN>(2) && stack->to<bool>(2)){
+			if (!lua_zmqQueueOpenFD(queue)){
+				delete queue;
+				stack->push<bool>(false);
+				stack->push<const std::string &>(strerror(errno));
+				return 2;
+			}
+		}
+		lua_zmqPushSharedObject(state, queue, &queueObjectType);
+		return 1;
+	}
+
+	int lua_zmqQueueFree(lutok2::State & state){
+		return lua_zmqSharedObjectFree(state);
+	}
+
+	/*
+		Pushes all arguments after the queue object.
+		Returns the number of pushed values, it's lower if the queue got full.
+		Unsupported values (tables, long strings, ...) return false and error message,
+		all values are checked first so nothing is pushed in that case.
+	*/
+	int lua_zmqQueuePush(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			valueQueue_t * queue = static_cast<valueQueue_t *>(getZMQobject(1));
+			if (!queue){
+				return lua_zmqQueuePushClosed(state);
+			}
+			int top = stack->getTop();
+			int pushed = 0;
+
+			for (int index = 2; index <= top; index++){
+				if (!lua_zmqQueueCheckValue(state, index)){
+					stack->push<bool>(false);
+					stack->push<const std::string &>("unsupported value");
+					return 2;
+				}
+			}
+
+			for (int index = 2; index <= top; index++){
+				queueValue_t value;
+				lua_zmqQueueReadValue(state, index, value);
+				if (!queue->queue.push(value)){
+					break;
+				}
+				pushed++;
+			}
+
+			if (pushed > 0){
+				lua_zmqQueueSignal(queue);
+			}
+			stack->push<int>(pushed);
+			return 1;
+		}
+		return 0;
+	}
+
+	//returns the oldest value or nil if the queue is empty
+	int lua_zmqQueuePop(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			valueQueue_t * queue = static_cast<valueQueue_t *>(getZMQobject(1));
+			if (!queue){
+				return lua_zmqQueuePushClosed(state);
+			}
+			queueValue_t value;
+			if (lua_zmqQueueTake(queue, value)){
+				lua_zmqQueuePushValue(state, value);
+			}else{
+				stack->pushNil();
+			}
+			return 1;
+		}
+		return 0;
+	}
+
+	/*
+		Pops up to max values into a table (an optional reused table) and returns the table and count.
+		Reused table keeps its capacity, trailing elements from the previous batch are cleared.
+	*/
+	int lua_zmqQueuePopBatch(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			valueQueue_t * queue = static_cast<valueQueue_t *>(getZMQobject(1));
+			if (!queue){
+				return lua_zmqQueuePushClosed(state);
+			}
+			size_t max = queue->queue.capacity();
+			if (stack->is<LUA_TNUMBER>(2) && (stack->to<int>(2) > 0)){
+				max = static_cast<size_t>(stack->to<int>(2));
+			}
+
+			size_t previous = 0;
+			if (stack->is<LUA_TTABLE>(3)){
+				stack->pushValue(3);
+				previous = stack->objLen(-1);
+			}else{
+				stack->newTable();
+			}
+
+			size_t count = 0;
+			queueValue_t value;
+			while ((count < max) && lua_zmqQueueTake(queue, value)){
+				count++;
+				stack->push<int>(static_cast<int>(count));
+				lua_zmqQueuePushValue(state, value);
+				stack->setTable();
+			}
+			for (size_t index = count + 1; index <= previous; index++){
+				stack->push<int>(static_cast<int>(index));
+				stack->pushNil();
+				stack->setTable();
+			}
+
+			stack->push<int>(static_cast<int>(count));
+			return 2;
+		}
+		return 0;
+	}
+
+	int lua_zmqQueueSize(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			valueQueue_t * queue = static_cast<valueQueue_t *>(getZMQobject(1));
+			if (!queue){
+				return lua_zmqQueuePushClosed(state);
+			}
+			stack->push<LUA_NUMBER>(static_cast<LUA_NUMBER>(queue->queue.size()));
+			return 1;
+		}
+		return 0;
+	}
+
+	//returns file descriptor for zmq_poll or nil if the queue isn't pollable
+	int lua_zmqQueueFD(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			valueQueue_t * queue = static_cast<valueQueue_t *>(getZMQobject(1));
+			if (!queue){
+				return lua_zmqQueuePushClosed(state);
+			}
+			if (queue->fd >= 0){
+				stack->push<int>(queue->fd);
+			}else{
+				stack->pushNil();
+			}
+			return 1;
+		}
+		return 0;
+	}
+};
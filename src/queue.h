@@ -0,0 +1,109 @@
+#ifndef LUAZMQ_QUEUE_H
+#define LUAZMQ_QUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace LuaZMQ {
+	/*
+		Bounded lock-free multi-producer multi-consumer queue (Dmitry Vyukov's algorithm).
+		Every cell carries a sequence number which tells whether it's ready to be written or read,
+		so producers and consumers only contend on their own position counter.
+		Capacity is rounded up to a power of two.
+	*/
+	template <typename T> class mpmcQueue {
+	private:
+		struct cell_t {
+			std::atomic<size_t> sequence;
+			T value;
+		};
+
+		std::unique_ptr<cell_t[]> cells;
+		size_t mask;
+		//producer and consumer positions are kept on separate cache lines
+		char padding1[64];
+		std::atomic<size_t> enqueuePosition;
+		char padding2[64];
+		std::atomic<size_t> dequeuePosition;
+		char padding3[64];
+
+	public:
+		explicit mpmcQueue(size_t capacity){
+			size_t size = 2;
+			while (size < capacity){
+				size <<= 1;
+			}
+			cells.reset(new cell_t[size]);
+			mask = size - 1;
+			for (size_t index = 0; index < size; index++){
+				cells[index].sequence.store(index, std::memory_order_relaxed);
+			}
+			enqueuePosition.store(0, std::memory_order_relaxed);
+			dequeuePosition.store(0, std::memory_order_relaxed);
+		}
+
+		mpmcQueue(const mpmcQueue &) = delete;
+		mpmcQueue & operator=(const mpmcQueue &) = delete;
+
+		//returns false if the queue is full
+		bool push(const T & value){
+			size_t position = enqueuePosition.load(std::memory_order_relaxed);
+			cell_t * cell;
+			while (true){
+				cell = &cells[position & mask];
+				size_t sequence = cell->sequence.load(std::memory_order_acquire);
+				intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+				if (difference == 0){
+					if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)){
+						break;
+					}
+				}else if (difference < 0){
+					return false;
+				}else{
+					position = enqueuePosition.load(std::memory_order_relaxed);
+				}
+			}
+			cell->value = value;
+			cell->sequence.store(position + 1, std::memory_order_release);
+			return true;
+		}
+
+		//returns false if the queue is empty
+		bool pop(T & value){
+			size_t position = dequeuePosition.load(std::memory_order_relaxed);
+			cell_t * cell;
+			while (true){
+				cell = &cells[position & mask];
+				size_t sequence = cell->sequence.load(std::memory_order_acquire);
+				intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+				if (difference == 0){
+					if (dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)){
+						break;
+					}
+				}else if (difference < 0){
+					return false;
+				}else{
+					position = dequeuePosition.load(std::memory_order_relaxed);
+				}
+			}
+			value = std::move(cell->value);
+			cell->sequence.store(position + mask + 1, std::memory_order_release);
+			return true;
+		}
+
+		//approximate number of queued items
+		size_t size() const {
+			size_t enqueued = enqueuePosition.load(std::memory_order_relaxed);
+			size_t dequeued = dequeuePosition.load(std::memory_order_relaxed);
+			return (enqueued > dequeued) ? (enqueued - dequeued) : 0;
+		}
+
+		size_t capacity() const {
+			return mask + 1;
+		}
+	};
+};
+
+#endif
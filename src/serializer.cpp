@@ -0,0 +1,449 @@
+/*
+	LuaZMQ - Lua binding for ZeroMQ library
+
+	Copyright 2013, 2014, 2015 Mário Kašuba
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are
+	met:
+
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+	"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+	A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+	OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+	SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+	LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "common.h"
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "serializer.h"
+#include "shared.h"
+
+namespace LuaZMQ {
+	/*
+		Buffer layout: 32-bit value count followed by values. Every value starts with a tag byte.
+		Strings and functions store 32-bit length and raw bytes, numbers store LUA_NUMBER as is.
+		Tables store key-value pairs terminated by VALUE_TABLE_END. Tables are numbered in encoding
+		order so that repeated or cyclic references are stored as VALUE_TABLE_REF with table number.
+		The buffer is meant for Lua states inside the same process only.
+		Shared objects (channels, queues, ...) store object and type pointers. The written buffer owns
+		a reference of every shared object, so objects stay alive until the buffer is decoded
+		even if the sending state collects them. Buffer owner drops these references with lua_zmqReleaseValues.
+	*/
+	enum valueTag_t {
+		VALUE_NIL = 0,
+		VALUE_FALSE,
+		VALUE_TRUE,
+		VALUE_NUMBER,
+		VALUE_STRING,
+		VALUE_FUNCTION,
+		VALUE_TABLE,
+		VALUE_TABLE_REF,
+		VALUE_TABLE_END,
+		VALUE_LIGHTUSERDATA,
+		VALUE_USERDATA,
+		VALUE_SHARED,
+	};
+
+	const int maxValueDepth = 200;
+
+	struct valueDecoder_t {
+		const char * data;
+		size_t size;
+		size_t position;
+		int tablesIndex;
+		int nextTable;
+		int depth;
+		bool trusted;
+	};
+
+	static void lua_zmqEncodeWrite(valueEncoder_t & encoder, const void * data, size_t size){
+		if (encoder.output && (size > 0)){
+			memcpy(encoder.output + encoder.position, data, size);
+		}
+		encoder.position += size;
+	}
+
+	static void lua_zmqEncodeTag(valueEncoder_t & encoder, unsigned char tag){
+		lua_zmqEncodeWrite(encoder, &tag, sizeof(tag));
+	}
+
+	static void lua_zmqEncodeBytes(valueEncoder_t & encoder, unsigned char tag, const char * data, size_t size){
+		uint32_t length = static_cast<uint32_t>(size);
+		lua_zmqEncodeTag(encoder, tag);
+		lua_zmqEncodeWrite(encoder, &length, sizeof(length));
+		lua_zmqEncodeWrite(encoder, data, size);
+	}
+
+	static bool lua_zmqEncodeValue(lutok2::State & state, int index, valueEncoder_t & encoder, std::string & error){
+		Stack * stack = state.stack;
+
+		switch (stack->type(index)){
+			case LUA_TBOOLEAN:
+				lua_zmqEncodeTag(encoder, stack->to<bool>(index) ? VALUE_TRUE : VALUE_FALSE);
+				break;
+			case LUA_TNUMBER: {
+				LUA_NUMBER value = stack->to<LUA_NUMBER>(index);
+				lua_zmqEncodeTag(encoder, VALUE_NUMBER);
+				lua_zmqEncodeWrite(encoder, &value, sizeof(value));
+				break;
+			}
+			case LUA_TSTRING: {
+				size_t length = stack->objLen(index);
+				if (length > UINT32_MAX){
+					error = "string is too long";
+					return false;
+				}
+				lua_zmqEncodeBytes(encoder, VALUE_STRING, stack->to<const char *>(index), length);
+				break;
+			}
+			case LUA_TFUNCTION: {
+				//C functions can't be dumped and they're passed as nil
+				if (!encoder.output){
+					std::string code;
+					try{
+						code = stack->dumpFunction(index);
+					}catch (std::exception &){
+						code.clear();
+					}
+					encoder.functions.push_back(code);
+				}
+				const std::string & code = encoder.functions[encoder.nextFunction++];
+				if (code.empty()){
+					lua_zmqEncodeTag(encoder, VALUE_NIL);
+				}else{
+					lua_zmqEncodeBytes(encoder, VALUE_FUNCTION, code.c_str(), code.length());
+				}
+				break;
+			}
+			case LUA_TTABLE: {
+				stack->pushValue(index);
+				stack->getTable(encoder.tablesIndex);
+				if (stack->is<LUA_TNUMBER>(-1)){
+					uint32_t id = static_cast<uint32_t>(stack->to<int>(-1));
+					stack->pop(1);
+					lua_zmqEncodeTag(encoder, VALUE_TABLE_REF);
+					lua_zmqEncodeWrite(encoder, &id, sizeof(id));
+					break;
+				}
+				stack->pop(1);
+
+				if ((encoder.depth >= maxValueDepth) || !stack->checkStack(LUA_MINSTACK)){
+					error = "table nesting is too deep";
+					return false;
+				}
+				stack->pushValue(index);
+				stack->push<int>(static_cast<int>(encoder.nextTable++));
+				stack->setTable(encoder.tablesIndex);
+
+				lua_zmqEncodeTag(encoder, VALUE_TABLE);
+				encoder.depth++;
+				stack->pushNil();
+				while (stack->next(index)){
+					int top = stack->getTop();
+					if (!lua_zmqEncodeValue(state, top - 1, encoder, error) || !lua_zmqEncodeValue(state, top, encoder, error)){
+						stack->pop(2);
+						return false;
+					}
+					stack->pop(1);
+				}
+				encoder.depth--;
+				lua_zmqEncodeTag(encoder, VALUE_TABLE_END);
+				break;
+			}
+			case LUA_TLIGHTUSERDATA: {
+				intptr_t pointer = reinterpret_cast<intptr_t>(stack->to<void*>(index));
+				lua_zmqEncodeTag(encoder, VALUE_LIGHTUSERDATA);
+				lua_zmqEncodeWrite(encoder, &pointer, sizeof(pointer));
+				break;
+			}
+			case LUA_TUSERDATA: {
+				sharedObject_t * shared = lua_zmqToSharedObject(state, index);
+				if (shared && shared->object){
+					//reference is taken only once, in the writing pass
+					if (encoder.output){
+						lua_zmqSharedObjectAcquireEncoded(shared->object, shared->type);
+					}
+					lua_zmqEncodeTag(encoder, VALUE_SHARED);
+					lua_zmqEncodeWrite(encoder, &shared->object, sizeof(shared->object));
+					lua_zmqEncodeWrite(encoder, &shared->type, sizeof(shared->type));
+					break;
+				}
+				intptr_t pointer = reinterpret_cast<intptr_t>(getZMQobject(index));
+				lua_zmqEncodeTag(encoder, VALUE_USERDATA);
+				lua_zmqEncodeWrite(encoder, &pointer, sizeof(pointer));
+				break;
+			}
+				//set nil for unsupported type
+			case LUA_TNIL:
+			default:
+				lua_zmqEncodeTag(encoder, VALUE_NIL);
+				break;
+		}
+		return true;
+	}
+
+	size_t lua_zmqEncodeValues(lutok2::State & state, int first, int count, valueEncoder_t & encoder, std::string & error){
+		Stack * stack = state.stack;
+		uint32_t outCount = static_cast<uint32_t>(count);
+		bool ok = true;
+
+		encoder.position = 0;
+		encoder.nextFunction = 0;
+		encoder.nextTable = 0;
+		encoder.depth = 0;
+		if (!encoder.output){
+			encoder.functions.clear();
+		}
+
+		stack->newTable();
+		encoder.tablesIndex = stack->getTop();
+
+		lua_zmqEncodeWrite(encoder, &outCount, sizeof(outCount));
+		for (int index = first; ok && (index < first + count); index++){
+			ok = lua_zmqEncodeValue(state, index, encoder, error);
+		}
+		stack->pop(1);
+		return (ok) ? encoder.position : 0;
+	}
+
+	bool lua_zmqEncodeValuesToString(lutok2::State & state, int first, int count, std::string & buffer, std::string & error){
+		valueEncoder_t encoder;
+		encoder.output = nullptr;
+
+		size_t size = lua_zmqEncodeValues(state, first, count, encoder, error);
+		if (size == 0){
+			return false;
+		}
+		buffer.resize(size);
+		encoder.output = &buffer[0];
+		return (lua_zmqEncodeValues(state, first, count, encoder, error) == size);
+	}
+
+	static bool lua_zmqDecodeRead(valueDecoder_t & decoder, void * data, size_t size){
+		if ((decoder.size - decoder.position) < size){
+			return false;
+		}
+		memcpy(data, decoder.data + decoder.position, size);
+		decoder.position += size;
+		return true;
+	}
+
+	//pushes exactly one value on success and nothing on failure
+	static bool lua_zmqDecodeValue(lutok2::State & state, valueDecoder_t & decoder){
+		Stack * stack = state.stack;
+		unsigned char tag = 0;
+
+		if (!lua_zmqDecodeRead(decoder, &tag, sizeof(tag))){
+			return false;
+		}
+		if (!decoder.trusted && ((tag == VALUE_FUNCTION) || (tag == VALUE_LIGHTUSERDATA) || (tag == VALUE_USERDATA) || (tag == VALUE_SHARED))){
+			return false;
+		}
+
+		switch (tag){
+			case VALUE_NIL:
+				stack->pushNil();
+				break;
+			case VALUE_FALSE:
+			case VALUE_TRUE:
+				stack->push<bool>(tag == VALUE_TRUE);
+				break;
+			case VALUE_NUMBER: {
+				LUA_NUMBER value;
+				if (!lua_zmqDecodeRead(decoder, &value, sizeof(value))){
+					return false;
+				}
+				stack->push<LUA_NUMBER>(value);
+				break;
+			}
+			case VALUE_STRING:
+			case VALUE_FUNCTION: {
+				uint32_t length = 0;
+				if (!lua_zmqDecodeRead(decoder, &length, sizeof(length)) || ((decoder.size - decoder.position) < length)){
+					return false;
+				}
+				const char * data = decoder.data + decoder.position;
+				decoder.position += length;
+				if (tag == VALUE_STRING){
+					stack->pushLString(data, length);
+				}else{
+					try{
+						state.loadString(std::string(data, length));
+					}catch (std::exception &){
+						return false;
+					}
+				}
+				break;
+			}
+			case VALUE_TABLE: {
+				if ((decoder.depth >= maxValueDepth) || !stack->checkStack(LUA_MINSTACK)){
+					return false;
+				}
+				stack->newTable();
+				stack->push<int>(decoder.nextTable++);
+				stack->pushValue(-2);
+				stack->setTable(decoder.tablesIndex);
+
+				decoder.depth++;
+				while (true){
+					if (decoder.position >= decoder.size){
+						stack->pop(1);
+						return false;
+					}
+					if (decoder.data[decoder.position] == VALUE_TABLE_END){
+						decoder.position++;
+						break;
+					}
+					if (!lua_zmqDecodeValue(state, decoder)){
+						stack->pop(1);
+						return false;
+					}
+					if (!lua_zmqDecodeValue(state, decoder)){
+						stack->pop(2);
+						return false;
+					}
+					//nil and NaN keys can't come from a valid buffer
+					if (stack->is<LUA_TNIL>(-2) || (stack->is<LUA_TNUMBER>(-2) && (stack->to<LUA_NUMBER>(-2) != stack->to<LUA_NUMBER>(-2)))){
+						stack->pop(3);
+						return false;
+					}
+					stack->setTable(-3);
+				}
+				decoder.depth--;
+				break;
+			}
+			case VALUE_TABLE_REF: {
+				uint32_t id = 0;
+				if (!lua_zmqDecodeRead(decoder, &id, sizeof(id)) || (id >= static_cast<uint32_t>(decoder.nextTable))){
+					return false;
+				}
+				stack->push<int>(static_cast<int>(id));
+				stack->getTable(decoder.tablesIndex);
+				break;
+			}
+			case VALUE_LIGHTUSERDATA:
+			case VALUE_USERDATA: {
+				intptr_t pointer = 0;
+				if (!lua_zmqDecodeRead(decoder, &pointer, sizeof(pointer))){
+					return false;
+				}
+				if (tag == VALUE_LIGHTUSERDATA){
+					stack->push<void*>(reinterpret_cast<void*>(pointer));
+				}else{
+					pushUData(reinterpret_cast<void*>(pointer));
+				}
+				break;
+			}
+			case VALUE_SHARED: {
+				void * object = nullptr;
+				const sharedObjectType_t * type = nullptr;
+				if (!lua_zmqDecodeRead(decoder, &object, sizeof(object)) || !lua_zmqDecodeRead(decoder, &type, sizeof(type))){
+					return false;
+				}
+				type->acquire(object);
+				lua_zmqPushSharedObject(state, object, type);
+				break;
+			}
+			default:
+				return false;
+		}
+		return true;
+	}
+
+	int lua_zmqDecodeValues(lutok2::State & state, const char * data, size_t size, bool trusted){
+		Stack * stack = state.stack;
+		valueDecoder_t decoder;
+		uint32_t count = 0;
+
+		decoder.data = data;
+		decoder.size = size;
+		decoder.position = 0;
+		decoder.nextTable = 0;
+		decoder.depth = 0;
+		decoder.trusted = trusted;
+
+		//every value takes at least one byte
+		if (!lua_zmqDecodeRead(decoder, &count, sizeof(count)) || (count > (size - decoder.position)) || !stack->checkStack(static_cast<int>(count) + LUA_MINSTACK)){
+			return -1;
+		}
+
+		stack->newTable();
+		decoder.tablesIndex = stack->getTop();
+
+		for (uint32_t index = 0; index < count; index++){
+			if (!lua_zmqDecodeValue(state, decoder)){
+				stack->pop(stack->getTop() - decoder.tablesIndex + 1);
+				return -1;
+			}
+		}
+		stack->remove(decoder.tablesIndex);
+		return static_cast<int>(count);
+	}
+
+	void lua_zmqReleaseValues(const char * data, size_t size){
+		valueDecoder_t decoder;
+		decoder.data = data;
+		decoder.size = size;
+		decoder.position = sizeof(uint32_t);
+
+		//values are stored as a flat sequence of tags, table contents included
+		while (decoder.position < decoder.size){
+			unsigned char tag = static_cast<unsigned char>(decoder.data[decoder.position++]);
+			size_t skip = 0;
+			switch (tag){
+				case VALUE_NUMBER:
+					skip = sizeof(LUA_NUMBER);
+					break;
+				case VALUE_STRING:
+				case VALUE_FUNCTION: {
+					uint32_t length = 0;
+					if (!lua_zmqDecodeRead(decoder, &length, sizeof(length))){
+						return;
+					}
+					skip = length;
+					break;
+				}
+				case VALUE_TABLE_REF:
+					skip = sizeof(uint32_t);
+					break;
+				case VALUE_LIGHTUSERDATA:
+				case VALUE_USERDATA:
+					skip = sizeof(intptr_t);
+					break;
+				case VALUE_SHARED: {
+					void * object = nullptr;
+					const sharedObjectType_t * type = nullptr;
+					if (!lua_zmqDecodeRead(decoder, &object, sizeof(object)) || !lua_zmqDecodeRead(decoder, &type, sizeof(type))){
+						return;
+					}
+					//unknown references (forged or already released) are skipped
+					lua_zmqSharedObjectReleaseEncoded(object, type);
+					break;
+				}
+				default:
+					break;
+			}
+			if ((decoder.size - decoder.position) < skip){
+				return;
+			}
+			decoder.position += skip;
+		}
+	}
+};
@@ -0,0 +1,50 @@
+#ifndef LUAZMQ_SERIALIZER_H
+#define LUAZMQ_SERIALIZER_H
+
+#include <string>
+#include <vector>
+
+namespace LuaZMQ {
+	/*
+		Compact binary encoding of Lua values used to pass arguments between Lua states.
+		Supported types: nil, boolean, number, string, Lua function (bytecode),
+		light userdata, object userdata (pointer only), shared objects and tables with nested
+		and cyclic references. Other values are encoded as nil.
+	*/
+	struct valueEncoder_t {
+		//output buffer, nullptr while measuring the encoded size
+		char * output;
+		size_t position;
+		//function dumps made while measuring are reused when writing
+		std::vector<std::string> functions;
+		size_t nextFunction;
+		//stack index of the table with already encoded tables
+		int tablesIndex;
+		unsigned int nextTable;
+		int depth;
+	};
+
+	/*
+		Encodes count values starting at stack index first.
+		Returns encoded size, or 0 and error message on failure (e.g. nesting too deep).
+		The first call with a null output only measures. The second call writes into output
+		which must have at least the measured size.
+	*/
+	size_t lua_zmqEncodeValues(lutok2::State & state, int first, int count, valueEncoder_t & encoder, std::string & error);
+	//measures and encodes values into a string buffer
+	bool lua_zmqEncodeValuesToString(lutok2::State & state, int first, int count, std::string & buffer, std::string & error);
+	/*
+		Decodes and pushes all values from buffer.
+		Returns the number of pushed values or -1 if the buffer is malformed.
+		Functions and userdata pointers are accepted only from trusted buffers.
+	*/
+	int lua_zmqDecodeValues(lutok2::State & state, const char * data, size_t size, bool trusted = true);
+	/*
+		Drops references of shared objects (channels, queues, ...) held by an encoded buffer.
+		Call it once when the buffer won't be decoded anymore, decoded values hold their own references.
+		Only references taken by the encoder are dropped, so buffers from untrusted peers are safe too.
+	*/
+	void lua_zmqReleaseValues(const char * data, size_t size);
+};
+
+#endif
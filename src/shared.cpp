@@ -0,0 +1,99 @@
+/*
+	LuaZMQ - Lua binding for ZeroMQ library
+
+	Copyright 2013, 2014, 2015 Mário Kašuba
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are
+	met:
+
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+	"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+	A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+	OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+	SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+	LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "common.h"
+#include <mutex>
+#include <unordered_map>
+#include "shared.h"
+
+namespace LuaZMQ {
+	const uint32_t sharedObjectMagic = 0x4c5a5348;
+
+	//references held by encoded buffers which haven't been decoded or released yet
+	static std::mutex encodedMutex;
+	static std::unordered_multimap<void *, const sharedObjectType_t *> encoded;
+
+	void lua_zmqPushSharedObject(lutok2::State & state, void * object, const sharedObjectType_t * type){
+		Stack * stack = state.stack;
+		sharedObject_t * shared = static_cast<sharedObject_t *>(stack->newUserData(sizeof(sharedObject_t)));
+		shared->object = object;
+		shared->type = type;
+		shared->magic = sharedObjectMagic;
+		//every object gets its own metatable, zmq.lua wrappers set __index on it
+		Module metamethods;
+		metamethods["__gc"] = lua_zmqSharedObjectFree;
+		stack->newTable();
+		state.registerLib(metamethods);
+		stack->setMetatable();
+	}
+
+	sharedObject_t * lua_zmqToSharedObject(lutok2::State & state, int index){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(index) && (stack->objLen(index) == sizeof(sharedObject_t))){
+			sharedObject_t * shared = static_cast<sharedObject_t *>(stack->to<void*>(index));
+			if (shared->magic == sharedObjectMagic){
+				return shared;
+			}
+		}
+		return nullptr;
+	}
+
+	int lua_zmqSharedObjectFree(lutok2::State & state){
+		sharedObject_t * shared = lua_zmqToSharedObject(state, 1);
+		if (shared && shared->object){
+			void * object = shared->object;
+			shared->object = nullptr;
+			shared->type->release(object);
+		}
+		return 0;
+	}
+
+	void lua_zmqSharedObjectAcquireEncoded(void * object, const sharedObjectType_t * type){
+		type->acquire(object);
+		std::lock_guard<std::mutex> lock(encodedMutex);
+		encoded.emplace(object, type);
+	}
+
+	bool lua_zmqSharedObjectReleaseEncoded(void * object, const sharedObjectType_t * type){
+		{
+			std::lock_guard<std::mutex> lock(encodedMutex);
+			auto range = encoded.equal_range(object);
+			auto iter = range.first;
+			while ((iter != range.second) && (iter->second != type)){
+				++iter;
+			}
+			if (iter == range.second){
+				return false;
+			}
+			encoded.erase(iter);
+		}
+		type->release(object);
+		return true;
+	}
+};
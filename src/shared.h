@@ -0,0 +1,69 @@
+/*
+	LuaZMQ - Lua binding for ZeroMQ library
+
+	Copyright 2013, 2014, 2015 Mário Kašuba
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are
+	met:
+
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+	"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+	A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+	OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+	SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+	LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef LUAZMQ_SHARED_H
+#define LUAZMQ_SHARED_H
+
+#include <stdint.h>
+
+namespace LuaZMQ {
+	/*
+		Reference counted objects which can be passed between Lua states (channels, queues,
+		histograms, proxy statistics). Encoding such object with the value serializer takes
+		a reference for the receiving state, decoding hands it over to the new userdata.
+	*/
+	struct sharedObjectType_t {
+		void (*acquire)(void * object);
+		void (*release)(void * object);
+	};
+
+	//object pointer comes first, so getZMQobject works on shared objects
+	struct sharedObject_t {
+		void * object;
+		const sharedObjectType_t * type;
+		uint32_t magic;
+	};
+
+	//pushes userdata which owns one reference of object, it's released by __gc or lua_zmqSharedObjectFree
+	void lua_zmqPushSharedObject(lutok2::State & state, void * object, const sharedObjectType_t * type);
+	//returns shared object at index or nullptr for other values
+	sharedObject_t * lua_zmqToSharedObject(lutok2::State & state, int index);
+	//releases the reference held by userdata at index, later calls do nothing
+	int lua_zmqSharedObjectFree(lutok2::State & state);
+
+	/*
+		References taken for encoded buffers are recorded, so a buffer can only release references
+		which were really handed out, even if it came from an untrusted peer.
+	*/
+	void lua_zmqSharedObjectAcquireEncoded(void * object, const sharedObjectType_t * type);
+	//releases one recorded reference, returns false if there's no such reference
+	bool lua_zmqSharedObjectReleaseEncoded(void * object, const sharedObjectType_t * type);
+};
+
+#endif
@@ -0,0 +1,262 @@
+/*
+	LuaZMQ - Lua binding for ZeroMQ library
+
+	Copyright 2013, 2014, 2015 Mário Kašuba
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are
+	met:
+
+	* Redistributions of source code must retain the above copyright
+	  notice, this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright
+	  notice, this list of conditions and the following disclaimer in the
+	  documentation and/or other materials provided with the distribution.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+	"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+	A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+	OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+	SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+	LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+	DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+	THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+	(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "common.h"
+#include <atomic>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <stdint.h>
+#include "main.h"
+#include "stats.h"
+#include "histogram.h"
+
+namespace LuaZMQ {
+	std::atomic<unsigned int> socketInstrumentation(0);
+	//number of sockets with a latency histogram
+	size_t socketLatencyHooks = 0;
+
+	/*
+		Open addressing table with linear probing. Lookups are lock-free,
+		registration and removal are serialized with a mutex.
+	*/
+	const size_t socketStatsCapacity = 4096;
+	//marks a slot of a closed socket, lookups continue past it
+	void * const socketStatsRemoved = reinterpret_cast<void *>(1);
+
+	socketStats_t socketStatsTable[socketStatsCapacity];
+	std::mutex socketStatsMutex;
+
+	static size_t lua_zmqSocketStatsHash(void * socket){
+		uintptr_t value = reinterpret_cast<uintptr_t>(socket);
+		//socket objects are aligned, drop low bits before mixing
+		value = (value >> 4) * 0x9E3779B1u;
+		return static_cast<size_t>(value) & (socketStatsCapacity - 1);
+	}
+
+	static void lua_zmqSocketStatsClear(socketStats_t & stats){
+		for (int direction = 0; direction < 2; direction++){
+			socketStatsDirection_s & d = stats.directions[direction];
+			d.messages.store(0, std::memory_order_relaxed);
+			d.bytes.store(0, std::memory_order_relaxed);
+			d.eagain.store(0, std::memory_order_relaxed);
+			d.blocked.store(0, std::memory_order_relaxed);
+		}
+		stats.sent.store(0, std::memory_order_relaxed);
+	}
+
+	//replaces latency histogram of a socket, must be called with locked socketStatsMutex
+	static void lua_zmqSocketStatsSetLatency(socketStats_t & stats, histogram_t * histogram){
+		if (histogram){
+			histogram->references++;
+			socketLatencyHooks++;
+		}
+		histogram_t * previous = stats.latency.exchange(histogram);
+		if (previous){
+			//wait for probes which may still record into the previous histogram
+			while (stats.recording.load() != 0){
+				std::this_thread::yield();
+			}
+			lua_zmqHistogramRelease(previous);
+			socketLatencyHooks--;
+		}
+		stats.sent.store(0, std::memory_order_relaxed);
+		if (socketLatencyHooks > 0){
+			socketInstrumentation.fetch_or(SOCKET_INSTRUMENT_LATENCY);
+		}else{
+			socketInstrumentation.fetch_and(~static_cast<unsigned int>(SOCKET_INSTRUMENT_LATENCY));
+		}
+	}
+
+	socketStats_t * lua_zmqSocketStatsFind(void * socket){
+		//empty slots hold a null socket
+		if (!socket){
+			return nullptr;
+		}
+		size_t start = lua_zmqSocketStatsHash(socket);
+		for (size_t probe = 0; probe < socketStatsCapacity; probe++){
+			socketStats_t & stats = socketStatsTable[(start + probe) & (socketStatsCapacity - 1)];
+			void * key = stats.socket.load(std::memory_order_acquire);
+			if (key == socket){
+				return &stats;
+			}else if (key == nullptr){
+				break;
+			}
+		}
+		return nullptr;
+	}
+
+	socketStats_t * lua_zmqSocketStatsGet(void * socket){
+		socketStats_t * stats = lua_zmqSocketStatsFind(socket);
+		if (stats || !socket){
+			return stats;
+		}
+
+		std::lock_guard<std::mutex> lock(socketStatsMutex);
+		stats = lua_zmqSocketStatsFind(socket);
+		if (stats){
+			return stats;
+		}
+		size_t start = lua_zmqSocketStatsHash(socket);
+		for (size_t probe = 0; probe < socketStatsCapacity; probe++){
+			socketStats_t & slot = socketStatsTable[(start + probe) & (socketStatsCapacity - 1)];
+			void * key = slot.socket.load(std::memory_order_relaxed);
+			if ((key == nullptr) || (key == socketStatsRemoved)){
+				lua_zmqSocketStatsClear(slot);
+				slot.latency.store(nullptr, std::memory_order_relaxed);
+				slot.socket.store(socket, std::memory_order_release);
+				return &slot;
+			}
+		}
+		return nullptr;
+	}
+
+	void lua_zmqSocketStatsForget(void * socket){
+		std::lock_guard<std::mutex> lock(socketStatsMutex);
+		socketStats_t * stats = lua_zmqSocketStatsFind(socket);
+		if (stats){
+			lua_zmqSocketStatsSetLatency(*stats, nullptr);
+			stats->socket.store(socketStatsRemoved, std::memory_order_release);
+		}
+	}
+
+	static void lua_zmqSocketStatsPush(lutok2::State & state, const socketStats_t & stats){
+		Stack * stack = state.stack;
+		const char * names[2] = {"sent", "received"};
+		stack->newTable();
+		for (int direction = 0; direction < 2; direction++){
+			const socketStatsDirection_s & d = stats.directions[direction];
+			stack->push<const std::string &>(names[direction]);
+			stack->newTable();
+			stack->setField<LUA_NUMBER>("messages", static_cast<LUA_NUMBER>(d.messages.load(std::memory_order_relaxed)));
+			stack->setField<LUA_NUMBER>("bytes", static_cast<LUA_NUMBER>(d.bytes.load(std::memory_order_relaxed)));
+			stack->setField<LUA_NUMBER>("eagain", static_cast<LUA_NUMBER>(d.eagain.load(std::memory_order_relaxed)));
+			//blocked time in seconds
+			stack->setField<LUA_NUMBER>("blocked", static_cast<LUA_NUMBER>(d.blocked.load(std::memory_order_relaxed)) / 1e9);
+			stack->setTable();
+		}
+	}
+
+	static const std::string lua_zmqSocketStatsID(void * socket){
+		std::stringstream id;
+		id << socket;
+		return id.str();
+	}
+
+	/*
+		Enables or disables counting in all sockets: statsEnable(boolean)
+		Returns previous state.
+	*/
+	int lua_zmqStatsEnable(lutok2::State & state){
+		Stack * stack = state.stack;
+		bool enable = true;
+		if (stack->is<LUA_TBOOLEAN>(1)){
+			enable = stack->to<bool>(1);
+		}
+		unsigned int previous = enable ? socketInstrumentation.fetch_or(SOCKET_INSTRUMENT_COUNTERS) :
+			socketInstrumentation.fetch_and(~static_cast<unsigned int>(SOCKET_INSTRUMENT_COUNTERS));
+		stack->push<bool>((previous & SOCKET_INSTRUMENT_COUNTERS) != 0);
+		return 1;
+	}
+
+	//counters of one socket or nil if nothing was counted yet
+	int lua_zmqSocketStatsLua(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			void * socket = getZMQobject(1);
+			socketStats_t * stats = lua_zmqSocketStatsFind(socket);
+			if (!stats){
+				return 0;
+			}
+			lua_zmqSocketStatsPush(state, *stats);
+			stack->setField<const std::string &>("id", lua_zmqSocketStatsID(socket));
+			return 1;
+		}
+		return 0;
+	}
+
+	/*
+		Snapshot of all counted sockets: {enabled = boolean, sockets = {[id] = {sent = {...}, received = {...}}}}
+		Socket id is the same as in socket.stats().id
+	*/
+	int lua_zmqStats(lutok2::State & state){
+		Stack * stack = state.stack;
+		stack->newTable();
+		stack->setField<bool>("enabled", (socketInstrumentation.load(std::memory_order_relaxed) & SOCKET_INSTRUMENT_COUNTERS) != 0);
+		stack->push<const std::string &>("sockets");
+		stack->newTable();
+		for (size_t index = 0; index < socketStatsCapacity; index++){
+			const socketStats_t & stats = socketStatsTable[index];
+			void * socket = stats.socket.load(std::memory_order_acquire);
+			if ((socket != nullptr) && (socket != socketStatsRemoved)){
+				stack->push<const std::string &>(lua_zmqSocketStatsID(socket));
+				lua_zmqSocketStatsPush(state, stats);
+				stack->setTable();
+			}
+		}
+		stack->setTable();
+		return 1;
+	}
+
+	/*
+		Records round trip latency of a socket into a histogram: socketRecordLatency(socket, histogram)
+		Time is measured in nanoseconds from a complete sent message to the next complete received message,
+		which fits REQ and DEALER sockets. Histogram is detached with nil or when the socket is closed.
+	*/
+	int lua_zmqSocketRecordLatency(lutok2::State & state){
+		Stack * stack = state.stack;
+		if (stack->is<LUA_TUSERDATA>(1)){
+			void * socket = getZMQobject(1);
+			histogram_t * histogram = nullptr;
+			if (stack->is<LUA_TUSERDATA>(2)){
+				histogram = static_cast<histogram_t *>(getZMQobject(2));
+			}
+			socketStats_t * stats = lua_zmqSocketStatsGet(socket);
+			if (!stats){
+				stack->push<bool>(false);
+				stack->push<const std::string &>("too many instrumented sockets");
+				return 2;
+			}
+			std::lock_guard<std::mutex> lock(socketStatsMutex);
+			lua_zmqSocketStatsSetLatency(*stats, histogram);
+			stack->push<bool>(true);
+			return 1;
+		}
+		return 0;
+	}
+
+	//resets counters of all sockets
+	int lua_zmqStatsReset(lutok2::State & state){
+		std::lock_guard<std::mutex> lock(socketStatsMutex);
+		for (size_t index = 0; index < socketStatsCapacity; index++){
+			lua_zmqSocketStatsClear(socketStatsTable[index]);
+		}
+		return 0;
+	}
+};
@@ -0,0 +1,132 @@
+#ifndef LUAZMQ_STATS_H
+#define LUAZMQ_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <errno.h>
+#include "histogram.h"
+
+namespace LuaZMQ {
+	/*
+		Optional per-socket counters of send and receive functions.
+		Counting is disabled by default, disabled counting costs one relaxed atomic load per call.
+		The same entries hold latency histograms which record send to receive round trips.
+		Counters are kept in a fixed process-wide table indexed by socket pointer,
+		so sockets passed between Lua states share their counters.
+	*/
+	enum socketStatsDirection_t {
+		SOCKET_STATS_SEND = 0,
+		SOCKET_STATS_RECV = 1,
+	};
+
+	struct socketStatsDirection_s {
+		std::atomic<uint64_t> messages;
+		std::atomic<uint64_t> bytes;
+		std::atomic<uint64_t> eagain;
+		//time spent in blocking calls in nanoseconds
+		std::atomic<uint64_t> blocked;
+	};
+
+	struct socketStats_t {
+		std::atomic<void *> socket;
+		socketStatsDirection_s directions[2];
+		//round trip histogram and the time of the last sent message in nanoseconds
+		std::atomic<histogram_t *> latency;
+		std::atomic<uint64_t> sent;
+		//probes recording into the latency histogram, it's released only when there are none
+		std::atomic<int> recording;
+	};
+
+	enum socketInstrumentation_t {
+		SOCKET_INSTRUMENT_COUNTERS = 1,
+		SOCKET_INSTRUMENT_LATENCY = 2,
+	};
+
+	//combination of socketInstrumentation_t flags, 0 if nothing is recorded
+	extern std::atomic<unsigned int> socketInstrumentation;
+
+	//finds counters of a socket without registering it
+	socketStats_t * lua_zmqSocketStatsFind(void * socket);
+	//finds or registers counters of a socket, returns nullptr if the table is full
+	socketStats_t * lua_zmqSocketStatsGet(void * socket);
+	//releases counters of a closed socket
+	void lua_zmqSocketStatsForget(void * socket);
+
+	struct socketStatsProbe_t {
+		socketStats_t * stats;
+		bool counters;
+		bool blocking;
+		bool latency;
+		std::chrono::steady_clock::time_point start;
+	};
+
+	inline void lua_zmqStatsBegin(socketStatsProbe_t & probe, void * socket, int flags){
+		probe.stats = nullptr;
+		unsigned int mode = socketInstrumentation.load(std::memory_order_relaxed);
+		if (mode != 0){
+			probe.counters = ((mode & SOCKET_INSTRUMENT_COUNTERS) != 0);
+			//latency alone doesn't register sockets, the ones with a histogram are registered already
+			probe.stats = probe.counters ? lua_zmqSocketStatsGet(socket) : lua_zmqSocketStatsFind(socket);
+			if (probe.stats){
+				probe.blocking = probe.counters && ((flags & ZMQ_DONTWAIT) == 0);
+				probe.latency = (probe.stats->latency.load(std::memory_order_relaxed) != nullptr);
+				if (probe.blocking){
+					probe.start = std::chrono::steady_clock::now();
+				}
+			}
+		}
+	}
+
+	//result is the result of the last zmq call, errno is read on failure
+	inline void lua_zmqStatsEnd(socketStatsProbe_t & probe, socketStatsDirection_t direction, int result, uint64_t messages, uint64_t bytes){
+		if (!probe.stats){
+			return;
+		}
+		int error = (result < 0) ? zmq_errno() : 0;
+		bool timed = probe.blocking || (probe.latency && (result >= 0) && (messages > 0));
+		std::chrono::steady_clock::time_point now;
+		if (timed){
+			now = std::chrono::steady_clock::now();
+		}
+
+		if (probe.counters){
+			socketStatsDirection_s & d = probe.stats->directions[direction];
+			if (result >= 0){
+				d.messages.fetch_add(messages, std::memory_order_relaxed);
+				d.bytes.fetch_add(bytes, std::memory_order_relaxed);
+			}else if (error == EAGAIN){
+				d.eagain.fetch_add(1, std::memory_order_relaxed);
+			}
+			if (probe.blocking){
+				uint64_t elapsed = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - probe.start).count());
+				d.blocked.fetch_add(elapsed, std::memory_order_relaxed);
+			}
+		}
+
+		//a complete sent message starts a round trip, the next complete received message ends it
+		if (probe.latency && (result >= 0) && (messages > 0)){
+			uint64_t timestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count());
+			if (direction == SOCKET_STATS_SEND){
+				probe.stats->sent.store(timestamp, std::memory_order_relaxed);
+			}else{
+				uint64_t sent = probe.stats->sent.exchange(0, std::memory_order_relaxed);
+				if (sent != 0){
+					//histogram is loaded again under the recording counter, it may have been replaced meanwhile
+					probe.stats->recording.fetch_add(1);
+					histogram_t * histogram = probe.stats->latency.load();
+					if (histogram){
+						lua_zmqHistogramRecord(histogram, timestamp - sent);
+					}
+					probe.stats->recording.fetch_sub(1);
+				}
+			}
+		}
+		//keep errno for error reporting
+		if (result < 0){
+			errno = error;
+		}
+	}
+};
+
+#endif
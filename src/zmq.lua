@@ -66,6 +66,17 @@ end
 
 local zmq = require 'luazmq'
 
+-- main chunk of this module, its bytecode is preloaded into new thread states
+local moduleChunk = debug and debug.getinfo and debug.getinfo(1, 'f').func
+local modulePreloaded = false
+
+local function preloadModule()
+	if not modulePreloaded and moduleChunk then
+		modulePreloaded = true
+		zmq.setPreload('zmq', moduleChunk)
+	end
+end
+
 local bit = tryRequire('bit') or tryRequire('bit32')
 local band
 
@@ -343,75 +354,95 @@ local context_options_types = {
     [constants.ZMQ_IPV6] =					'b',
 }
 
-local socket_options_types = {
-    [constants.ZMQ_AFFINITY] =				'i64',
-    [constants.ZMQ_IDENTITY] =				's',
-    [constants.ZMQ_SUBSCRIBE] =				's',
-    [constants.ZMQ_UNSUBSCRIBE] =			's',
-    [constants.ZMQ_RATE] =					'i',
-    [constants.ZMQ_RECOVERY_IVL] =			'i',
-    [constants.ZMQ_SNDBUF] =				'i',
-    [constants.ZMQ_RCVBUF] =				'i',
-    [constants.ZMQ_RCVMORE] =				'b',
-    [constants.ZMQ_FD] =					'iptr',
-    [constants.ZMQ_EVENTS] =				'i',
-    [constants.ZMQ_TYPE] =					'i',
-    [constants.ZMQ_LINGER] =				'i',
-    [constants.ZMQ_RECONNECT_IVL] =			'i',
-    [constants.ZMQ_BACKLOG] =				'i',
-    [constants.ZMQ_RECONNECT_IVL_MAX] =		'i',
-    [constants.ZMQ_MAXMSGSIZE] =			'i64',
-    [constants.ZMQ_SNDHWM] =				'i',
-    [constants.ZMQ_RCVHWM] =				'i',
-    [constants.ZMQ_MULTICAST_HOPS] =		'i',
-    [constants.ZMQ_RCVTIMEO] =				'i',
-    [constants.ZMQ_SNDTIMEO] =				'i',
-    [constants.ZMQ_LAST_ENDPOINT] =			's',
-    [constants.ZMQ_ROUTER_MANDATORY] =		'i',
-    [constants.ZMQ_TCP_KEEPALIVE] =			'i',
-    [constants.ZMQ_TCP_KEEPALIVE_CNT] =		'i',
-    [constants.ZMQ_TCP_KEEPALIVE_IDLE] =	'i',
-    [constants.ZMQ_TCP_KEEPALIVE_INTVL] =	'i',
-    [constants.ZMQ_TCP_ACCEPT_FILTER] =		's',
-    [constants.ZMQ_IMMEDIATE] =				'i',
-    [constants.ZMQ_XPUB_VERBOSE] =			'i',
-    [constants.ZMQ_ROUTER_RAW] =			'b',
-    [constants.ZMQ_IPV6] =					'b',
-    [constants.ZMQ_MECHANISM] =				'i',
-    [constants.ZMQ_PLAIN_SERVER] =			'b',
-    [constants.ZMQ_PLAIN_USERNAME] =		's',
-    [constants.ZMQ_PLAIN_PASSWORD] =		's',
-    [constants.ZMQ_CURVE_SERVER] =			'b',
-    [constants.ZMQ_CURVE_PUBLICKEY] =		's',
-    [constants.ZMQ_CURVE_SECRETKEY] =		's',
-    [constants.ZMQ_CURVE_SERVERKEY] =		's',
-    [constants.ZMQ_PROBE_ROUTER] =			'i',
-    [constants.ZMQ_REQ_CORRELATE] =			'b',
-    [constants.ZMQ_REQ_RELAXED] =			'b',
-    [constants.ZMQ_CONFLATE] =				'b',
-    [constants.ZMQ_ZAP_DOMAIN] =			's',
-    [constants.ZMQ_ROUTER_HANDOVER] =		'b',
-	[constants.ZMQ_TOS] =					'i',
-	[constants.ZMQ_CONNECT_RID] =			's',
-	[constants.ZMQ_GSSAPI_SERVER] =			'b',
-	[constants.ZMQ_GSSAPI_PRINCIPAL] =		's',
-	[constants.ZMQ_GSSAPI_SERVICE_PRINCIPAL] =	's',
-	[constants.ZMQ_GSSAPI_PLAINTEXT] =		'b',
-	[constants.ZMQ_HANDSHAKE_IVL] =			'i',
-	[constants.ZMQ_SOCKS_PROXY] =			's',
-	[constants.ZMQ_XPUB_NODROP] =			'b',
-	[constants.ZMQ_XPUB_MANUAL] =			'b',
-	[constants.ZMQ_XPUB_WELCOME_MSG] =		'b',
-	[constants.ZMQ_STREAM_NOTIFY] =			'b',
+--[[
+	Socket option ids by name (any case) or id, names are resolved by the binding on first use.
+	Unknown names are not cached.
+--]]
+local socket_option_ids = setmetatable({}, {
+	__index = function(t, name)
+		local id
+		if type(name) == 'number' or type(name) == 'string' then
+			id = zmq.socketOptionID(name)
+		end
+		if id then
+			rawset(t, name, id)
+		end
+		return id
+	end,
+})
+
+-- dedicated getters of read-only options polled in hot loops
+local socket_option_getters = {
+	[constants.ZMQ_RCVMORE] = zmq.socketRcvMore,
+	[constants.ZMQ_EVENTS] = zmq.socketEvents,
+	[constants.ZMQ_FD] = zmq.socketFD,
 }
 
 local setupSocket
+-- chunk size used only by the delimited sendMultipart format, receiving always uses true frame sizes
 local DEFAULT_BUFFER_SIZE = 4096
 
+-- used to create unique notification endpoints of thread pools
+local poolCounter = 0
+
 M.setBufferSize = function(value)
 	DEFAULT_BUFFER_SIZE = value
 end
 
+--[[
+	'delimited' - parts are split into DEFAULT_BUFFER_SIZE chunks and divided with empty frames (default)
+	'native' - each table element is sent as exactly one ZeroMQ frame
+--]]
+local MULTIPART_MODE = 'delimited'
+
+M.setMultipartMode = function(mode)
+	assert(mode == 'delimited' or mode == 'native', 'Unknown multipart mode')
+	MULTIPART_MODE = mode
+end
+
+--[[
+	Socket objects share one metatable created in C++, methods are called with ':' (socket:send(data)).
+	Methods implemented in Lua are added into the shared method table once.
+--]]
+do
+	local methods = zmq.socketObjectMethods()
+
+	-- message object, payload stays in zmq_msg_t until requested
+	methods.recvView = zmq.recvView
+	methods.recvMultipart = function(socket, flags)
+		if MULTIPART_MODE == 'native' then
+			return zmq.recvFrames(socket, flags)
+		end
+		return zmq.recvMultipart(socket, flags)
+	end
+	methods.sendMultipart = function(socket, t, flags, bufferLength)
+		if MULTIPART_MODE == 'native' then
+			return zmq.sendFrames(socket, t, flags)
+		end
+		return zmq.sendMultipart(socket, t, flags, bufferLength or DEFAULT_BUFFER_SIZE)
+	end
+	methods.sendID = function(socket, id)
+		assert(id)
+		return zmq.sendMultipart(socket, {id, ''}, constants.ZMQ_SNDMORE)
+	end
+	methods.monitorEvents = function(socket, events)
+		return M.monitor(socket, events)
+	end
+	-- message object from a size or a string, see zmq.msg
+	methods.msg = function(socket, data)
+		return zmq.msgObject(data)
+	end
+end
+
+-- raw context of a socket table or a socket object
+local function socketContext(socket)
+	local context = socket.context
+	if type(context) == 'function' then
+		return context(socket)
+	end
+	return context
+end
+
 M.context = function(context, io_threads, DEBUG)
 	local contextOwner
 	if context then
@@ -472,53 +503,22 @@ M.context = function(context, io_threads, DEBUG)
 				local closed = false
 				local options = {}
 		
+				-- option metadata are kept in C++, names are resolved once into socket_option_ids
 				setmetatable(options, {
 					__index = function(t, name)
-						local index
-						if type(name)=="number" then
-							index = name
-						elseif type(name) == "string" then
-							index = socket_option_names[string.upper(name)]
-						end
-
-						local _type = socket_options_types[index]
-						if _type then
-							if _type == 'i32' or _type=='i' then
-								return assert(zmq.socketGetOptionI32(socket, index))
-							elseif _type == 'i64' then
-								return assert(zmq.socketGetOptionI64(socket, index))
-							elseif _type == 'iptr' then
-								return assert(zmq.socketGetOptionIptr(socket, index))
-							elseif _type == 's' then
-								return assert(zmq.socketGetOptionS(socket, index))
-							elseif _type == 'b' then
-								return assert(zmq.socketGetOptionI32(socket, index) == 1)
-							else
-								error('Unknown socket option')
+						local index = socket_option_ids[name]
+						if index then
+							local getter = socket_option_getters[index]
+							if getter then
+								return assert(getter(socket))
 							end
+							return assert(zmq.socketGetOption(socket, index))
 						end
 					end,
 					__newindex = function(t, name, value)
-						local index
-						if type(name)=="number" then
-							index = name
-						elseif type(name) == "string" then
-							index = socket_option_names[string.upper(name)]
-						end
-
-						local _type = socket_options_types[index]
-						if _type then
-							if _type == 'i32' or _type == 'i' then
-								return assert(zmq.socketSetOptionI32(socket, index, tonumber(value)))
-							elseif _type == 'i64' then
-								return assert(zmq.socketSetOptionI64(socket, index, tonumber(value)))
-							elseif _type == 'iptr' then
-								return assert(zmq.socketSetOptionIptr(socket, index, tonumber(value)))
-							elseif _type == 's' then
-								return assert(zmq.socketSetOptionS(socket, index, tostring(value)))
-							elseif _type == 'b' then
-								return assert(zmq.socketSetOptionI32(socket, index, (value and 1) or 0))
-							end
+						local index = socket_option_ids[name]
+						if index then
+							return assert(zmq.socketSetOption(socket, index, value))
 						end
 					end,
 				})
@@ -537,25 +537,47 @@ M.context = function(context, io_threads, DEBUG)
 						return zmq.unbind(socket, endpoint)
 					end,
 					recv = function(len, flags)
+						-- len is kept for compatibility, frames are always received at full size
 						return zmq.recv(socket, len, flags)
 					end,
 					recvAll = function(flags)
 						return zmq.recvAll(socket, flags)
 					end,
+					recvFrame = function(flags)
+						return zmq.recvFrame(socket, flags)
+					end,
+					-- message object, payload stays in zmq_msg_t until requested
+					recvView = function(flags)
+						return zmq.recvView(socket, flags)
+					end,
 					send = function(str, flags)
 						local str = str or ''
 						return zmq.send(socket, str, flags)
 					end,
-					recvMultipart = function(bufferLength)
-						return zmq.recvMultipart(socket, flags, bufferLength or DEFAULT_BUFFER_SIZE)
+					-- bufferLength is kept for compatibility, frames are always received at full size
+					recvMultipart = function(bufferLength, flags)
+						if MULTIPART_MODE == 'native' then
+							return zmq.recvFrames(socket, flags)
+						end
+						return zmq.recvMultipart(socket, flags)
+					end,
+					recvFrames = function(flags)
+						return zmq.recvFrames(socket, flags)
+					end,
+					-- next frame as a message object, see zmq.msg
+					recvMsg = function(flags)
+						return zmq.recvMsg(socket, flags)
 					end,
-					recvMultipart2 = function(bufferLength)
+					recvBatch = function(max, flags, t)
+						return zmq.recvBatch(socket, max, flags, t)
+					end,
+					recvMultipart2 = function()
 						local out = {}
 						local part = {}
 						local ti, tc = table.insert, table.concat
 
 						repeat
-							local data = assert(zmq.recv(socket, buffer_size or DEFAULT_BUFFER_SIZE))
+							local data = assert(zmq.recv(socket))
                             if type(data)=='string' then
                                 if #data>0 then
                                     ti(part, data)
@@ -564,7 +586,7 @@ M.context = function(context, io_threads, DEBUG)
                                     part = {}
                                 end
                             end
-                        until (not (zmq.socketGetOptionI32(socket, constants.ZMQ_RCVMORE) == 1))
+                        until (not zmq.socketRcvMore(socket))
 
                         -- flush all parts
                         if #part > 0 then
@@ -575,8 +597,25 @@ M.context = function(context, io_threads, DEBUG)
                         return out
                     end,
 					sendMultipart = function(t, flags, bufferLength)
+						if MULTIPART_MODE == 'native' then
+							return zmq.sendFrames(socket, t, flags)
+						end
 						return zmq.sendMultipart(socket, t, flags, bufferLength or DEFAULT_BUFFER_SIZE)
 					end,
+					sendFrames = function(t, flags)
+						return zmq.sendFrames(socket, t, flags)
+					end,
+					sendBatch = function(t, flags)
+						return zmq.sendBatch(socket, t, flags)
+					end,
+					-- sends a Lua value (tables included) encoded in a single frame
+					sendValue = function(value, flags)
+						return zmq.sendValue(socket, value, flags)
+					end,
+					-- trusted enables functions and userdata, use it with trusted peers only
+					recvValue = function(flags, trusted)
+						return zmq.recvValue(socket, flags, trusted)
+					end,
 					sendID = function(id)
 						assert(id)
 						return zmq.sendMultipart(socket, {id, ''}, constants.ZMQ_SNDMORE)
@@ -587,93 +626,34 @@ M.context = function(context, io_threads, DEBUG)
 							closed = true
 						end
 					end,
-					msg = function(size)
-						local zmsg,msg
-						if type(size)=="string" then
-							zmsg,msg = zmq.msgInit(#size)
-							if zmsg then
-							   zmq.msgSetData(zmsg, size)
-							end
-						elseif type(size) == "number" then
-							zmsg,msg = zmq.msgInit(size)
-						else
-							zmsg,msg = zmq.msgInit()
-						end
-						if not zmsg then
-							return false, msg
-						end
-
-						local options = {}
-						setmetatable(options, {
-							__index = function(t, name)
-								return zmq.msgGet(zmsg, name)
-							end,
-							__newindex = function(t, name, value)
-								zmq.msgSet(zmsg, name, value)
-							end,						
-						})
-
-						local lfn = {
-							options = options,
-
-							copy = function(dest)
-								return zmq.msgCopy(zmsg, dest)
-							end,
-							move = function(dest)
-								return zmq.msgMove(zmsg, dest)
-							end,
-							send = function(flags)
-								return zmq.msgSend(zmsg, socket, flags)
-							end,
-							recv = function(flags)
-								return zmq.msgRecv(zmsg, socket, flags)
-							end,
-							gets = function(property)
-								return zmq.msgGets(zmsg, property)
-							end,
-						}
-
-						local mt = getmetatable(zmsg)
-						mt.__index = function(t, fn)
-							if (fn == "size") then
-								return zmq.msgSize(zmsg)
-							elseif (fn == "more") then
-								return (zmq.msgMore(zmsg) == 1)
-							elseif (fn == "data") then
-								return zmq.msgGetData(zmsg)
-							elseif (fn == "routingID") then
-								return zmq.msgGetRoutingID(zmsg)
-							else
-								return lfn[fn]
-							end
-						end
-						mt.__newindex = function(t, name, value)
-							if name == "data" then
-								zmq.msgSetData(zmsg, value)
-							elseif (name == "routingID") then
-								return zmq.msgSetRoutingID(zmsg, value)
-							end
-						end
-						mt.__gc = function()
-							if DEBUG then
-								print('Closing msg object')
-							end
-							zmq.msgClose(zmsg)
-						end
-
-						return zmsg
+					-- message object from a size or a string, see zmq.msg
+					msg = function(data)
+						return zmq.msgObject(data)
 					end,
 					options = options,
+					-- raw context object the socket was created in
+					context = context,
 					monitor = function(endpoint, events)
 						return zmq.socketMonitor(socket, endpoint, events)
 					end,
+					-- send and receive counters, see zmq.statsEnable
+					stats = function()
+						return zmq.socketStats(socket)
+					end,
+					-- records send to receive round trips into a zmq.histogram, nil detaches it
+					recordLatency = function(histogram)
+						return zmq.socketRecordLatency(socket, histogram)
+					end,
+					-- monitor object with decoded events, see zmq.monitor
+					monitorEvents = function(events)
+						return M.monitor(socket, events)
+					end,
 				}
 
 				local mt = getmetatable(socket)
 				mt.__index = function(t, fn)
 					if fn == "more" then
-						local more = zmq.socketGetOptionI32(socket, constants.ZMQ_RCVMORE)
-						return (more == 1)
+						return zmq.socketRcvMore(socket)
 					else
 						return lfn[fn]
 					end
@@ -691,10 +671,15 @@ M.context = function(context, io_threads, DEBUG)
 
 			return setupSocket(socket)
 		end,
+		-- socket object with a shared native metatable, use ':' to call its methods
+		socketObject = function(_type)
+			return zmq.socketObject(context, _type)
+		end,
 		shutdown = function()
 			assert(zmq.shutdown(context))
 		end,
 		thread2 = function(fn, ...)
+			preloadModule()
 			local thread = assert(zmq.thread2(fn,context, ...))
 			local mt = getmetatable(thread)
 
@@ -723,8 +708,114 @@ M.context = function(context, io_threads, DEBUG)
 			return thread
 		end,
 
+		--[[
+			Creates a pool of n worker threads with persistent Lua states.
+			initFn(context, workerID) is called once in every worker,
+			jobs are called as fn(context, ...) and they're balanced by work stealing.
+			options: {max = maximum workers, idle = ms before surplus workers quit}
+
+			pool.socket can be added into zmq.poll, pool.dispatch() then invokes
+			callbacks of finished jobs.
+		--]]
+		pool = function(n, initFn, options)
+			preloadModule()
+			poolCounter = poolCounter + 1
+			local endpoint = ("inproc://luazmq_pool_%d_%s"):format(poolCounter, tostring(context))
+			local notify = assert(context.socket(constants.ZMQ_PULL))
+			notify.options.LINGER = 0
+			notify.options.RCVHWM = 0
+			assert(notify.bind(endpoint))
+
+			local pool = assert(zmq.poolNew(context, n, initFn, options, endpoint))
+			local mt = getmetatable(pool)
+			local closed = false
+			-- futures waiting for a callback, indexed by future ID
+			local callbacks = {}
+			local batch = {}
+
+			local function setupFuture(future)
+				local id = zmq.poolFutureID(future)
+				local lfn = {
+					id = id,
+					ready = function()
+						return zmq.poolFutureReady(future)
+					end,
+					get = function(timeout)
+						return zmq.poolFutureGet(future, timeout)
+					end,
+					-- fn(future) is called from pool.dispatch() when the job is finished,
+					-- or right away if it's finished already
+					onDone = function(fn)
+						if zmq.poolFutureNotify(future) then
+							callbacks[id] = nil
+							fn(future)
+						else
+							callbacks[id] = {future, fn}
+						end
+					end,
+				}
+				local fmt = getmetatable(future)
+				fmt.__index = function(t, fn)
+					return lfn[fn]
+				end
+				fmt.__gc = function()
+					zmq.poolFutureFree(future)
+				end
+				return future
+			end
+
+			local lfn = {
+				socket = notify,
+				submit = function(fn, ...)
+					local future, msg = zmq.poolSubmit(pool, fn, ...)
+					if not future then
+						return false, msg
+					end
+					return setupFuture(future)
+				end,
+				dispatch = function()
+					local _, count = notify.recvBatch(256, constants.ZMQ_DONTWAIT, batch)
+					for i=1,(count or 0) do
+						local id = tonumber(batch[i])
+						local callback = callbacks[id]
+						if callback then
+							callbacks[id] = nil
+							callback[2](callback[1])
+						end
+					end
+					return count
+				end,
+				wait = function(timeout)
+					return zmq.poolWait(pool, timeout)
+				end,
+				resize = function(n, max)
+					return zmq.poolResize(pool, n, max)
+				end,
+				stats = function()
+					return zmq.poolStats(pool)
+				end,
+				close = function()
+					if not closed then
+						zmq.poolFree(pool)
+						notify.close()
+						closed = true
+					end
+				end,
+			}
+			mt.__index = function(t, fn)
+				return lfn[fn]
+			end
+			mt.__gc = function()
+				lfn.close()
+			end
+
+			return pool
+		end,
+
 		thread = function(code, ...)
+			preloadModule()
 			local arg = {...}
+
 			local finalCode = {[[
 local zmq = require 'zmq'
 local context = assert(zmq.context(assert(select(1, ...))))
@@ -738,7 +829,7 @@ local arg = {]]}
 				elseif type(value)=="string" then
 					table.insert(finalCode, string.format("%q", value))
 				elseif type(value)=="function" then
-					table.insert(finalCode, string.format("loadstring(%q)", string.dump(value)))
+					table.insert(finalCode, string.format("zmq.loadCached(%q)", string.dump(value)))
 				else
 					error("Thread parameters can be booleans, numbers, string and functions w/o upvalues")
 				end
@@ -828,82 +919,46 @@ end
 
 M.poll = function(initPollItems)
 	local poll = zmq.pollNew()
-	local pollItems = {}
-	setmetatable(pollItems, { __mode = 'k'})
 	local items = {}
 
 	setmetatable(items, {
 		__index = function(t, id)
 			local v = zmq.pollGet(poll, id)
 			if v then
-				local s = v.socket
-				local i = pollItems[s]
-				return {socket = s, revents = v.revents, flags = i[1], fn = i[2]}
+				return {socket = v.socket, revents = v.revents, flags = v.events, fn = v.fn}
 			end
 		end,
 		__newindex = function(t, id, v)
-			local s = v.socket
-			local flags = v.flags
-			pollItems[s] = {flags, v.fn}
-			zmq.pollSet(poll, id, {socket = s, fd = 0, events = flags, revents = 0})
+			zmq.pollSet(poll, id, {socket = v.socket, fd = 0, events = v.flags, revents = 0, fn = v.fn})
 		end,
 		__len = function(t)
 			return zmq.pollSize(poll)
 		end,
 	})
 
-	local socketCache = {}
-	setmetatable(socketCache, {
-		__mode = 'v',
-	})
-	local function getRawSocket(s)
-		local smt = getmetatable(s)
-		if smt then
-			return smt.__raw
-		end
-	end
-
 	local lfn = {
+		-- poll.items[handle] reads or replaces the item with given handle
 		items = items,
+		-- callbacks of signalled sockets are invoked directly from C++
 		start = function(timeout)
-			local signaledItems = assert(zmq.poll(poll, timeout))
-			if signaledItems > 0 then
-				local size = zmq.pollSize(poll)
-				for i=0,size-1 do
-					local v = zmq.pollGet(poll, i) 
-					if v then
-						local rawSocket = getRawSocket(v.socket)
-						local s = socketCache[rawSocket]
-						assert(s, 'Invalid socket')
-						local pollItem = pollItems[i+1]
-
-						if pollItem then
-							if band(v.revents, pollItem[1]) > 0 then
-								local flags = pollItem[1]
-								local fn = pollItem[2]
-								if type(fn) == "function" then
-									fn(s, v.revents)
-								end
-							end
-						end
-					end
-				end
-			end
-			return signaledItems
+			return assert(zmq.pollDispatch(poll, timeout))
 		end,
+		-- returns stable item handle, items can be modified or removed by socket or handle
 		add = function(s, flags, fn)
-			local rawSocket = getRawSocket(s)
-			
-			table.insert(pollItems, {flags, fn})
-
-			if not socketCache[rawSocket] then
-				socketCache[rawSocket] = s
+			-- raw file descriptor (e.g. queue.fd), use the returned handle to modify or remove it
+			if type(s) == 'number' then
+				return zmq.pollAdd(poll, {fd = s, events = flags, revents = 0, fn = fn})
 			end
-
-			zmq.pollSet(poll,
-				{socket = s, fd = s.options.FD, events = flags, revents = 0}
+			return zmq.pollAdd(poll,
+				{socket = s, fd = 0, events = flags, revents = 0, fn = fn}
 			)
 		end,
+		modify = function(s, flags, fn)
+			return zmq.pollModify(poll, s, flags, fn)
+		end,
+		remove = function(s)
+			return zmq.pollRemove(poll, s)
+		end,
 	}
 
 	local mt = getmetatable(poll)
@@ -957,6 +1012,183 @@ M.atomic = function()
 	return counter
 end
 
+--[[
+	Message channel moves zmq_msg_t content between Lua states without copying the payload.
+	zmq.channel(capacity) creates a new channel, zmq.channel(channel) wraps a channel
+	passed into thread2 or a pool job.
+--]]
+M.channel = function(capacity)
+	local channel
+	if type(capacity) == 'userdata' then
+		channel = capacity
+	else
+		channel = assert(zmq.channelNew(capacity))
+	end
+
+	local lfn = {
+		-- msg is a message object, it's empty afterwards
+		push = function(msg)
+			return zmq.channelPush(channel, msg)
+		end,
+		-- returns a message object or nil if there's nothing to receive within timeout
+		pop = function(timeout)
+			return zmq.channelPop(channel, timeout)
+		end,
+	}
+
+	local mt = getmetatable(channel)
+	mt.__index = function(t, fn)
+		if fn == 'size' then
+			return zmq.channelSize(channel)
+		else
+			return lfn[fn]
+		end
+	end
+	return channel
+end
+
+--[[
+	Message object with zmq_msg_t stored inline in the userdata. All message objects share one metatable
+	created in C++, methods are called with ':' (msg:data(), msg:send(socket, flags)).
+	data is a string or a size, empty message is created otherwise.
+--]]
+M.msg = function(data)
+	return zmq.msgObject(data)
+end
+
+--[[
+	Bounded lock-free queue of numbers, booleans and short strings shared between Lua states.
+	zmq.queue(capacity, pollable) creates a new queue, zmq.queue(queue) wraps a queue
+	passed into thread2 or a pool job. queue.fd of a pollable queue can be added into zmq.poll,
+	it's readable while there's something to pop.
+--]]
+M.queue = function(capacity, pollable)
+	local queue
+	if type(capacity) == 'userdata' then
+		queue = capacity
+	else
+		queue = assert(zmq.queueNew(capacity, pollable))
+	end
+
+	local lfn = {
+		-- returns the number of pushed values
+		push = function(...)
+			return zmq.queuePush(queue, ...)
+		end,
+		pop = function()
+			return zmq.queuePop(queue)
+		end,
+		popBatch = function(max, t)
+			return zmq.queuePopBatch(queue, max, t)
+		end,
+	}
+
+	local mt = getmetatable(queue)
+	mt.__index = function(t, fn)
+		if fn == 'size' then
+			return zmq.queueSize(queue)
+		elseif fn == 'fd' then
+			return zmq.queueFD(queue)
+		else
+			return lfn[fn]
+		end
+	end
+	return queue
+end
+
+--[[
+	Per-socket counters of messages, bytes, EAGAIN errors and time spent in blocking calls.
+	Counting is off by default, zmq.statsEnable(true) turns it on for all sockets.
+	zmq.stats() returns a snapshot of all counted sockets, socket.stats() counters of one socket.
+--]]
+M.statsEnable = function(enable)
+	return zmq.statsEnable(enable)
+end
+
+M.stats = function()
+	return zmq.stats()
+end
+
+M.statsReset = function()
+	return zmq.statsReset()
+end
+
+--[[
+	Log-linear latency histogram with fixed memory, shared between Lua states like zmq.queue.
+	zmq.histogram() creates a new histogram, zmq.histogram(histogram) wraps one passed into a thread.
+	Values are non-negative integers, zmq.now() returns monotonic time in nanoseconds.
+--]]
+M.histogram = function(histogram)
+	if type(histogram) ~= 'userdata' then
+		histogram = zmq.histogramNew()
+	end
+
+	local lfn = {
+		record = function(value, count)
+			return zmq.histogramRecord(histogram, value, count)
+		end,
+		merge = function(other)
+			return zmq.histogramMerge(histogram, other)
+		end,
+		-- returns values at all given percentiles
+		percentile = function(...)
+			return zmq.histogramPercentile(histogram, ...)
+		end,
+		summary = function()
+			return zmq.histogramSummary(histogram)
+		end,
+		reset = function()
+			return zmq.histogramReset(histogram)
+		end,
+	}
+
+	local mt = getmetatable(histogram)
+	mt.__index = function(t, fn)
+		return lfn[fn]
+	end
+	return histogram
+end
+
+M.now = zmq.now
+
+--[[
+	Socket monitor with events decoded in C++. monitor.process(timeout, callback) reads pending events,
+	counts them per endpoint and calls callback(event, value, endpoint) for each of them.
+	monitor.counters(endpoint) returns event counters, monitor.fd can be added into zmq.poll.
+	A socket can have only one monitor. monitor.stop() detaches it, closing the socket stops the monitor too.
+--]]
+M.monitor = function(socket, events)
+	local monitor = assert(zmq.monitorNew(socketContext(socket), socket, events))
+
+	local lfn = {
+		process = function(timeout, callback)
+			return zmq.monitorProcess(monitor, timeout, callback)
+		end,
+		counters = function(endpoint)
+			return zmq.monitorCounters(monitor, endpoint)
+		end,
+		reset = function()
+			return zmq.monitorReset(monitor)
+		end,
+		stop = function()
+			return zmq.monitorStop(monitor)
+		end,
+	}
+
+	local mt = getmetatable(monitor)
+	mt.__index = function(t, fn)
+		if fn == 'fd' then
+			return zmq.monitorFD(monitor)
+		else
+			return lfn[fn]
+		end
+	end
+	mt.__gc = function()
+		zmq.monitorFree(monitor)
+	end
+	return monitor
+end
+
 M.proxy = function(forward, backend, capture)
 	zmq.proxy(forward, backend, capture)
 end
@@ -965,6 +1197,91 @@ M.proxySteerable = function(forward, backend, capture, control)
 	zmq.proxySteerable(forward, backend, capture, control)
 end
 
+--[[
+	Proxy statistics shared between Lua states, zmq.proxyStats(stats) wraps an object
+	passed from another state. stats.get() returns counters of both directions.
+--]]
+M.proxyStats = function(stats)
+	if type(stats) ~= 'userdata' then
+		stats = zmq.proxyStatsNew()
+	end
+
+	local lfn = {
+		get = function()
+			return zmq.proxyStatsGet(stats)
+		end,
+	}
+
+	local mt = getmetatable(stats)
+	mt.__index = function(t, fn)
+		return lfn[fn]
+	end
+	return stats
+end
+
+--[[
+	Instrumented steerable proxy, blocks until TERMINATE command is received on control socket.
+	Control socket also answers STATISTICS command like zmq_proxy_steerable.
+	options: {drop = drop messages on high water mark instead of blocking, latency = record forwarding latency}
+--]]
+M.proxyRun = function(frontend, backend, capture, control, stats, options)
+	return zmq.proxyRun(frontend, backend, capture, control, stats, options)
+end
+
+--[[
+	Encodes routing rules as RULES command frames for a control socket of zmq.proxyRun:
+	control.sendFrames({zmq.proxyRulesEncode(rules)})
+--]]
+M.proxyRulesEncode = function(rules)
+	return zmq.proxyRulesEncode(rules)
+end
+
+--[[
+	Runs proxy on a native thread and returns a handle with pause, resume, terminate, stats and join.
+	Frontend, backend and capture sockets must not be used from Lua until the proxy is terminated.
+	options: {control = socket, stats = zmq.proxyStats() object, drop = boolean, latency = boolean, rules = table}
+	Backend may be a table of sockets, rules route frontend messages by topic prefix:
+	{{prefix = 'orders', backend = 2}, {prefix = 'debug', drop = true}, {prefix = 'ticks', sample = 10}}
+--]]
+M.proxyStart = function(frontend, backend, capture, options)
+	local context = socketContext(frontend)
+	local proxy = assert(zmq.proxyStart(context, frontend, backend, capture, options))
+	-- the proxy thread uses these sockets until it's joined, they mustn't be collected before
+	local owned = {context, frontend, backend, capture, options}
+
+	local lfn = {
+		pause = function()
+			return zmq.proxyCommand(proxy, 'PAUSE')
+		end,
+		resume = function()
+			return zmq.proxyCommand(proxy, 'RESUME')
+		end,
+		terminate = function()
+			return zmq.proxyCommand(proxy, 'TERMINATE')
+		end,
+		stats = function()
+			return zmq.proxyStatistics(proxy)
+		end,
+		setRules = function(rules)
+			return zmq.proxySetRules(proxy, rules)
+		end,
+		join = function()
+			local result, msg = zmq.proxyJoin(proxy)
+			owned = nil
+			return result, msg
+		end,
+	}
+
+	local mt = getmetatable(proxy)
+	mt.__index = function(t, fn)
+		return lfn[fn]
+	end
+	mt.__gc = function()
+		zmq.proxyFree(proxy)
+	end
+	return proxy
+end
+
 M.Z85_encode = function(str)
 	return zmq.Z85Encode(str)
 end
@@ -996,6 +1313,8 @@ M.ID = function(n)
 end
 
 M.has = zmq.has
+-- loads code (source or bytecode), source is compiled once per process and each call returns a new function
+M.loadCached = zmq.loadCached
 
 setmetatable(M, {
 	__index = constants,
@@ -0,0 +1,26 @@
+local zmq = require 'zmq'
+
+local context, msg = assert(zmq.context())
+
+local pull = assert(context.socket(zmq.ZMQ_PULL))
+assert(pull.bind("inproc://batch"))
+local push = assert(context.socket(zmq.ZMQ_PUSH))
+assert(push.connect("inproc://batch"))
+
+-- strings are single frame messages, tables are multipart messages
+assert(push.sendBatch({'one', {'two', 'parts'}, 'three'}) == 3)
+local messages, count = pull.recvBatch(10)
+print('Received: ', count)
+assert(count == 3 and messages[1] == 'one' and messages[2][2] == 'parts' and messages[3] == 'three')
+
+-- invalid or empty elements reject the whole batch before anything is sent
+for _, batch in ipairs {{'ok', {}}, {'ok', 5 == 5}, {'ok', {'frame', {}}}} do
+	local ok, err, sent = push.sendBatch(batch)
+	print('Invalid batch: ', ok, err, sent)
+	assert(not ok and sent == 0)
+end
+local _, count = pull.recvBatch(10, zmq.ZMQ_DONTWAIT)
+assert(count == 0)
+
+push.close()
+pull.close()
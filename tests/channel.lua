@@ -0,0 +1,82 @@
+local zmq = require 'zmq'
+
+local context = assert(zmq.context())
+local socket = assert(context.socket(zmq.ZMQ_PAIR))
+
+-- messages are moved between Lua states, only message handles go through channels
+local input = zmq.channel(16)
+local output = zmq.channel(16)
+
+local worker = function(_ctx, input, output)
+	local zmq = require 'zmq'
+	local input = zmq.channel(input)
+	local output = zmq.channel(output)
+
+	while true do
+		local msg = input.pop(-1)
+		if #msg == 0 then
+			break
+		end
+		print(('Worker got %d bytes starting with %q'):format(#msg, msg:sub(1, 4)))
+		-- pass the same payload to the next stage
+		assert(output.push(msg))
+	end
+end
+
+do
+	local N = 4
+	local thread = assert(context.thread2(worker, input, output))
+
+	for i=1,N do
+		local msg = assert(socket.msg(('img%d'):format(i) .. ('x'):rep(1024*1024)))
+		assert(input.push(msg))
+		print('Pushed message, size left in sender: ', msg:size())
+	end
+
+	for i=1,N do
+		local msg = output.pop(1000)
+		print('Result: ', msg and #msg)
+	end
+
+	-- empty message stops the worker
+	assert(input.push(socket.msg()))
+	thread.join()
+end
+
+-- the thread holds its own reference even if the channel is collected here before it's wrapped
+do
+	local thread
+	do
+		local channel = zmq.channel(4)
+		assert(channel.push(socket.msg('still alive')))
+		thread = assert(context.thread2(function(_ctx, channel)
+			local zmq = require 'zmq'
+			zmq.sleep(1)
+			local channel = zmq.channel(channel)
+			local msg = channel.pop()
+			print('Late receiver got: ', msg and tostring(msg))
+		end, channel))
+	end
+	collectgarbage()
+	collectgarbage()
+	thread.join()
+end
+
+-- a freed channel and a closed message are reported as errors
+do
+	local channel = zmq.channel(4)
+	local msg = zmq.msg('closed')
+	msg:close()
+	local ok, err = channel.push(msg)
+	print('Push closed message: ', ok, err)
+	assert(ok == false and err == 'message is closed')
+
+	require('luazmq').channelFree(channel)
+	ok, err = channel.push(zmq.msg('late'))
+	print('Push after free: ', ok, err)
+	assert(ok == false and err == 'channel is closed')
+	assert(not channel.pop())
+end
+
+socket.close()
+print('Exiting')
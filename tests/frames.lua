@@ -0,0 +1,36 @@
+local zmq = require 'zmq'
+
+local context, msg = assert(zmq.context())
+
+local pull = assert(context.socket(zmq.ZMQ_PULL))
+assert(pull.bind("inproc://frames"))
+local push = assert(context.socket(zmq.ZMQ_PUSH))
+assert(push.connect("inproc://frames"))
+
+-- each table element is sent as exactly one frame
+assert(push.sendFrames({'first', '', 'third'}))
+local frames = assert(pull.recvFrames())
+assert(#frames == 3 and frames[1] == 'first' and frames[2] == '' and frames[3] == 'third')
+print('Frames: ', #frames)
+
+-- invalid element is reported before anything is sent
+local ok, err = push.sendFrames({'valid', {}, 'valid'})
+print('Invalid frame: ', ok, err)
+assert(not ok)
+assert(push.sendFrames({'next'}))
+frames = assert(pull.recvFrames())
+assert(#frames == 1 and frames[1] == 'next')
+
+-- native multipart mode maps sendMultipart and recvMultipart onto frames
+zmq.setMultipartMode('native')
+assert(push.sendMultipart({'a', 'b'}))
+frames = assert(pull.recvMultipart())
+assert(#frames == 2 and frames[1] == 'a' and frames[2] == 'b')
+zmq.setMultipartMode('delimited')
+assert(push.sendMultipart({'a', 'b'}))
+frames = assert(pull.recvMultipart())
+assert(#frames == 2 and frames[1] == 'a' and frames[2] == 'b')
+print('Multipart modes: ok')
+
+push.close()
+pull.close()
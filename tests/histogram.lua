@@ -0,0 +1,68 @@
+local zmq = require 'zmq'
+
+local context, msg = assert(zmq.context())
+
+local rep = assert(context.socket(zmq.ZMQ_REP))
+assert(rep.bind("inproc://histogram"))
+local req = assert(context.socket(zmq.ZMQ_REQ))
+assert(req.connect("inproc://histogram"))
+
+-- round trips of the REQ socket are recorded in C++
+local roundTrips = zmq.histogram()
+assert(req.recordLatency(roundTrips))
+
+-- values can be recorded from Lua too
+local handling = zmq.histogram()
+
+local N = 10000
+for i=1,N do
+	req.send('ping')
+	rep.recv()
+	local t0 = zmq.now()
+	rep.send('pong')
+	handling.record(zmq.now() - t0)
+	req.recv()
+end
+req.recordLatency(nil)
+
+local s = roundTrips.summary()
+print('Round trips: ', s.count)
+print('p50/p99/p99.9 (ns): ', s.p50, s.p99, s.p999)
+print('rep.send p50/p99 (ns): ', handling.percentile(50, 99))
+
+-- histograms from several threads can be merged
+roundTrips.merge(handling)
+print('Merged: ', roundTrips.summary().count)
+
+-- a histogram passed into a thread stays alive after this state collects it
+do
+	local thread
+	do
+		local shared = zmq.histogram()
+		shared.record(42)
+		thread = assert(context.thread2(function(_ctx, histogram)
+			local zmq = require 'zmq'
+			zmq.sleep(1)
+			local histogram = zmq.histogram(histogram)
+			histogram.record(43)
+			print('Recorded in thread: ', histogram.summary().count)
+			assert(histogram.summary().count == 2)
+		end, shared))
+	end
+	collectgarbage()
+	collectgarbage()
+	thread.join()
+end
+
+-- out of range values are clamped, NaN and negative values are ignored
+local edges = zmq.histogram()
+edges.record(math.huge)
+edges.record(2^70, 3)
+edges.record(0/0)
+edges.record(-1)
+edges.record(5, 0/0)
+print('Clamped: ', edges.summary().count)
+assert(edges.summary().count == 4)
+
+req.close()
+rep.close()
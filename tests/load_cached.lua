@@ -0,0 +1,31 @@
+local zmq = require 'zmq'
+
+-- repeated code isn't parsed again, but every call returns a new function
+local f1 = assert(zmq.loadCached('return 1 + 1'))
+local f2 = assert(zmq.loadCached('return 1 + 1'))
+assert(f1 ~= f2)
+assert(f1() == 2 and f2() == 2)
+
+-- environments set on one function don't leak into functions loaded later
+local g1 = assert(zmq.loadCached('return value'))
+setfenv(g1, {value = 'job 1'})
+local g2 = assert(zmq.loadCached('return value'))
+print('Environments: ', g1(), g2())
+assert(g1() == 'job 1' and g2() == nil)
+
+-- bytecode is loaded as well
+local dumped = string.dump(function() return 'bytecode' end)
+assert(zmq.loadCached(dumped)() == 'bytecode')
+
+-- syntax errors are reported like loadstring does
+local fn, err = zmq.loadCached('return +')
+print('Syntax error: ', fn, err)
+assert(fn == nil and type(err) == 'string')
+
+-- a full cache is replaced, chunks keep working
+for i=1,1000 do
+	assert(zmq.loadCached(('return %d'):format(i))() == i)
+end
+assert(zmq.loadCached('return 1 + 1')() == 2)
+
+print('Chunk cache: ok')
@@ -0,0 +1,61 @@
+local zmq = require 'zmq'
+
+local context, msg = assert(zmq.context())
+
+local router = assert(context.socket(zmq.ZMQ_ROUTER))
+local monitor = router.monitorEvents()
+assert(router.bind("tcp://127.0.0.1:12345"))
+
+local names = {
+	[zmq.ZMQ_EVENT_LISTENING] = 'listening',
+	[zmq.ZMQ_EVENT_ACCEPTED] = 'accepted',
+	[zmq.ZMQ_EVENT_DISCONNECTED] = 'disconnected',
+}
+
+local N = 10
+local peers = {}
+for i=1,N do
+	local peer = assert(context.socket(zmq.ZMQ_DEALER))
+	assert(peer.connect("tcp://127.0.0.1:12345"))
+	peers[i] = peer
+end
+for i=1,N do
+	peers[i].close()
+end
+
+-- events are decoded in C++, the callback receives event id, value and endpoint
+local received = 0
+local deadline = zmq.now() + 5e9
+while received < 1 + 2*N and zmq.now() < deadline do
+	received = received + assert(monitor.process(100, function(event, value, endpoint)
+		print('Event: ', names[event] or event, value, endpoint)
+	end))
+end
+print('Received events: ', received)
+assert(received >= 1 + 2*N)
+
+local counters = monitor.counters()
+print('Accepted: ', counters.total.accepted)
+print('Disconnected: ', counters.total.disconnected)
+for endpoint, c in pairs(counters.endpoints) do
+	print(endpoint, c.listening, c.accepted, c.disconnected)
+end
+
+-- libzmq supports one monitor per socket, a second one is refused until the first is stopped
+local ok, err = require('luazmq').monitorNew(router.context, router, zmq.ZMQ_EVENT_ALL)
+print('Second monitor: ', ok, err)
+assert(ok == false and err == 'socket is already monitored')
+
+monitor.stop()
+local again = router.monitorEvents()
+again.stop()
+router.close()
+
+-- closing the monitored socket stops the monitor, stop and free are safe afterwards
+local dealer = assert(context.socket(zmq.ZMQ_DEALER))
+local monitor2 = dealer.monitorEvents()
+dealer.close()
+monitor2.stop()
+monitor2 = nil
+collectgarbage()
+print('Stop after close: ok')
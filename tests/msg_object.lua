@@ -0,0 +1,53 @@
+local zmq = require 'zmq'
+
+local context, msg = assert(zmq.context())
+
+local pull = assert(context.socket(zmq.ZMQ_PULL))
+assert(pull.bind("inproc://msg_object"))
+local push = assert(context.socket(zmq.ZMQ_PUSH))
+assert(push.connect("inproc://msg_object"))
+
+-- message objects share one native metatable, methods are called with ':'
+local out = assert(zmq.msg('Hello world'))
+print('Size: ', out:size(), #out)
+assert(out:send(push, zmq.ZMQ_SNDMORE))
+assert(zmq.msg(4):send(push))
+
+local frame = assert(pull.recvMsg())
+print('Data: ', frame:data(), 'More: ', frame:more())
+print('Find: ', frame:find('world'))
+print('Sub: ', frame:sub(1, 5))
+
+-- copy keeps the source message, close can be called before the message is collected
+local copy = zmq.msg()
+assert(frame:copy(copy))
+print('Copy: ', tostring(copy))
+frame:close()
+copy:close()
+-- closed message converts into an empty string
+assert(tostring(frame) == '')
+
+frame = assert(pull.recvMsg())
+print('Size: ', frame:size(), 'More: ', frame:more())
+
+-- setData leaves exactly the new data in the message, whether it grows, shrinks or keeps its size
+local resized = zmq.msg(4)
+for _, payload in ipairs {('y'):rep(1000), 'abc', 'xyz', ''} do
+	resized:setData(payload)
+	assert(resized:size() == #payload and resized:data() == payload)
+	local copy = zmq.msg()
+	assert(resized:copy(copy))
+	assert(copy:send(push))
+	frame = assert(pull.recvMsg())
+	assert(frame:data() == payload)
+	print('setData: ', frame:size())
+end
+
+-- message object churn doesn't create any Lua closures
+for i=1,10000 do
+	zmq.msg(('x'):rep(i % 64)):send(push)
+	pull.recvMsg()
+end
+
+push.close()
+pull.close()
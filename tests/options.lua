@@ -0,0 +1,28 @@
+local zmq = require 'zmq'
+
+local context, msg = assert(zmq.context())
+
+local pull = assert(context.socket(zmq.ZMQ_PULL))
+assert(pull.bind("inproc://options"))
+local push = assert(context.socket(zmq.ZMQ_PUSH))
+assert(push.connect("inproc://options"))
+
+-- option names are resolved once, later accesses go straight to the typed getter
+pull.options.rcvhwm = 5000
+print('RCVHWM: ', pull.options.RCVHWM)
+pull.options.IPV6 = true
+print('IPV6: ', pull.options.ipv6)
+print('LAST_ENDPOINT: ', pull.options.LAST_ENDPOINT)
+
+push.send('a', zmq.ZMQ_SNDMORE)
+push.send('b')
+
+-- RCVMORE, EVENTS and FD have dedicated getters
+print('EVENTS: ', pull.options.EVENTS)
+print('FD: ', pull.options.FD)
+repeat
+	print('Frame: ', pull.recv())
+until not pull.options.RCVMORE
+
+push.close()
+pull.close()
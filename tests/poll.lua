@@ -0,0 +1,114 @@
+local zmq = require 'zmq'
+
+local context = assert(zmq.context())
+
+local pull = assert(context.socket(zmq.ZMQ_PULL))
+assert(pull.bind("inproc://poll"))
+local push = assert(context.socket(zmq.ZMQ_PUSH))
+assert(push.connect("inproc://poll"))
+
+-- callbacks get the socket object and revents of a signalled item
+do
+	local received = {}
+	local poll = zmq.poll {
+		{pull, zmq.ZMQ_POLLIN, function(socket, revents)
+			assert(socket == pull)
+			assert(revents == zmq.ZMQ_POLLIN)
+			received[#received + 1] = socket.recv()
+		end},
+	}
+
+	assert(push.send('first'))
+	assert(push.send('second'))
+	local deadline = zmq.now() + 1e9
+	while #received < 2 and zmq.now() < deadline do
+		poll.start(100)
+	end
+	assert(#received == 2 and received[1] == 'first' and received[2] == 'second')
+	assert(poll.items[0].fn)
+	print('Dispatched: ', #received)
+end
+
+-- a callback that refers to its own poll doesn't keep the poll alive
+do
+	local polls = setmetatable({}, {__mode = 'k'})
+	do
+		local poll = zmq.poll()
+		poll.add(pull, zmq.ZMQ_POLLIN, function(socket)
+			socket.recv()
+			poll.remove(socket)
+		end)
+		polls[poll] = true
+	end
+
+	collectgarbage()
+	collectgarbage()
+	assert(next(polls) == nil)
+	print('Collected: ok')
+end
+
+-- items can be added, modified and removed by socket or handle
+do
+	local poll = zmq.poll()
+	local handle = poll.add(pull, zmq.ZMQ_POLLIN, function() end)
+	assert(poll.add(pull, zmq.ZMQ_POLLIN) == handle)
+	assert(poll.items[handle])
+	assert(poll.modify(handle, zmq.ZMQ_POLLIN + zmq.ZMQ_POLLOUT))
+	assert(poll.items[handle].flags == zmq.ZMQ_POLLIN + zmq.ZMQ_POLLOUT)
+	assert(poll.modify(pull, zmq.ZMQ_POLLIN))
+	assert(poll.remove(pull))
+	assert(not poll.remove(pull))
+	assert(not poll.modify(handle, zmq.ZMQ_POLLIN))
+	assert(poll.items[handle] == nil)
+	print('Add, modify, remove: ok')
+end
+
+-- a socket removed and added again from its own callback keeps the new item
+do
+	local poll = zmq.poll()
+	local replaced = 0
+	local oldHandle, newHandle
+	oldHandle = poll.add(pull, zmq.ZMQ_POLLIN, function(socket)
+		socket.recv()
+		assert(poll.remove(socket))
+		newHandle = poll.add(socket, zmq.ZMQ_POLLIN, function(socket)
+			socket.recv()
+			replaced = replaced + 1
+		end)
+	end)
+
+	assert(push.send('first'))
+	assert(push.send('second'))
+	local deadline = zmq.now() + 1e9
+	while replaced < 1 and zmq.now() < deadline do
+		poll.start(100)
+	end
+	assert(replaced == 1)
+	assert(newHandle ~= oldHandle)
+	assert(poll.items[oldHandle] == nil and poll.items[newHandle])
+	-- the socket still resolves to the new item
+	assert(poll.modify(pull, zmq.ZMQ_POLLIN))
+	assert(poll.remove(pull))
+	assert(poll.items[newHandle] == nil)
+	print('Remove during dispatch: ok')
+end
+
+-- items are addressed by stable handles, removing an item doesn't move the others
+do
+	local poll = zmq.poll()
+	local a = poll.add(push, zmq.ZMQ_POLLOUT, function() end)
+	local b = poll.add(pull, zmq.ZMQ_POLLIN, function() end)
+	assert(poll.remove(a))
+	local item = poll.items[b]
+	assert(item and item.socket == pull and item.fn)
+
+	-- assigned item replaces the old one, including its callback
+	poll.items[b] = {socket = pull, flags = zmq.ZMQ_POLLIN}
+	item = poll.items[b]
+	assert(item.socket == pull and item.fn == nil)
+	assert(poll.items[a] == nil)
+	print('Stable handles: ok')
+end
+
+push.close()
+pull.close()
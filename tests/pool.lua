@@ -0,0 +1,80 @@
+local zmq = require 'zmq'
+
+local context = assert(zmq.context())
+
+-- results socket
+local socket = assert(context.socket(zmq.ZMQ_PULL))
+assert(socket.bind("inproc://results"))
+
+-- init function runs once in every worker state
+local init = function(_ctx, workerId)
+	local zmq = require 'zmq'
+	context = assert(zmq.context(_ctx))
+	results = assert(context.socket(zmq.ZMQ_PUSH))
+	assert(results.connect("inproc://results"))
+	worker = workerId
+end
+
+local pool = context.pool(4, init, {max = 8, idle = 1000})
+
+local Njobs = 100
+
+for i=1,Njobs do
+	pool.submit(function(_ctx, i)
+		results.send(("Job #%d done by worker #%d"):format(i, worker))
+	end, i)
+end
+
+for i=1,Njobs do
+	print(assert(socket.recv()))
+end
+
+assert(pool.wait())
+local stats = pool.stats()
+print(("Workers: %d, idle: %d, pending: %d"):format(stats.workers, stats.idle, stats.pending))
+
+-- shrinking stops surplus idle workers
+pool.resize(2)
+local deadline = zmq.now() + 2e9
+while pool.stats().workers > 2 and zmq.now() < deadline do
+	zmq.sleep(0)
+end
+stats = pool.stats()
+print(("Workers after resize(2): %d, max: %d"):format(stats.workers, stats.max))
+assert(stats.workers == 2)
+
+-- a finished future can be freed before it's collected
+local future = assert(pool.submit(function() return 1 end))
+assert(future.get() == 1)
+require('luazmq').poolFutureFree(future)
+local ok, err = future.get()
+assert(not ok and err == 'future is freed')
+future = nil
+collectgarbage()
+
+-- shared objects passed to a job and returned from it outlive the submitting state's references
+do
+	local future
+	do
+		local queue = zmq.queue(4)
+		future = assert(pool.submit(function(_ctx, queue)
+			local zmq = require 'zmq'
+			zmq.queue(queue).push('from job')
+			return queue
+		end, queue))
+	end
+	collectgarbage()
+	collectgarbage()
+	local queue = zmq.queue(assert(future.get()))
+	print('Returned queue: ', queue.pop())
+end
+
+-- a closed pool reports an error instead of touching freed memory
+pool.close()
+local ok, err = pool.stats()
+print('Stats after close: ', ok, err)
+assert(not ok and err == 'pool is closed')
+assert(not pool.submit(function() end))
+assert(not pool.wait(0))
+assert(not pool.resize(1))
+socket.close()
@@ -0,0 +1,49 @@
+local zmq = require 'zmq'
+
+local context = assert(zmq.context())
+
+-- jobs of very different cost are balanced by work stealing
+local pool = context.pool(4)
+
+local job = function(_ctx, n)
+	local sum = 0
+	for i=1,n do
+		sum = sum + i
+	end
+	return n, sum
+end
+
+local finished = 0
+local Njobs = 64
+
+for i=1,Njobs do
+	local n = (i % 8 == 0) and 10000000 or 1000
+	local future = assert(pool.submit(job, n))
+	future.onDone(function(future)
+		local n, sum = future.get()
+		print(("Job #%d: sum(1..%d) = %.0f"):format(future.id, n, sum))
+		finished = finished + 1
+	end)
+end
+
+-- futures are dispatched from an ordinary poll loop
+local poll = zmq.poll {
+	{pool.socket, zmq.ZMQ_POLLIN, function()
+		pool.dispatch()
+	end},
+}
+
+while finished < Njobs do
+	poll.start(100)
+end
+
+-- callback registered after the job is done is called right away
+local late = assert(pool.submit(job, 10))
+assert(late.get())
+local called = false
+late.onDone(function(future)
+	called = true
+end)
+assert(called)
+
+pool.close()
@@ -0,0 +1,72 @@
+local zmq = require 'zmq'
+
+local context, msg = assert(zmq.context())
+
+local frontend = assert(context.socket(zmq.ZMQ_PULL))
+assert(frontend.bind("inproc://frontend"))
+local orders = assert(context.socket(zmq.ZMQ_PUSH))
+assert(orders.bind("inproc://orders"))
+local other = assert(context.socket(zmq.ZMQ_PUSH))
+assert(other.bind("inproc://other"))
+
+local producer = assert(context.socket(zmq.ZMQ_PUSH))
+assert(producer.connect("inproc://frontend"))
+local ordersConsumer = assert(context.socket(zmq.ZMQ_PULL))
+assert(ordersConsumer.connect("inproc://orders"))
+local otherConsumer = assert(context.socket(zmq.ZMQ_PULL))
+assert(otherConsumer.connect("inproc://other"))
+
+-- rules are compiled once and matched in C++, the longest prefix wins
+local proxy = zmq.proxyStart(frontend, {orders, other}, nil, {
+	rules = {
+		{prefix = '', backend = 2},
+		{prefix = 'orders', backend = 1},
+		{prefix = 'orders.debug', drop = true},
+		{prefix = 'ticks', backend = 2, sample = 10},
+	},
+})
+
+producer.send('orders.new 1')
+producer.send('orders.debug ignored')
+for i=1,20 do
+	producer.send(('ticks %d'):format(i))
+end
+producer.send('misc')
+
+print('Orders: ', ordersConsumer.recv())
+print('Sampled: ', otherConsumer.recv())
+print('Sampled: ', otherConsumer.recv())
+print('Default: ', otherConsumer.recv())
+
+-- rules can be replaced while the proxy is running
+assert(proxy.setRules({
+	{prefix = 'ticks', backend = 1},
+}))
+producer.send('ticks after update')
+print('Orders: ', ordersConsumer.recv())
+
+-- a sampling rule must sample at least every message
+local ok, err = proxy.setRules({
+	{prefix = 'ticks', backend = 2, sample = 0},
+})
+print('Invalid sample: ', ok, err)
+assert(not ok)
+
+local stats = proxy.stats()
+print('Forwarded: ', stats.frontend.messages)
+print('Filtered: ', stats.frontend.filtered)
+
+assert(proxy.terminate())
+print('Join: ', proxy.join())
+
+-- backend indices of rules are table positions, an entry that isn't a socket is an error
+local ok, err = pcall(zmq.proxyStart, frontend, {orders, 'other'})
+print('Invalid backend: ', ok, err)
+assert(not ok)
+
+producer.close()
+ordersConsumer.close()
+otherConsumer.close()
+frontend.close()
+orders.close()
+other.close()
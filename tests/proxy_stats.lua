@@ -0,0 +1,79 @@
+local zmq = require 'zmq'
+
+local context, msg = assert(zmq.context())
+
+local frontend = assert(context.socket(zmq.ZMQ_PULL))
+assert(frontend.bind("inproc://frontend"))
+local backend = assert(context.socket(zmq.ZMQ_PUSH))
+assert(backend.bind("inproc://backend"))
+local control = assert(context.socket(zmq.ZMQ_PAIR))
+assert(control.bind("inproc://control"))
+
+local stats = zmq.proxyStats()
+local N = 10000
+
+-- producer, consumer and a monitor which reads live counters and stops the proxy
+local producer = function(_ctx, N)
+	local zmq = require 'zmq'
+	local context = assert(zmq.context(_ctx))
+	local socket = assert(context.socket(zmq.ZMQ_PUSH))
+	assert(socket.connect("inproc://frontend"))
+	for i=1,N do
+		socket.send(('message %d'):format(i))
+	end
+	socket.close()
+end
+
+local consumer = function(_ctx, N, stats)
+	local zmq = require 'zmq'
+	local context = assert(zmq.context(_ctx))
+	local stats = zmq.proxyStats(stats)
+	local socket = assert(context.socket(zmq.ZMQ_PULL))
+	assert(socket.connect("inproc://backend"))
+	local control = assert(context.socket(zmq.ZMQ_PAIR))
+	assert(control.connect("inproc://control"))
+
+	for i=1,N do
+		socket.recv()
+		if i % 2500 == 0 then
+			local s = stats.get()
+			print(('Forwarded: %d messages, %d bytes, %.0f msg/s, p99 %s ns'):format(
+				s.frontend.messages, s.frontend.bytes, s.frontend.rate, tostring(s.frontend.p99)))
+		end
+	end
+
+	control.send('TERMINATE')
+	socket.close()
+	control.close()
+end
+
+local threads = {
+	assert(context.thread2(consumer, N, stats)),
+	assert(context.thread2(producer, N)),
+}
+
+print('Proxy result: ', zmq.proxyRun(frontend, backend, nil, control, stats, {latency = true}))
+
+for _, thread in ipairs(threads) do
+	thread.join()
+end
+
+local s = stats.get()
+print('Total: ', s.frontend.messages, s.frontend.eagain, s.frontend.dropped)
+
+-- a stats object passed into a thread stays alive after this state collects it
+do
+	local thread
+	do
+		local shared = zmq.proxyStats()
+		thread = assert(context.thread2(function(_ctx, stats)
+			local zmq = require 'zmq'
+			zmq.sleep(1)
+			local stats = zmq.proxyStats(stats)
+			print('Stats in thread: ', stats.get().frontend.messages)
+		end, shared))
+	end
+	collectgarbage()
+	collectgarbage()
+	thread.join()
+end
@@ -0,0 +1,66 @@
+local zmq = require 'zmq'
+
+local context, msg = assert(zmq.context())
+
+local frontend = assert(context.socket(zmq.ZMQ_PULL))
+assert(frontend.bind("inproc://frontend"))
+local backend = assert(context.socket(zmq.ZMQ_PUSH))
+assert(backend.bind("inproc://backend"))
+
+local producer = assert(context.socket(zmq.ZMQ_PUSH))
+assert(producer.connect("inproc://frontend"))
+local consumer = assert(context.socket(zmq.ZMQ_PULL))
+assert(consumer.connect("inproc://backend"))
+
+-- forwarding runs on a native thread, this Lua state stays free
+local proxy = zmq.proxyStart(frontend, backend, nil, {latency = true})
+
+local N = 1000
+for i=1,N do
+	producer.send(('message %d'):format(i))
+end
+for i=1,N do
+	consumer.recv()
+end
+
+local stats = proxy.stats()
+print('Running: ', stats.running)
+print('Forwarded: ', stats.frontend.messages, stats.frontend.bytes)
+print('Latency p50/p99 (ns): ', stats.frontend.p50, stats.frontend.p99)
+
+assert(proxy.pause())
+producer.send('held while paused')
+zmq.sleep(1)
+print('Forwarded while paused: ', proxy.stats().frontend.messages)
+assert(proxy.resume())
+print('After resume: ', consumer.recv())
+
+assert(proxy.terminate())
+print('Join: ', proxy.join())
+
+producer.close()
+consumer.close()
+frontend.close()
+backend.close()
+
+-- sockets passed to the proxy stay open while it's running even if nothing else refers to them
+local proxy2
+do
+	local frontend = assert(context.socket(zmq.ZMQ_PULL))
+	assert(frontend.bind("inproc://frontend2"))
+	local backend = assert(context.socket(zmq.ZMQ_PUSH))
+	assert(backend.bind("inproc://backend2"))
+	proxy2 = zmq.proxyStart(frontend, backend)
+end
+collectgarbage()
+collectgarbage()
+
+producer = assert(context.socket(zmq.ZMQ_PUSH))
+assert(producer.connect("inproc://frontend2"))
+consumer = assert(context.socket(zmq.ZMQ_PULL))
+assert(consumer.connect("inproc://backend2"))
+producer.send('after collect')
+print('Forwarded after collect: ', consumer.recv())
+print('Join: ', proxy2.join())
+producer.close()
+consumer.close()
@@ -0,0 +1,95 @@
+local zmq = require 'zmq'
+
+local context = assert(zmq.context())
+
+-- control-plane messages without sockets
+local commands = zmq.queue(64, true)
+local replies = zmq.queue(64)
+
+local worker = function(_ctx, commands, replies)
+	local zmq = require 'zmq'
+	local commands = zmq.queue(commands)
+	local replies = zmq.queue(replies)
+	local running = true
+
+	local poll = zmq.poll()
+	poll.add(commands.fd, zmq.ZMQ_POLLIN, function()
+		local batch, count = commands.popBatch()
+		for i=1,count do
+			local command = batch[i]
+			if command == 'stop' then
+				running = false
+			else
+				replies.push(('done: %s'):format(tostring(command)))
+			end
+		end
+	end)
+
+	while running do
+		poll.start(100)
+	end
+	replies.push('stopped')
+end
+
+do
+	local thread = assert(context.thread2(worker, commands, replies))
+
+	print('Pushed: ', commands.push('reload', 42, true))
+
+	local received = 0
+	while received < 3 do
+		local reply = replies.pop()
+		if reply then
+			print('Reply: ', reply)
+			received = received + 1
+		else
+			zmq.sleep(0)
+		end
+	end
+
+	commands.push('stop')
+	thread.join()
+	print('Last reply: ', replies.pop())
+end
+
+-- the thread holds its own reference even if the queue is collected here before it's wrapped
+do
+	local thread
+	do
+		local queue = zmq.queue(4)
+		assert(queue.push('still alive') == 1)
+		thread = assert(context.thread2(function(_ctx, queue)
+			local zmq = require 'zmq'
+			zmq.sleep(1)
+			local queue = zmq.queue(queue)
+			print('Late receiver got: ', queue.pop())
+		end, queue))
+	end
+	collectgarbage()
+	collectgarbage()
+	thread.join()
+end
+
+-- an unsupported value rejects the whole call, nothing is pushed
+do
+	local queue = zmq.queue(4)
+	local ok, err = queue.push(1, 'two', {}, 4)
+	print('Unsupported value: ', ok, err)
+	assert(ok == false)
+	assert(queue.pop() == nil)
+	assert(queue.push(1, 2, 3, 4, 5) == 4)
+end
+
+-- a freed queue reports an error
+do
+	local queue = zmq.queue(4)
+	require('luazmq').queueFree(queue)
+	local ok, err = queue.push(1)
+	print('Push after free: ', ok, err)
+	assert(ok == false and err == 'queue is closed')
+	assert(not queue.pop())
+	assert(not queue.popBatch())
+	assert(not queue.size)
+end
+
+print('Exiting')
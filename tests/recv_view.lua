@@ -0,0 +1,27 @@
+local zmq = require 'zmq'
+
+local context = assert(zmq.context())
+local server = assert(context.socket(zmq.ZMQ_PAIR))
+local client = assert(context.socket(zmq.ZMQ_PAIR))
+
+assert(server.bind("inproc://view"))
+assert(client.connect("inproc://view"))
+
+assert(client.send("quote:EURUSD:1.0842", zmq.ZMQ_SNDMORE))
+assert(client.send("payload"))
+
+-- frame is kept inside zmq_msg_t, only requested parts are copied into Lua strings
+local view = assert(server.recvView())
+print('Length: ', #view)
+print('Prefix: ', view:sub(1, 5))
+print('Symbol: ', view:sub(7, 12))
+print('Separator at: ', view:find(':', 7))
+print('First byte: ', view:byte(1))
+print('More parts: ', view:more())
+
+-- frame payload copied once directly from message memory
+local data, more = assert(server.recvFrame())
+print('Second frame: ', data, more)
+
+client.close()
+server.close()
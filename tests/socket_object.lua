@@ -0,0 +1,57 @@
+local zmq = require 'zmq'
+
+local context, msg = assert(zmq.context())
+
+-- socket objects share one native metatable, methods are called with ':'
+local pull = assert(context.socketObject(zmq.ZMQ_PULL))
+pull:set('LINGER', 0)
+pull:set('rcvhwm', 5000)
+print('RCVHWM: ', pull:get('RCVHWM'))
+assert(pull:bind("inproc://socket_object"))
+print('LAST_ENDPOINT: ', pull:get('LAST_ENDPOINT'))
+
+-- table sockets and socket objects can be mixed
+local push = assert(context.socket(zmq.ZMQ_PUSH))
+assert(push.connect("inproc://socket_object"))
+
+push.send('a', zmq.ZMQ_SNDMORE)
+push.send('b')
+repeat
+	print('Frame: ', pull:recv())
+until not pull:more()
+
+push.sendFrames({'c', 'd'})
+for i, frame in ipairs(pull:recvFrames()) do
+	print('Frame ' .. i .. ': ', frame)
+end
+
+local poll = zmq.poll()
+poll.add(pull, zmq.ZMQ_POLLIN, function(socket)
+	print('Polled: ', pull:recv())
+end)
+push.send('e')
+poll.start(100)
+poll.remove(pull)
+
+push.close()
+print(pull)
+assert(pull:close())
+
+-- a closed socket object fails with ENOTSOCK, counters are not touched
+zmq.statsEnable(true)
+local ok, err = pull:recv(zmq.ZMQ_DONTWAIT)
+print('Recv after close: ', ok, err)
+assert(ok == false and err)
+assert(not pull:send('x'))
+assert(pull:close())
+zmq.statsEnable(false)
+
+-- closing through the low-level binding leaves nothing for the collector to close again
+local luazmq = require 'luazmq'
+local dealer = assert(context.socketObject(zmq.ZMQ_DEALER))
+assert(luazmq.close(dealer))
+assert(not luazmq.close(dealer))
+assert(dealer:close())
+dealer = nil
+collectgarbage()
+print('Double close: ok')
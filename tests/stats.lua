@@ -0,0 +1,34 @@
+local zmq = require 'zmq'
+
+local context, msg = assert(zmq.context())
+
+-- counting has to be enabled before the measured calls
+zmq.statsEnable(true)
+
+local pull = assert(context.socket(zmq.ZMQ_PULL))
+assert(pull.bind("inproc://stats"))
+local push = assert(context.socket(zmq.ZMQ_PUSH))
+assert(push.connect("inproc://stats"))
+
+local N = 1000
+for i=1,N do
+	push.send(('message %d'):format(i))
+end
+for i=1,N do
+	pull.recv()
+end
+-- empty socket, counted as EAGAIN
+pull.recv(nil, zmq.ZMQ_DONTWAIT)
+
+local s = pull.stats()
+print('Received: ', s.received.messages, s.received.bytes)
+print('EAGAIN: ', s.received.eagain)
+print('Blocked (s): ', s.received.blocked)
+
+for id, stats in pairs(zmq.stats().sockets) do
+	print(id, stats.sent.messages, stats.received.messages)
+end
+
+zmq.statsEnable(false)
+push.close()
+pull.close()
@@ -34,7 +34,7 @@ local worker = function(_ctx, ...)
 
 			-- a job command
 			if job and id then
-				local jobFn = loadstring(job)
+				local jobFn = zmq.loadCached(job)
 
 				local r,m = pcall(jobFn, id)
 				if r then
@@ -0,0 +1,48 @@
+local zmq = require 'zmq'
+
+local context, msg = assert(zmq.context())
+
+-- result socket
+local socket,msg = assert(context.socket(zmq.ZMQ_PULL))
+assert(socket.bind("inproc://results"))
+
+-- nested configuration table with a cycle, passed to the thread in a single frame
+local config = {
+	name = 'worker',
+	limits = {low = 1, high = 2.5, enabled = true},
+	tags = {'a', 'b', 'c'},
+	format = function(name, n)
+		return ("%s: %d"):format(name, n)
+	end,
+}
+config.self = config
+
+local worker = function(_ctx, config, count)
+	local zmq = require 'zmq'
+	local context, msg = assert(zmq.context(_ctx))
+
+	local socket,msg = assert(context.socket(zmq.ZMQ_PUSH))
+	assert(socket.connect("inproc://results"))
+
+	assert(config.self == config)
+	assert(config.limits.enabled and config.limits.high == 2.5)
+	assert(#config.tags == 3)
+
+	for i=1,count do
+		socket.send(config.format(config.name, i))
+	end
+	socket.close()
+end
+
+do
+	local N = 5
+	local thread = assert(context.thread2(worker, config, N))
+
+	for i=1,N do
+		print(socket.recv())
+	end
+	thread.join()
+end
+
+socket.close()
+print('Exiting')
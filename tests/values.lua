@@ -0,0 +1,48 @@
+local zmq = require 'zmq'
+
+local context = assert(zmq.context())
+local server = assert(context.socket(zmq.ZMQ_PAIR))
+local client = assert(context.socket(zmq.ZMQ_PAIR))
+
+assert(server.bind("inproc://values"))
+assert(client.connect("inproc://values"))
+
+-- structured message encoded into a single frame without string building on Lua side
+local order = {
+	id = 42,
+	symbol = 'EURUSD',
+	price = 1.0842,
+	buy = true,
+	legs = {
+		{qty = 100, venue = 'A'},
+		{qty = 250, venue = 'B'},
+	},
+}
+order.parent = order
+
+assert(client.sendValue(order))
+assert(client.sendValue('plain string'))
+
+local value = assert(server.recvValue())
+print('Order: ', value.id, value.symbol, value.price, value.buy)
+for i, leg in ipairs(value.legs) do
+	print('Leg: ', i, leg.qty, leg.venue)
+end
+print('Cycle kept: ', value.parent == value)
+
+print('String: ', server.recvValue())
+
+-- functions are accepted only from trusted peers
+assert(client.sendValue(function() return 'hello' end))
+print('Untrusted: ', server.recvValue())
+assert(client.sendValue(function() return 'hello' end))
+print('Trusted: ', server.recvValue(0, true)())
+
+-- a rejected frame still drops the channel reference taken by sendValue
+local channel = zmq.channel(4)
+assert(client.sendValue(channel))
+print('Untrusted channel: ', server.recvValue())
+require('luazmq').channelFree(channel)
+
+client.close()
+server.close()